@@ -0,0 +1,352 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "versioningCompiler/CompileScheduler.hpp"
+#include "versioningCompiler/CompilerImpl/SystemCompiler.hpp"
+#include "versioningCompiler/Reclaimer.hpp"
+#include "versioningCompiler/ThreadPool.hpp"
+#include "versioningCompiler/Version.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#ifndef FORCED_PATH_TO_TEST
+#define FORCED_PATH_TO_TEST "../libVersioningCompiler/test_code"
+#endif
+#define PATH_TO_C_TEST_CODE FORCED_PATH_TO_TEST "/test_code.c"
+
+#ifndef TEST_FUNCTION
+#define TEST_FUNCTION "test_function"
+#endif
+
+#ifndef TEST_FUNCTION_LBL
+#define TEST_FUNCTION_LBL "TEST_FUNCTION"
+#endif
+
+#ifndef DEFAULT_COMPILER_DIR
+#define DEFAULT_COMPILER_DIR "/usr/bin"
+#endif
+
+#ifndef DEFAULT_COMPILER_NAME
+#define DEFAULT_COMPILER_NAME "gcc"
+#endif
+
+#define ASYNC_TEST_DIR "./test_async_dir"
+#define NUM_VARIANTS 16
+
+typedef float (*compute_func_t)(int);
+int ret_value = 0;
+
+void checkResult(bool passed, const std::string &message) {
+  if (passed) {
+    std::cout << "PASSED" << std::endl;
+  } else {
+    std::cout << "FAILED: " << message << std::endl;
+    ret_value = 1;
+  }
+}
+
+bool checkSymbol(const vc::version_ptr_t &v, int x) {
+  if (!v->hasLoadedSymbol()) {
+    return false;
+  }
+  compute_func_t f = (compute_func_t)v->getSymbol();
+  return std::fabs(f(x) - (float)(x * x)) <
+         10 * std::numeric_limits<float>::epsilon();
+}
+
+int countLogLines(const std::filesystem::path &log_file,
+                  const std::string &expected) {
+  std::ifstream log(log_file);
+  std::string line;
+  int count = 0;
+  while (std::getline(log, line)) {
+    if (line.find(expected) != std::string::npos) {
+      count++;
+    }
+  }
+  return count;
+}
+
+int main(int argc, char const *argv[]) {
+  std::cout << "\n=== libVC_testAsync ===\n" << std::endl;
+  std::cout << ">>> Test Configuration" << std::endl
+            << "- Work-stealing pool with nested submissions." << std::endl
+            << "- Batch of " << NUM_VARIANTS
+            << " variants compiled in the library thread pool." << std::endl
+            << "- Concurrent compilations of the same Version." << std::endl
+            << "- Stage-pipelined scheduler with bounded lanes." << std::endl
+            << "- Priorities, deadlines and cancellation." << std::endl
+            << "- Candidates share interned options and configuration."
+            << std::endl;
+  std::filesystem::remove_all(ASYNC_TEST_DIR);
+  std::filesystem::create_directories(ASYNC_TEST_DIR);
+
+  vc::compiler_ptr_t compiler = vc::make_compiler<vc::SystemCompiler>(
+      "async_comp", std::filesystem::u8path(DEFAULT_COMPILER_NAME),
+      std::filesystem::u8path(ASYNC_TEST_DIR),
+      std::filesystem::u8path(ASYNC_TEST_DIR) / "async.log",
+      std::filesystem::u8path(DEFAULT_COMPILER_DIR), false);
+
+  std::cout << "\n>>> Test Cases" << std::endl;
+
+  // nested submissions land in the worker queue and get stolen by the others
+  std::cout << "Test 01: nested tasks complete\t\t\t";
+  std::atomic<int> counter(0);
+  {
+    vc::ThreadPool pool(4);
+    pool.submit([&pool, &counter]() {
+      for (int i = 0; i < 100; i++) {
+        pool.submit([&counter]() { counter++; });
+      }
+    });
+  } // the destructor drains the queues
+  checkResult(counter.load() == 100, std::to_string(counter.load()) +
+                                         " nested tasks executed");
+
+  std::cout << "Test 02: exceptions reach the handle\t\t";
+  bool thrown = false;
+  try {
+    vc::ThreadPool::getDefault()
+        .async([]() -> int { throw std::runtime_error("expected"); })
+        .get();
+  } catch (const std::runtime_error &) {
+    thrown = true;
+  }
+  checkResult(thrown, "exception lost");
+
+  std::vector<vc::version_ptr_t> versions;
+  for (int i = 0; i < NUM_VARIANTS; i++) {
+    vc::Version::Builder builder(PATH_TO_C_TEST_CODE, TEST_FUNCTION, compiler);
+    builder.addFunctionFlag(TEST_FUNCTION_LBL);
+    builder.addDefine("VARIANT", i);
+    builder.options({vc::Option("o", "-O", std::to_string(i % 4))});
+    versions.push_back(builder.build());
+  }
+  std::vector<std::shared_future<bool>> handles = vc::submit(versions);
+  bool all_ok = handles.size() == versions.size();
+  for (std::size_t i = 0; i < handles.size(); i++) {
+    all_ok = handles[i].get() && checkSymbol(versions[i], (int)i) && all_ok;
+  }
+  std::cout << "Test 03: batch compilation\t\t\t";
+  checkResult(all_ok, "some variant failed");
+
+  // the handle keeps the version alive
+  std::cout << "Test 04: handle outlives caller reference\t";
+  vc::version_ptr_t single;
+  {
+    vc::Version::Builder builder(PATH_TO_C_TEST_CODE, TEST_FUNCTION, compiler);
+    builder.addFunctionFlag(TEST_FUNCTION_LBL);
+    single = builder.build();
+  }
+  std::shared_future<bool> h = single->compileAsync();
+  single.reset();
+  checkResult(h.get(), "asynchronous compile failed");
+
+  std::cout << "Test 05: prepareIRAsync without IR support\t";
+  checkResult(!versions[0]->prepareIRAsync().get(),
+              "system compiler has no IR support");
+
+  // concurrent callers share the same compilation
+  std::cout << "Test 06: single-flight compile\t\t\t";
+  vc::version_ptr_t shared;
+  {
+    vc::Version::Builder builder(PATH_TO_C_TEST_CODE, TEST_FUNCTION, compiler);
+    builder.addFunctionFlag(TEST_FUNCTION_LBL);
+    builder.addDefine("SHARED", 1);
+    shared = builder.build();
+  }
+  std::atomic<int> compiled(0);
+  std::vector<std::thread> callers;
+  for (int i = 0; i < 8; i++) {
+    callers.emplace_back([&shared, &compiled]() {
+      if (shared->compile()) {
+        compiled++;
+      }
+    });
+  }
+  for (auto &t : callers) {
+    t.join();
+  }
+  const int invocations = countLogLines(
+      std::filesystem::u8path(ASYNC_TEST_DIR) / "async.log", shared->getID());
+  checkResult(compiled.load() == 8 && invocations == 1,
+              std::to_string(invocations) + " compiler invocations");
+
+  std::cout << "Test 07: registry deduplicates Versions\t\t";
+  auto registry = std::make_shared<vc::VersionRegistry>();
+  auto intern = [&](int variant) {
+    vc::Version::Builder builder(PATH_TO_C_TEST_CODE, TEST_FUNCTION, compiler);
+    builder.setRegistry(registry);
+    builder.addFunctionFlag(TEST_FUNCTION_LBL);
+    builder.addDefine("VARIANT", variant);
+    return builder.build();
+  };
+  vc::version_ptr_t r1 = intern(1);
+  vc::version_ptr_t r2 = intern(1);
+  vc::version_ptr_t r3 = intern(2);
+  const bool deduplicated = r1 == r2 && r1 != r3 && registry->size() == 2;
+  r1.reset();
+  r2.reset();
+  checkResult(deduplicated && registry->size() == 1,
+              "unexpected registry content");
+
+  // compile() joins the scheduled compilation
+  std::cout << "Test 08: pipelined scheduler\t\t\t";
+  std::vector<vc::version_ptr_t> pipelined;
+  for (int i = 0; i < NUM_VARIANTS; i++) {
+    vc::Version::Builder builder(PATH_TO_C_TEST_CODE, TEST_FUNCTION, compiler);
+    builder.addFunctionFlag(TEST_FUNCTION_LBL);
+    builder.addDefine("PIPELINED", i);
+    pipelined.push_back(builder.build());
+  }
+  bool pipelined_ok = true;
+  int pipelined_invocations = 0;
+  {
+    vc::CompileScheduler scheduler(2, 2, 2);
+    pipelined_ok = scheduler.workers(vc::CompileScheduler::LOAD) == 1;
+    handles = scheduler.submit(pipelined);
+    pipelined_ok = pipelined.back()->compile() && pipelined_ok;
+    for (std::size_t i = 0; i < handles.size(); i++) {
+      pipelined_ok = handles[i].get() && checkSymbol(pipelined[i], (int)i) &&
+                     pipelined_ok;
+    }
+    pipelined_invocations =
+        countLogLines(std::filesystem::u8path(ASYNC_TEST_DIR) / "async.log",
+                      pipelined.back()->getID());
+  }
+  checkResult(pipelined_ok && pipelined_invocations == 1,
+              "some variant failed or compiled twice");
+
+  // a single codegen worker: the hot Version overtakes the queued ones
+  std::cout << "Test 09: priority and cancellation by tag\t";
+  std::vector<vc::version_ptr_t> speculative;
+  for (int i = 0; i < NUM_VARIANTS; i++) {
+    vc::Version::Builder builder(PATH_TO_C_TEST_CODE, TEST_FUNCTION, compiler);
+    builder.addFunctionFlag(TEST_FUNCTION_LBL);
+    builder.addDefine("SPECULATIVE", i);
+    builder.addTag("speculative");
+    speculative.push_back(builder.build());
+  }
+  vc::version_ptr_t hot;
+  {
+    vc::Version::Builder builder(PATH_TO_C_TEST_CODE, TEST_FUNCTION, compiler);
+    builder.addFunctionFlag(TEST_FUNCTION_LBL);
+    builder.addDefine("HOT", 1);
+    hot = builder.build();
+  }
+  bool overtaken = false;
+  bool dropped = false;
+  std::size_t cancelled = 0;
+  {
+    vc::CompileScheduler scheduler(1, 1, 1);
+    handles = scheduler.submit(speculative);
+    vc::CompileScheduler::JobOptions urgent;
+    urgent.priority = 10;
+    const bool hot_ok =
+        scheduler.submit(hot, urgent).get() && checkSymbol(hot, 3);
+    overtaken = hot_ok && handles.back().wait_for(std::chrono::seconds(0)) !=
+                              std::future_status::ready;
+    cancelled = scheduler.cancel("speculative");
+    for (auto &handle : handles) {
+      dropped = !handle.get() || dropped;
+    }
+    dropped = dropped &&
+              scheduler.pendingTasks(vc::CompileScheduler::CODEGEN) == 0;
+  }
+  checkResult(overtaken && cancelled > 0 && dropped,
+              "hot Version not prioritized or cancellation ignored");
+
+  std::cout << "Test 10: expired deadline\t\t\t";
+  vc::version_ptr_t late;
+  {
+    vc::Version::Builder builder(PATH_TO_C_TEST_CODE, TEST_FUNCTION, compiler);
+    builder.addFunctionFlag(TEST_FUNCTION_LBL);
+    builder.addDefine("LATE", 1);
+    late = builder.build();
+  }
+  vc::CompileScheduler::JobOptions expired;
+  expired.deadline = std::chrono::steady_clock::now();
+  const bool late_ok =
+      vc::CompileScheduler::getDefault().submit(late, expired).get();
+  const int late_invocations = countLogLines(
+      std::filesystem::u8path(ASYNC_TEST_DIR) / "async.log", late->getID());
+  checkResult(!late_ok && late_invocations == 0, "compiled past its deadline");
+
+  std::cout << "Test 11: cancellation stops a running process\t";
+  vc::CancellationToken token;
+  const auto start = std::chrono::steady_clock::now();
+  std::thread canceller([&token]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    token.cancel();
+  });
+  const vc::ProcessResult sleeper =
+      vc::ProcessLauncher::run({"sleep", "30"}, nullptr, {}, &token);
+  canceller.join();
+  checkResult(sleeper.cancelled && !sleeper.success() &&
+                  std::chrono::steady_clock::now() - start <
+                      std::chrono::seconds(10),
+              "process not terminated");
+
+  // only the changed option list is copied by the second build
+  std::cout << "Test 12: candidates share their configuration\t";
+  vc::Version::Builder candidates(PATH_TO_C_TEST_CODE, TEST_FUNCTION, compiler);
+  candidates.addFunctionFlag(TEST_FUNCTION_LBL);
+  candidates.options({vc::Option("o", "-O", "2")});
+  vc::version_ptr_t c1 = candidates.build();
+  candidates.options({vc::Option("o", "-O", "3")});
+  vc::version_ptr_t c2 = candidates.build();
+  const vc::Option o2("o", "-O", "2");
+  const bool interned =
+      o2.getID() == vc::Option("o", "-O", "2").getID() &&
+      vc::Option("level", "-O", "2") == c1->getOptionList().back() &&
+      vc::Option("level", "-O", "2").getID() !=
+          c1->getOptionList().back().getID();
+  checkResult(interned &&
+                  &c1->getFunctionNames() == &c2->getFunctionNames() &&
+                  &c1->getFileNames_src() == &c2->getFileNames_src() &&
+                  &c1->getGenIRoptionList() == &c2->getGenIRoptionList() &&
+                  &c1->getOptionList() != &c2->getOptionList() &&
+                  c2->getOptionList().back().getValue() == "3",
+              "configuration not shared");
+  c1.reset();
+  c2.reset();
+  candidates.reset();
+
+  speculative.clear();
+  hot.reset();
+  late.reset();
+  pipelined.clear();
+  versions.clear();
+  single.reset();
+  shared.reset();
+  r3.reset();
+  vc::Reclaimer::getDefault().drain(); // files are removed in background
+  std::filesystem::remove_all(ASYNC_TEST_DIR);
+  return ret_value;
+}
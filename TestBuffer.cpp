@@ -0,0 +1,151 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "versioningCompiler/CompilerImpl/SystemCompiler.hpp"
+#include "versioningCompiler/Reclaimer.hpp"
+#include "versioningCompiler/Version.hpp"
+
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#ifndef DEFAULT_COMPILER_DIR
+#define DEFAULT_COMPILER_DIR "/usr/bin"
+#endif
+
+#ifndef DEFAULT_COMPILER_NAME
+#define DEFAULT_COMPILER_NAME "gcc"
+#endif
+
+#define BUFFER_TEST_DIR "./test_buffer_dir"
+
+typedef int (*kernel_func_t)(int);
+int ret_value = 0;
+
+void checkResult(bool passed, const std::string &message) {
+  if (passed) {
+    std::cout << "PASSED" << std::endl;
+  } else {
+    std::cout << "FAILED: " << message << std::endl;
+    ret_value = 1;
+  }
+}
+
+// a tiny generated kernel, as a code generator would emit it
+std::string make_kernel(int factor) {
+  return "int kernel(int x) { return x * " + std::to_string(factor) + "; }\n";
+}
+
+int main(int argc, char const *argv[]) {
+  std::cout << "\n=== libVC_testBuffer ===\n" << std::endl;
+  std::cout << ">>> Test Configuration" << std::endl
+            << "- Versions are compiled from in-memory source strings."
+            << std::endl
+            << "- Diskless mode loads shared objects from anonymous memory."
+            << std::endl;
+  std::filesystem::remove_all(BUFFER_TEST_DIR);
+  std::filesystem::create_directories(BUFFER_TEST_DIR);
+
+  vc::compiler_ptr_t c = vc::make_compiler<vc::SystemCompiler>(
+      "buffer_comp", std::filesystem::u8path(DEFAULT_COMPILER_NAME),
+      std::filesystem::u8path(BUFFER_TEST_DIR),
+      std::filesystem::u8path(BUFFER_TEST_DIR) / "buffer.log",
+      std::filesystem::u8path(DEFAULT_COMPILER_DIR), false);
+
+  vc::Version::Builder b3;
+  b3.setCompiler(c);
+  b3.addFunctionName("kernel");
+  b3.addSourceBuffer("kernel.c", make_kernel(3));
+  vc::version_ptr_t v3 = b3.build();
+
+  vc::Version::Builder b5;
+  b5.setCompiler(c);
+  b5.addFunctionName("kernel");
+  b5.addSourceBuffer("kernel.c", make_kernel(5));
+  vc::version_ptr_t v5 = b5.build();
+
+  // two in-memory translation units
+  vc::Version::Builder b2;
+  b2.setCompiler(c);
+  b2.addFunctionName("kernel");
+  b2.addSourceBuffer("kernel.c",
+                     "int helper(int);\n"
+                     "int kernel(int x) { return helper(x) + 1; }\n");
+  b2.addSourceBuffer("helper.c", "int helper(int x) { return x * 2; }\n");
+  vc::version_ptr_t v2 = b2.build();
+
+  // diskless: in-memory sources and in-memory shared objects
+  vc::compiler_ptr_t mc = vc::make_compiler<vc::SystemCompiler>(
+      "memfd_comp", std::filesystem::u8path(DEFAULT_COMPILER_NAME),
+      std::filesystem::u8path(BUFFER_TEST_DIR),
+      std::filesystem::u8path(BUFFER_TEST_DIR) / "memfd.log",
+      std::filesystem::u8path(DEFAULT_COMPILER_DIR), false);
+  const bool memfd_enabled = mc->enableMemoryBinaries();
+  vc::Version::Builder bm;
+  bm.setCompiler(mc);
+  bm.addFunctionName("kernel");
+  bm.addSourceBuffer("kernel.c", make_kernel(4));
+  vc::version_ptr_t vm = bm.build();
+
+  const bool v3_ok = v3->compile();
+  const bool v5_ok = v5->compile();
+  const bool v2_ok = v2->compile();
+
+  std::cout << "\n>>> Test Cases" << std::endl;
+  std::cout << "Test 01: compile from a source buffer\t\t";
+  kernel_func_t f3 = v3_ok ? (kernel_func_t)v3->getSymbol() : nullptr;
+  checkResult(f3 && f3(7) == 21, "v3 symbol unavailable or wrong");
+  std::cout << "Test 02: same name, different buffer\t\t";
+  kernel_func_t f5 = v5_ok ? (kernel_func_t)v5->getSymbol() : nullptr;
+  checkResult(f5 && f5(7) == 35, "v5 symbol unavailable or wrong");
+  std::cout << "Test 03: multiple source buffers\t\t";
+  kernel_func_t f2 = v2_ok ? (kernel_func_t)v2->getSymbol() : nullptr;
+  checkResult(f2 && f2(7) == 15, "v2 symbol unavailable or wrong");
+  std::cout << "Test 04: no source file written\t\t\t";
+  bool source_found = std::filesystem::exists("kernel.c");
+  for (const auto &entry :
+       std::filesystem::directory_iterator(BUFFER_TEST_DIR)) {
+    const std::string extension = entry.path().extension().string();
+    source_found = source_found || extension == ".c";
+  }
+  checkResult(!source_found, "source buffer written to disk");
+
+  std::cout << "Test 05: load from anonymous memory\t\t";
+  const bool vm_ok = memfd_enabled && vm->compile();
+  kernel_func_t fm = vm_ok ? (kernel_func_t)vm->getSymbol() : nullptr;
+  checkResult(fm && fm(7) == 28, "vm symbol unavailable or wrong");
+  std::cout << "Test 06: no shared object written\t\t";
+  const bool binary_found =
+      vm->getFileName_bin().string().rfind("/proc/", 0) != 0 ||
+      std::filesystem::exists(std::filesystem::u8path(BUFFER_TEST_DIR) /
+                              ("lib" + vm->getID() + ".so"));
+  vm->fold();
+  kernel_func_t fr = (kernel_func_t)vm->reload();
+  checkResult(!binary_found && fr && fr(7) == 28,
+              "shared object written to disk");
+
+  v3.reset();
+  v5.reset();
+  v2.reset();
+  vm.reset();
+  vc::Reclaimer::getDefault().drain(); // files are removed in background
+  std::filesystem::remove_all(BUFFER_TEST_DIR);
+  return ret_value;
+}
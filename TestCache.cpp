@@ -0,0 +1,154 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "versioningCompiler/CompilerImpl/SystemCompiler.hpp"
+#include "versioningCompiler/Reclaimer.hpp"
+#include "versioningCompiler/Version.hpp"
+
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+
+#ifndef FORCED_PATH_TO_TEST
+#define FORCED_PATH_TO_TEST "../libVersioningCompiler/test_code"
+#endif
+#define PATH_TO_C_TEST_CODE FORCED_PATH_TO_TEST "/test_code.c"
+
+#ifndef TEST_FUNCTION
+#define TEST_FUNCTION "test_function"
+#endif
+
+#ifndef TEST_FUNCTION_LBL
+#define TEST_FUNCTION_LBL "TEST_FUNCTION"
+#endif
+
+#ifndef DEFAULT_COMPILER_DIR
+#define DEFAULT_COMPILER_DIR "/usr/bin"
+#endif
+
+#ifndef DEFAULT_COMPILER_NAME
+#define DEFAULT_COMPILER_NAME "gcc"
+#endif
+
+#define CACHE_TEST_DIR "./test_cache_dir"
+
+typedef float (*compute_func_t)(int);
+int ret_value = 0;
+
+void checkResult(bool passed, const std::string &message) {
+  if (passed) {
+    std::cout << "PASSED" << std::endl;
+  } else {
+    std::cout << "FAILED: " << message << std::endl;
+    ret_value = 1;
+  }
+}
+
+bool log_contains(const std::filesystem::path &log_file,
+                  const std::string &expected) {
+  std::ifstream log(log_file);
+  std::string line;
+  while (std::getline(log, line)) {
+    if (line.find(expected) != std::string::npos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// A fresh compiler instance with its own log behaves like another process
+// sharing the same working directory.
+vc::compiler_ptr_t make_cached_compiler(const std::string &log_name) {
+  vc::compiler_ptr_t c = vc::make_compiler<vc::SystemCompiler>(
+      "cached_comp", std::filesystem::u8path(DEFAULT_COMPILER_NAME),
+      std::filesystem::u8path(CACHE_TEST_DIR),
+      std::filesystem::u8path(CACHE_TEST_DIR) / log_name,
+      std::filesystem::u8path(DEFAULT_COMPILER_DIR), false);
+  c->enableArtifactCache();
+  return c;
+}
+
+vc::version_ptr_t make_version(const vc::compiler_ptr_t &c,
+                               const vc::opt_list_t &options) {
+  vc::Version::Builder builder(PATH_TO_C_TEST_CODE, TEST_FUNCTION, c);
+  builder.addFunctionFlag(TEST_FUNCTION_LBL);
+  builder.options(options);
+  return builder.build();
+}
+
+int main(int argc, char const *argv[]) {
+  std::cout << "\n=== libVC_testCache ===\n" << std::endl;
+  std::cout << ">>> Test Configuration" << std::endl
+            << "- Two compiler instances share the same artifact cache."
+            << std::endl
+            << "- The second one should never invoke the compiler."
+            << std::endl;
+  std::filesystem::remove_all(CACHE_TEST_DIR);
+  std::filesystem::create_directories(CACHE_TEST_DIR);
+
+  const vc::opt_list_t good = {vc::Option("o", "-O", "2")};
+  const vc::opt_list_t bad = {vc::Option("werror", "-Werror"),
+                              vc::Option("wconv", "-Wconversion")};
+
+  vc::compiler_ptr_t first = make_cached_compiler("first.log");
+  vc::version_ptr_t v1 = make_version(first, good);
+  vc::version_ptr_t v1_bad = make_version(first, bad);
+  const bool v1_ok = v1->compile();
+  const bool v1_bad_ok = v1_bad->compile();
+
+  vc::compiler_ptr_t second = make_cached_compiler("second.log");
+  vc::version_ptr_t v2 = make_version(second, good);
+  vc::version_ptr_t v2_bad = make_version(second, bad);
+  const bool v2_ok = v2->compile();
+  const bool v2_bad_ok = v2_bad->compile();
+
+  std::cout << "\n>>> Test Cases" << std::endl;
+  std::cout << "Test 01: cold compilation\t\t\t";
+  checkResult(v1_ok && v1->getSymbol(), "v1 not compiled");
+  std::cout << "Test 02: failing configuration\t\t\t";
+  checkResult(!v1_bad_ok, "v1_bad should not compile");
+  std::cout << "Test 03: cache hit produces a working symbol\t";
+  compute_func_t f = v2_ok ? (compute_func_t)v2->getSymbol() : nullptr;
+  checkResult(f && std::fabs(f(3) - 9.f) <
+                       10 * std::numeric_limits<float>::epsilon(),
+              "v2 symbol unavailable or wrong");
+  std::cout << "Test 04: cache hit does not invoke compiler\t";
+  checkResult(!log_contains(std::filesystem::u8path(CACHE_TEST_DIR) /
+                                "second.log",
+                            "-shared"),
+              "compiler invoked on cache hit");
+  std::cout << "Test 05: known failure is not rebuilt\t\t";
+  checkResult(!v2_bad_ok && !log_contains(std::filesystem::u8path(
+                                              CACHE_TEST_DIR) /
+                                              "second.log",
+                                          "-Werror"),
+              "failing configuration compiled again");
+
+  v1.reset();
+  v1_bad.reset();
+  v2.reset();
+  v2_bad.reset();
+  vc::Reclaimer::getDefault().drain(); // files are removed in background
+  std::filesystem::remove_all(CACHE_TEST_DIR);
+  return ret_value;
+}
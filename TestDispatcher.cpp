@@ -0,0 +1,765 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "versioningCompiler/CompilerImpl/SystemCompiler.hpp"
+#include "versioningCompiler/Dispatcher.hpp"
+#include "versioningCompiler/Epoch.hpp"
+#include "versioningCompiler/GuardedSpecialization.hpp"
+#include "versioningCompiler/MemoryBudgetManager.hpp"
+#include "versioningCompiler/ProfileGuidedFunction.hpp"
+#include "versioningCompiler/ProfiledFunction.hpp"
+#include "versioningCompiler/Reclaimer.hpp"
+#include "versioningCompiler/SharedObjectManager.hpp"
+#include "versioningCompiler/SymbolTable.hpp"
+#include "versioningCompiler/Version.hpp"
+#include "versioningCompiler/VersionSelector.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef FORCED_PATH_TO_TEST
+#define FORCED_PATH_TO_TEST "../libVersioningCompiler/test_code"
+#endif
+#define PATH_TO_C_TEST_CODE FORCED_PATH_TO_TEST "/test_code.c"
+
+#ifndef TEST_FUNCTION
+#define TEST_FUNCTION "test_function"
+#endif
+
+#ifndef TEST_FUNCTION_LBL
+#define TEST_FUNCTION_LBL "TEST_FUNCTION"
+#endif
+
+#ifndef DEFAULT_COMPILER_DIR
+#define DEFAULT_COMPILER_DIR "/usr/bin"
+#endif
+
+#ifndef DEFAULT_COMPILER_NAME
+#define DEFAULT_COMPILER_NAME "gcc"
+#endif
+
+#define DISPATCHER_TEST_DIR "./test_dispatcher_dir"
+#define NUM_VERSIONS 8
+#define NUM_READERS 4
+
+typedef float (*compute_func_t)(int);
+int ret_value = 0;
+
+// heap allocations made by the calling thread
+thread_local long allocations = 0;
+
+// the replaced allocation functions use malloc() and free(). The helpers are
+// not inlined, so the compiler does not pair free() with operator new.
+__attribute__((noinline)) void *countedAlloc(std::size_t size,
+                                             std::size_t align) {
+  allocations++;
+  void *p = nullptr;
+  if (posix_memalign(&p, std::max(align, sizeof(void *)), size ? size : 1)) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+__attribute__((noinline)) void countedFree(void *p) noexcept {
+  std::free(p);
+  return;
+}
+
+void *operator new(std::size_t size) {
+  return countedAlloc(size, alignof(std::max_align_t));
+}
+
+void *operator new(std::size_t size, std::align_val_t align) {
+  return countedAlloc(size, static_cast<std::size_t>(align));
+}
+
+void *operator new[](std::size_t size) {
+  return countedAlloc(size, alignof(std::max_align_t));
+}
+
+void *operator new[](std::size_t size, std::align_val_t align) {
+  return countedAlloc(size, static_cast<std::size_t>(align));
+}
+
+void operator delete(void *p) noexcept { countedFree(p); }
+
+void operator delete(void *p, std::size_t) noexcept { countedFree(p); }
+
+void operator delete(void *p, std::align_val_t) noexcept { countedFree(p); }
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+  countedFree(p);
+}
+
+void operator delete[](void *p) noexcept { countedFree(p); }
+
+void operator delete[](void *p, std::size_t) noexcept { countedFree(p); }
+
+void operator delete[](void *p, std::align_val_t) noexcept { countedFree(p); }
+
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+  countedFree(p);
+}
+
+void checkResult(bool passed, const std::string &message) {
+  if (passed) {
+    std::cout << "PASSED" << std::endl;
+  } else {
+    std::cout << "FAILED: " << message << std::endl;
+    ret_value = 1;
+  }
+}
+
+// kernel whose cost is iterations, or n if iterations is empty
+std::string make_kernel(const std::string &iterations) {
+  return "float kernel(int n) {\n"
+         "  volatile float s = 0;\n"
+         "  for (int i = 0; i < " +
+         (iterations.empty() ? std::string("n") : iterations) +
+         "; i++) s += 1;\n"
+         "  return n;\n"
+         "}\n";
+}
+
+vc::version_ptr_t build_kernel(const vc::compiler_ptr_t &c,
+                               const std::string &iterations) {
+  vc::Version::Builder builder;
+  builder.setCompiler(c);
+  builder.addFunctionName("kernel");
+  builder.addSourceBuffer("kernel.c", make_kernel(iterations));
+  vc::version_ptr_t v = builder.build();
+  v->compile();
+  return v;
+}
+
+// transparent huge pages enabled, or explicit ones reserved
+bool huge_pages_available() {
+  std::ifstream thp("/sys/kernel/mm/transparent_hugepage/enabled");
+  std::string mode;
+  if (std::getline(thp, mode) && mode.find("[never]") == std::string::npos) {
+    return true;
+  }
+  std::ifstream meminfo("/proc/meminfo");
+  std::string line;
+  while (std::getline(meminfo, line)) {
+    if (line.compare(0, 15, "HugePages_Free:") == 0) {
+      return std::stoul(line.substr(15)) > 0;
+    }
+  }
+  return false;
+}
+
+// true if address lies in a mapping of a file
+bool file_backed(const void *address) {
+  const uintptr_t a = reinterpret_cast<uintptr_t>(address);
+  std::ifstream maps("/proc/self/maps");
+  std::string line;
+  while (std::getline(maps, line)) {
+    // address range, perms, offset, dev, inode, path
+    std::istringstream fields(line);
+    uintptr_t begin = 0, end = 0;
+    char dash = 0;
+    std::string perms, offset, dev;
+    unsigned long inode = 0;
+    fields >> std::hex >> begin >> dash >> end >> perms >> offset >> dev >>
+        std::dec >> inode;
+    if (a >= begin && a < end) {
+      return inode != 0;
+    }
+  }
+  return false;
+}
+
+bool isSquare(float result, int x) {
+  return std::fabs(result - (float)(x * x)) <
+         10 * std::numeric_limits<float>::epsilon();
+}
+
+int main(int argc, char const *argv[]) {
+  std::cout << "\n=== libVC_testDispatcher ===\n" << std::endl;
+  std::cout << ">>> Test Configuration" << std::endl
+            << "- " << NUM_VERSIONS << " Versions installed in turn while "
+            << NUM_READERS << " threads call the dispatcher." << std::endl
+            << "- Replaced Versions are released by the dispatcher only."
+            << std::endl
+            << "- Typed symbol access without heap allocations." << std::endl
+            << "- Per-input selection learned from measured timings."
+            << std::endl
+            << "- Guarded specialization with fallback." << std::endl
+            << "- Specializations and rebuilds driven by profiles."
+            << std::endl
+            << "- Identical shared objects loaded once, on request." << std::endl
+            << "- Cold Versions folded to meet a memory budget." << std::endl
+            << "- Versions restored from a manifest without recompiling."
+            << std::endl
+            << "- Destroyed Versions are torn down in background." << std::endl
+            << "- Loaded Versions are warmed up before use." << std::endl
+            << "- Hot code on huge pages, when available." << std::endl
+            << "- Only the versioned functions exported, on request." << std::endl;
+  std::filesystem::remove_all(DISPATCHER_TEST_DIR);
+  std::filesystem::create_directories(DISPATCHER_TEST_DIR);
+
+  vc::compiler_ptr_t compiler = vc::make_compiler<vc::SystemCompiler>(
+      "dispatcher_comp", std::filesystem::u8path(DEFAULT_COMPILER_NAME),
+      std::filesystem::u8path(DISPATCHER_TEST_DIR),
+      std::filesystem::u8path(DISPATCHER_TEST_DIR) / "dispatcher.log",
+      std::filesystem::u8path(DEFAULT_COMPILER_DIR), false);
+
+  std::vector<vc::version_ptr_t> versions;
+  for (int i = 0; i < NUM_VERSIONS; i++) {
+    vc::Version::Builder builder(PATH_TO_C_TEST_CODE, TEST_FUNCTION, compiler);
+    builder.addFunctionFlag(TEST_FUNCTION_LBL);
+    builder.addDefine("DISPATCHED", i);
+    versions.push_back(builder.build());
+  }
+  bool compiled = true;
+  for (auto &handle : vc::submit(versions)) {
+    compiled = handle.get() && compiled;
+  }
+
+  std::cout << "\n>>> Test Cases" << std::endl;
+  vc::Dispatcher<float(int)> dispatcher;
+  std::cout << "Test 01: call through the dispatcher\t\t";
+  const bool installed = compiled && dispatcher.install(versions[0]);
+  checkResult(installed && isSquare(dispatcher(3), 3),
+              "dispatcher not installed or wrong result");
+
+  std::cout << "Test 02: install by name\t\t\t";
+  const std::size_t group_size = dispatcher.withSymbols(
+      [](const std::vector<void *> &symbols) { return symbols.size(); });
+  checkResult(dispatcher.install(versions[0], TEST_FUNCTION) &&
+                  !dispatcher.install(versions[0], "missing_function") &&
+                  group_size == 1 && dispatcher.getVersion() == versions[0],
+              "unexpected symbol group");
+
+  // an object retired while a reader is inside a guard outlives the guard
+  std::cout << "Test 03: reclamation waits for readers\t\t";
+  std::atomic<bool> inside(false);
+  std::atomic<bool> leave(false);
+  std::thread reader([&inside, &leave]() {
+    vc::Epoch::Guard guard;
+    inside = true;
+    while (!leave) {
+      std::this_thread::yield();
+    }
+  });
+  while (!inside) {
+    std::this_thread::yield();
+  }
+  auto reclaimed = std::make_shared<std::atomic<bool>>(false);
+  vc::Epoch::retire([reclaimed]() { *reclaimed = true; });
+  vc::Epoch::reclaim();
+  const bool deferred = !*reclaimed;
+  leave = true;
+  reader.join();
+  vc::Epoch::synchronize();
+  checkResult(deferred && *reclaimed, "object reclaimed too early or never");
+
+  // replaced Versions are closed while the readers keep calling
+  std::cout << "Test 04: hot swap under load\t\t\t";
+  std::atomic<bool> stop(false);
+  std::atomic<long> wrong(0);
+  std::atomic<long> calls(0);
+  std::vector<std::thread> readers;
+  for (int t = 0; t < NUM_READERS; t++) {
+    readers.emplace_back([&, t]() {
+      int x = t;
+      while (!stop) {
+        if (!isSquare(dispatcher(x), x)) {
+          wrong++;
+        }
+        calls++;
+        x = (x + 1) % 100;
+      }
+    });
+  }
+  std::vector<std::weak_ptr<vc::Version>> replaced;
+  for (int i = 1; i < NUM_VERSIONS; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    dispatcher.install(versions[i]);
+    replaced.push_back(versions[i - 1]);
+    versions[i - 1].reset();
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  stop = true;
+  for (auto &t : readers) {
+    t.join();
+  }
+  vc::Epoch::synchronize();
+  bool released = true;
+  for (const auto &v : replaced) {
+    released = v.expired() && released;
+  }
+  checkResult(wrong.load() == 0 && calls.load() > 0 && released &&
+                  dispatcher.getVersion() == versions.back(),
+              std::to_string(wrong.load()) + " wrong results over " +
+                  std::to_string(calls.load()) + " calls");
+
+  std::cout << "Test 05: accessors do not allocate\t\t";
+  const vc::Version &last = *versions.back();
+  const vc::SymbolTable<float(int)> table(last);
+  const int index = last.getSymbolIndex(TEST_FUNCTION);
+  std::size_t touched = 0;
+  bool typed = table.valid() && index == 0;
+  const long before = allocations;
+  for (int i = 0; i < 1000; i++) {
+    compute_func_t f = last.getSymbol<compute_func_t>(index);
+    typed = typed && f == table.get<0>() && isSquare(table.call<0>(i), i);
+    touched += last.getSymbolCount() + last.getFunctionNames().size() +
+               last.getTags().size() + last.getOptionList().size() +
+               last.getID().size() + last.getFileName_bin().native().size();
+  }
+  const long allocated = allocations - before;
+  checkResult(typed && touched > 0 && allocated == 0,
+              std::to_string(allocated) + " allocations");
+
+  // linear kernel wins on small inputs, constant one on large inputs
+  std::cout << "Test 06: selector learns per-input decisions\t";
+  vc::VersionSelector<float(int)> selector(
+      [](const int &n) -> std::size_t { return n < 1000 ? 0 : 1; }, 3);
+  const int linear = selector.addVersion(build_kernel(compiler, ""));
+  const int constant = selector.addVersion(build_kernel(compiler, "200000"));
+  const bool untrained = selector.getDecision(1) == 0 && selector(5) == 5.f;
+  for (int i = 0; i < 10; i++) {
+    selector.measure(10);
+    selector.measure(5000000);
+  }
+  const bool trained = selector.train();
+  checkResult(linear == 0 && constant == 1 && untrained && trained &&
+                  selector.getDecision(0) == (std::size_t)linear &&
+                  selector.getDecision(1) == (std::size_t)constant &&
+                  selector.getDecision(2) == (std::size_t)constant &&
+                  selector(7) == 7.f,
+              "unexpected decisions");
+
+  // the specialized kernel marks its results to tell which one ran
+  std::cout << "Test 07: guarded specialization\t\t\t";
+  vc::GuardedSpecialization guarded(
+      compiler, "scale", "int", {{"const int *", "p"}, {"int", "n"}});
+  guarded.assumeValue("n", 8);
+  guarded.assumeAligned("p", 16);
+  vc::Version::Builder scale_builder;
+  scale_builder.setCompiler(compiler);
+  scale_builder.addFunctionName("scale");
+  scale_builder.addSourceBuffer("scale.c",
+                                "int scale(const int *p, int n) {\n"
+                                "#if defined(VC_ASSUME_VALUE_n) && "
+                                "defined(VC_ASSUME_ALIGNED_p)\n"
+                                "  return p[0] * VC_ASSUME_VALUE_n + 1000;\n"
+                                "#else\n"
+                                "  return p[0] * n;\n"
+                                "#endif\n"
+                                "}\n");
+  typedef int (*scale_func_t)(const int *, int);
+  alignas(16) int data[8] = {3, 3, 3, 3, 3, 3, 3, 3};
+  scale_func_t scale = guarded.build(scale_builder)
+                           ? guarded.getSymbol<scale_func_t>()
+                           : nullptr;
+  // a second guard of the same shape does not redirect the first one
+  vc::GuardedSpecialization doubled(
+      compiler, "scale", "int", {{"const int *", "p"}, {"int", "n"}});
+  doubled.assumeValue("n", 8);
+  vc::Version::Builder doubled_builder;
+  doubled_builder.setCompiler(compiler);
+  doubled_builder.addFunctionName("scale");
+  doubled_builder.addDefine("SCALE_FACTOR", 2);
+  doubled_builder.addSourceBuffer("scale.c",
+                                  "int scale(const int *p, int n) {\n"
+                                  "  return p[0] * n * SCALE_FACTOR;\n"
+                                  "}\n");
+  scale_func_t twice = doubled.build(doubled_builder)
+                           ? doubled.getSymbol<scale_func_t>()
+                           : nullptr;
+  checkResult(scale && guarded.getGuard() && scale(data, 8) == 1024 &&
+                  scale(data, 5) == 15 && scale(data + 1, 8) == 24 &&
+                  twice && twice(data, 5) == 30 && twice != scale,
+              "wrong dispatch between specialized and generic");
+
+  // n settles on 8 after startup, k keeps changing
+  std::cout << "Test 08: profiling drives specialization\t";
+  vc::Version::Builder axpy_builder;
+  axpy_builder.setCompiler(compiler);
+  axpy_builder.addFunctionName("axpy");
+  axpy_builder.addSourceBuffer("axpy.c",
+                               "int axpy(int k, int n) {\n"
+                               "#ifdef VC_ASSUME_VALUE_n\n"
+                               "  return k * VC_ASSUME_VALUE_n + 1000;\n"
+                               "#else\n"
+                               "  return k * n;\n"
+                               "#endif\n"
+                               "}\n");
+  vc::ProfilingOptions profiling;
+  profiling.samplingPeriod = 4;
+  profiling.minSamples = 100;
+  vc::ProfiledFunction<int(int, int)> axpy(
+      axpy_builder, "int", {{"int", "k"}, {"int", "n"}}, profiling);
+  bool generic_ok = axpy.ready();
+  for (int i = 0; i < 1000 && generic_ok; i++) {
+    generic_ok = axpy(i, i < 20 ? i : 8) == i * (i < 20 ? i : 8);
+  }
+  const bool specialized = axpy.waitSpecialization();
+  const auto assumed = axpy.getAssumptions();
+  checkResult(generic_ok && specialized &&
+                  axpy.getState() ==
+                      vc::ProfiledFunction<int(int, int)>::SPECIALIZED &&
+                  assumed.size() == 1 && assumed.count("n") &&
+                  assumed.at("n") == 8 && axpy(3, 8) == 1024 &&
+                  axpy(3, 5) == 15,
+              "no specialization on the near-constant argument");
+
+  // instrumented, then plain, then profile-optimized Version
+  std::cout << "Test 09: two-phase profile-guided optimization\t";
+  vc::Version::Builder branchy_builder;
+  branchy_builder.setCompiler(compiler);
+  branchy_builder.addFunctionName("branchy");
+  branchy_builder.addSourceBuffer("branchy.c",
+                                  "int branchy(int n) {\n"
+                                  "  int s = 0;\n"
+                                  "  for (int i = 0; i < n; i++) {\n"
+                                  "    s += (i % 3) ? i : -i;\n"
+                                  "  }\n"
+                                  "  return s;\n"
+                                  "}\n");
+  branchy_builder.options({vc::Option("o", "-O", "2")});
+  vc::ProfileGuidedFunction<int(int)> branchy(branchy_builder, 256);
+  std::string twin_profile;
+  {
+    // same configuration, but a profile of its own
+    vc::ProfileGuidedFunction<int(int)> twin(branchy_builder, 256);
+    twin_profile = twin.getProfileID();
+  }
+  const bool instrumented =
+      branchy.ready() &&
+      branchy.getState() == vc::ProfileGuidedFunction<int(int)>::INSTRUMENTED;
+  bool results_ok = true;
+  for (int i = 0; i < 512 && instrumented; i++) {
+    results_ok = branchy(10) == 9 && results_ok;
+  }
+  const bool optimized = branchy.waitOptimization();
+  const std::filesystem::path profile_dir =
+      compiler->getProfileDirectory(branchy.getProfileID());
+  bool profiled = false;
+  if (std::filesystem::exists(profile_dir)) {
+    for (const auto &entry :
+         std::filesystem::recursive_directory_iterator(profile_dir)) {
+      profiled = profiled || entry.path().extension() == ".gcda" ||
+                 entry.path().extension() == ".profdata";
+    }
+  }
+  checkResult(instrumented && results_ok && optimized && profiled &&
+                  twin_profile != branchy.getProfileID() &&
+                  branchy.getState() ==
+                      vc::ProfileGuidedFunction<int(int)>::OPTIMIZED &&
+                  branchy(10) == 9,
+              "profile not collected or not used");
+
+  // identical binaries share one handle only on request, since they share
+  // their state too. Other flags get their own handle.
+  std::cout << "Test 10: shared objects are deduplicated\t";
+  vc::SharedObjectManager &objects = vc::SharedObjectManager::getDefault();
+  const std::size_t open_before = objects.size();
+  const auto build_counter = [&compiler]() {
+    vc::Version::Builder counter_builder;
+    counter_builder.setCompiler(compiler);
+    counter_builder.addFunctionName("kernel");
+    counter_builder.addSourceBuffer("kernel.c", "float kernel(int n) {\n"
+                                                "  static int calls = 0;\n"
+                                                "  return ++calls;\n"
+                                                "}\n");
+    vc::version_ptr_t v = counter_builder.build();
+    v->compile();
+    return v;
+  };
+  vc::version_ptr_t first = build_counter();
+  vc::version_ptr_t second = build_counter();
+  compute_func_t count1 = first->getSymbol<compute_func_t>();
+  compute_func_t count2 = second->getSymbol<compute_func_t>();
+  const bool isolated = count1 && count2 && count1 != count2 &&
+                        count1(0) == 1.f && count1(0) == 2.f &&
+                        count2(0) == 1.f;
+  const std::size_t open_isolated = objects.size();
+  objects.setContentDedupe(true);
+  vc::version_ptr_t stateless = build_kernel(compiler, "7");
+  vc::version_ptr_t twin = build_kernel(compiler, "7");
+  objects.setContentDedupe(false);
+  const std::size_t open_shared = objects.size();
+  const bool same = stateless->getSymbol() &&
+                    stateless->getSymbol() == twin->getSymbol();
+  vc::Version::Builder deepbind_builder;
+  deepbind_builder.setCompiler(compiler);
+  deepbind_builder.addFunctionName("kernel");
+  deepbind_builder.addFunctionName("missing_function");
+  deepbind_builder.addSourceBuffer("kernel.c", make_kernel("7"));
+  deepbind_builder.setLoadFlags(RTLD_LAZY | RTLD_LOCAL | RTLD_DEEPBIND);
+  vc::version_ptr_t deepbind = deepbind_builder.build();
+  // missing symbols are only found missing when requested
+  const bool lazy = deepbind->compile() && deepbind->getSymbol<void *>(0) &&
+                    !deepbind->getSymbol<void *>(1);
+  const std::size_t open_deepbind = objects.size();
+  first.reset();
+  second.reset();
+  stateless.reset();
+  twin.reset();
+  deepbind.reset();
+  deepbind_builder.reset(); // the builder refers to the last Version built
+  vc::Reclaimer::getDefault().drain(); // unloads run in background
+  checkResult(isolated && same && lazy &&
+                  open_isolated == open_before + 2 &&
+                  open_shared == open_isolated + 1 &&
+                  open_deepbind == open_shared + 1 &&
+                  objects.size() == open_before,
+              "unexpected sharing of shared objects");
+
+  // room for two kernels out of four: the least recently used are folded
+  std::cout << "Test 11: memory budget folds cold Versions\t";
+  std::vector<vc::version_ptr_t> kernels;
+  for (int i = 1; i <= 4; i++) {
+    kernels.push_back(build_kernel(compiler, std::to_string(i)));
+  }
+  const std::size_t kernel_size =
+      vc::MemoryBudgetManager::getMappedSize(kernels[0]->getFileName_bin());
+  vc::MemoryBudgetManager budget(2 * kernel_size);
+  bool tracked = kernel_size > 0;
+  for (const auto &k : kernels) {
+    tracked = budget.track(k) && tracked;
+  }
+  const bool cold_folded = !kernels[0]->hasLoadedSymbol() &&
+                           !kernels[1]->hasLoadedSymbol() &&
+                           kernels[2]->hasLoadedSymbol() &&
+                           kernels[3]->hasLoadedSymbol();
+  bool reloaded = false;
+  {
+    vc::MemoryBudgetManager::Pin pin = budget.pin(kernels[0]);
+    compute_func_t k0 = pin.getSymbol<compute_func_t>();
+    reloaded = k0 && k0(6) == 6.f && !kernels[2]->hasLoadedSymbol();
+  }
+  vc::MemoryBudgetManager resident(
+      0, vc::MemoryBudgetManager::LEAST_FREQUENTLY_USED,
+      vc::MemoryBudgetManager::RESIDENT_SIZE);
+  resident.track(kernels[3]);
+  // not folded before resident sizes are known
+  const bool measured = kernels[3]->hasLoadedSymbol() &&
+                        resident.refresh() == 0 &&
+                        !kernels[3]->hasLoadedSymbol();
+  // binaries in anonymous memory files are measured as well
+  vc::compiler_ptr_t memfd_compiler = vc::make_compiler<vc::SystemCompiler>(
+      "memfd_comp", std::filesystem::u8path(DEFAULT_COMPILER_NAME),
+      std::filesystem::u8path(DISPATCHER_TEST_DIR),
+      std::filesystem::u8path(DISPATCHER_TEST_DIR) / "memfd.log",
+      std::filesystem::u8path(DEFAULT_COMPILER_DIR), false);
+  bool memfd_measured = true;
+  if (memfd_compiler->enableMemoryBinaries()) {
+    vc::version_ptr_t in_memory = build_kernel(memfd_compiler, "12");
+    vc::MemoryBudgetManager memfd_budget(
+        std::numeric_limits<std::size_t>::max(),
+        vc::MemoryBudgetManager::LEAST_RECENTLY_USED,
+        vc::MemoryBudgetManager::RESIDENT_SIZE);
+    compute_func_t k12 = in_memory->getSymbol<compute_func_t>();
+    memfd_measured = k12 && k12(3) == 3.f && memfd_budget.track(in_memory) &&
+                     memfd_budget.refresh() > 0;
+  }
+  checkResult(tracked && cold_folded && reloaded && measured &&
+                  memfd_measured &&
+                  budget.getUsage() <= budget.getBudget(),
+              "unexpected folded Versions");
+  kernels.clear();
+
+  // a new registry restores the saved binary, a Builder finds it there
+  std::cout << "Test 12: Versions restored from a manifest\t";
+  const std::filesystem::path manifest_dir = compiler->getManifestDirectory();
+  vc::version_ptr_t saved = build_kernel(compiler, "11");
+  const bool written = vc::VersionRegistry::saveManifest(manifest_dir, {saved});
+  saved.reset(); // removes the working files
+  auto registry = std::make_shared<vc::VersionRegistry>();
+  std::vector<vc::version_ptr_t> restored =
+      registry->loadManifest(manifest_dir, {compiler}, false);
+  bool warm = written && restored.size() == 1 &&
+              restored[0]->hasGeneratedBin() && restored[0]->compile();
+  if (warm) {
+    compute_func_t k = restored[0]->getSymbol<compute_func_t>();
+    vc::Version::Builder warm_builder;
+    warm_builder.setCompiler(compiler);
+    warm_builder.setRegistry(registry);
+    warm_builder.addFunctionName("kernel");
+    warm_builder.addSourceBuffer("kernel.c", make_kernel("11"));
+    warm = k && k(5) == 5.f && warm_builder.build() == restored[0];
+  }
+  checkResult(warm, "Version not restored");
+  restored.clear();
+
+  // the last reference is dropped while the reclaimer is busy
+  std::cout << "Test 13: teardown runs in background\t\t";
+  vc::Reclaimer &reclaimer = vc::Reclaimer::getDefault();
+  vc::version_ptr_t retired = build_kernel(compiler, "13");
+  const std::filesystem::path retired_bin = retired->getFileName_bin();
+  std::promise<void> unblock;
+  std::shared_future<void> unblocked = unblock.get_future().share();
+  reclaimer.defer([unblocked]() { unblocked.wait(); });
+  retired.reset();
+  const bool in_background = std::filesystem::exists(retired_bin) &&
+                        reclaimer.pending() >= 3; // blocker, unload, file
+  unblock.set_value();
+  reclaimer.drain();
+  checkResult(in_background && !std::filesystem::exists(retired_bin) &&
+                  reclaimer.pending() == 0,
+              "teardown not deferred");
+
+  // the warm-up runs before compile() returns, with every symbol resolved
+  std::cout << "Test 14: Versions warmed up before use\t\t";
+  vc::Version::Builder warm_up_builder;
+  warm_up_builder.setCompiler(compiler);
+  warm_up_builder.addFunctionName("kernel");
+  warm_up_builder.addSourceBuffer("kernel.c", make_kernel("14"));
+  warm_up_builder.setLoadFlags(RTLD_LAZY | RTLD_LOCAL);
+  std::atomic<int> warm_ups(0);
+  warm_up_builder.setWarmUp(true, [&warm_ups](const vc::Version &v) {
+    compute_func_t k = v.getSymbol<compute_func_t>();
+    if (k && k(2) == 2.f) {
+      warm_ups++;
+    }
+  });
+  vc::version_ptr_t warmed = warm_up_builder.build();
+  const bool warmed_up = warmed->compile() && warm_ups == 1;
+  // a folded Version is warmed up again when it comes back
+  warmed->fold();
+  const bool rewarmed = warmed->reload() && warm_ups == 2;
+  warmed.reset();
+  warm_up_builder.reset();
+  checkResult(warmed_up && rewarmed, "warm-up not run");
+
+  // the code is moved while the Version is loaded, where huge pages exist.
+  // Clones and restored copies have the same configuration
+  std::cout << "Test 15: code on huge pages\t\t\t";
+  auto huge_registry = std::make_shared<vc::VersionRegistry>();
+  vc::Version::Builder huge_builder;
+  huge_builder.setCompiler(compiler);
+  huge_builder.setRegistry(huge_registry);
+  huge_builder.addFunctionName("kernel");
+  huge_builder.addSourceBuffer("kernel.c", make_kernel("15"));
+  huge_builder.setHugePages(true);
+  vc::version_ptr_t huge = huge_builder.build();
+  bool huge_ok = huge->compile();
+  if (huge_ok) {
+    compute_func_t k = huge->getSymbol<compute_func_t>();
+    huge_ok = k && k(15) == 15.f;
+    if (huge_pages_available()) {
+      // no longer backed by the shared object
+      huge_ok = huge_ok && huge->hasHugePages() &&
+                !file_backed(reinterpret_cast<const void *>(k));
+    }
+  }
+  vc::Version::Builder huge_clone(huge);
+  huge_clone.setRegistry(huge_registry);
+  vc::Version::Builder huge_copy(huge);
+  huge_ok = huge_ok && huge_clone.build() == huge &&
+            huge_copy.build()->getOptionList() == huge->getOptionList();
+  const bool huge_saved =
+      vc::VersionRegistry::saveManifest(manifest_dir, {huge});
+  auto huge_restore_registry = std::make_shared<vc::VersionRegistry>();
+  std::vector<vc::version_ptr_t> huge_restored =
+      huge_restore_registry->loadManifest(manifest_dir, {compiler}, false);
+  if (huge_saved && huge_restored.size() == 1 &&
+      huge_restored[0]->compile()) {
+    huge_builder.setRegistry(huge_restore_registry);
+    huge_ok = huge_ok && huge_builder.build() == huge_restored[0] &&
+              huge_restored[0]->hasHugePages() == huge->hasHugePages();
+  } else {
+    huge_ok = false;
+  }
+  huge.reset();
+  huge_builder.reset();
+  huge_clone.reset();
+  huge_copy.reset();
+  huge_restored.clear();
+  vc::Reclaimer::getDefault().drain(); // unmaps the moved code
+  checkResult(huge_ok, "Version not usable on huge pages");
+
+  // globals of the source stay internal to the shared object
+  std::cout << "Test 16: export map and fast-load profile\t";
+  vc::Version::Builder fast_builder;
+  fast_builder.setCompiler(compiler);
+  fast_builder.addFunctionName("kernel");
+  fast_builder.addSourceBuffer("kernel.c", "int kernel_calls = 0;\n"
+                                           "float kernel(int n) {\n"
+                                           "  kernel_calls++;\n"
+                                           "  return n;\n"
+                                           "}\n");
+  fast_builder.setFastLoad(true);
+  compiler->enableExportMaps();
+  vc::version_ptr_t fast = fast_builder.build();
+  bool fast_ok = fast->compile();
+  compiler->enableExportMaps(false);
+  if (fast_ok) {
+    compute_func_t k = fast->getSymbol<compute_func_t>();
+    fast_ok = k && k(16) == 16.f;
+    void *handle = dlopen(fast->getFileName_bin().c_str(),
+                          RTLD_NOW | RTLD_LOCAL | RTLD_NOLOAD);
+    fast_ok = fast_ok && handle && dlsym(handle, "kernel") &&
+              !dlsym(handle, "kernel_calls");
+    if (handle) {
+      dlclose(handle);
+    }
+  }
+  // link options are added once to clones and restored copies
+  auto fast_registry = std::make_shared<vc::VersionRegistry>();
+  vc::Version::Builder fast_copy(fast);
+  fast_copy.setRegistry(fast_registry);
+  vc::version_ptr_t fast_clone = fast_copy.build();
+  fast_ok = fast_ok && fast_clone->getOptionList() == fast->getOptionList();
+  const bool fast_saved =
+      vc::VersionRegistry::saveManifest(manifest_dir, {fast_clone});
+  auto fast_restore_registry = std::make_shared<vc::VersionRegistry>();
+  std::vector<vc::version_ptr_t> fast_restored =
+      fast_restore_registry->loadManifest(manifest_dir, {compiler}, false);
+  fast_builder.setRegistry(fast_restore_registry);
+  fast_ok = fast_ok && fast_saved && fast_restored.size() == 1 &&
+            fast_builder.build() == fast_restored[0] &&
+            fast_restored[0]->getOptionList() == fast->getOptionList();
+  fast.reset();
+  fast_builder.reset();
+  fast_copy.reset();
+  fast_clone.reset();
+  fast_restored.clear();
+  checkResult(fast_ok, "unexpected exported symbols or fast-load options");
+
+  dispatcher.clear();
+  versions.clear();
+  vc::Epoch::synchronize();
+  vc::Reclaimer::getDefault().drain(); // files are removed in background
+  std::filesystem::remove_all(DISPATCHER_TEST_DIR);
+  return ret_value;
+}
@@ -0,0 +1,103 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_ARTIFACT_CACHE_HPP
+#define LIB_VERSIONING_COMPILER_ARTIFACT_CACHE_HPP
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+
+namespace vc {
+
+/** \brief Persistent content-addressed store of compilation artifacts.
+ *
+ * Artifacts (LLVM-IR bitcode, optimized bitcode, shared objects) are stored
+ * in a directory using as file name a key computed from everything that
+ * determines their content: input files content, ordered option list,
+ * compiler identifier and compiler version.
+ * The directory can be shared among different processes. Publication of a new
+ * artifact is atomic (write to a temporary file, then rename) thus a reader
+ * never observes a partially written artifact.
+ *
+ * The cache also remembers recent failures: a configuration which failed to
+ * compile is not compiled again until the failure record expires.
+ *
+ * Header files included by the sources are not part of the key.
+ */
+class ArtifactCache {
+public:
+  /** \brief Constructs a cache rooted in cacheDir.
+   *
+   * \param cacheDir directory where the artifacts are stored. It is created
+   * if it does not exist.
+   *
+   * \param failureTTL how long a failure record prevents a new compilation
+   * of the same configuration.
+   */
+  ArtifactCache(const std::filesystem::path &cacheDir,
+                std::chrono::seconds failureTTL = std::chrono::seconds(300));
+
+  /** \brief directory where the artifacts are stored. */
+  std::filesystem::path getDirectory() const;
+
+  /** \brief Copies the artifact identified by key into destination.
+   *
+   * Returns true on cache hit. False otherwise.
+   */
+  bool lookup(const std::string &key, const std::string &extension,
+              const std::filesystem::path &destination) const;
+
+  /** \brief Stores a copy of artifact under the given key.
+   *
+   * Returns true if the artifact is available in the cache after the call.
+   */
+  bool publish(const std::string &key, const std::string &extension,
+               const std::filesystem::path &artifact) const;
+
+  /** \brief Returns true if the configuration identified by key recently
+   * failed to compile.
+   */
+  bool isKnownFailure(const std::string &key) const;
+
+  /** \brief Remembers that the configuration identified by key failed. */
+  void recordFailure(const std::string &key) const;
+
+  /** \brief Forgets a previously recorded failure. */
+  void clearFailure(const std::string &key) const;
+
+private:
+  /** \brief directory where the artifacts are stored. */
+  std::filesystem::path directory;
+
+  /** \brief validity period of a failure record. */
+  std::chrono::seconds failureTimeToLive;
+
+  /** \brief file name of the artifact identified by key. */
+  std::filesystem::path getEntryFileName(const std::string &key,
+                                         const std::string &extension) const;
+
+  /** \brief unique name for a temporary file in the cache directory. */
+  std::filesystem::path getTemporaryFileName(const std::string &key) const;
+};
+
+} // end namespace vc
+
+#endif /* end of include guard: LIB_VERSIONING_COMPILER_ARTIFACT_CACHE_HPP */
@@ -0,0 +1,68 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_CANCELLATION_TOKEN_HPP
+#define LIB_VERSIONING_COMPILER_CANCELLATION_TOKEN_HPP
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+namespace vc {
+
+/** \brief Shared flag used to stop a compilation.
+ *
+ * The token is cancelled either explicitly or when its deadline expires.
+ * Compilers poll it between stages and while waiting for child processes.
+ */
+class CancellationToken {
+public:
+  typedef std::chrono::steady_clock clock_t;
+
+  /** \brief a token without deadline. */
+  CancellationToken()
+      : cancelled(false), deadline(clock_t::time_point::max()) {}
+
+  /** \brief a token which expires at deadline. */
+  explicit CancellationToken(clock_t::time_point deadline)
+      : cancelled(false), deadline(deadline) {}
+
+  /** \brief Requests the compilation to stop. */
+  void cancel() { cancelled.store(true); }
+
+  /** \brief true if cancelled or past its deadline. */
+  bool isCancelled() const {
+    return cancelled.load() || clock_t::now() >= deadline;
+  }
+
+  /** \brief point in time after which the token is cancelled. */
+  clock_t::time_point getDeadline() const { return deadline; }
+
+private:
+  std::atomic<bool> cancelled;
+
+  const clock_t::time_point deadline;
+};
+
+typedef std::shared_ptr<CancellationToken> cancel_token_t;
+
+} // end namespace vc
+
+#endif /* end of include guard: LIB_VERSIONING_COMPILER_CANCELLATION_TOKEN_HPP */
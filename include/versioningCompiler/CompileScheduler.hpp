@@ -0,0 +1,221 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_COMPILE_SCHEDULER_HPP
+#define LIB_VERSIONING_COMPILER_COMPILE_SCHEDULER_HPP
+
+#include "versioningCompiler/CancellationToken.hpp"
+#include "versioningCompiler/ThreadPool.hpp"
+#include "versioningCompiler/Version.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace vc {
+
+/** \brief Pipelined compilation of many Versions.
+ *
+ * Every compilation stage has its own lane, i.e. its own queue and worker
+ * budget: IR generation, optimization, code generation and loading.
+ * A Version moves to the next lane as soon as a stage completes, so that the
+ * optimizer of a Version runs while the frontend of another Version and the
+ * code generation of a third one are in progress.
+ *
+ * The load lane has a single worker: dlopen is serialized by the dynamic
+ * loader lock anyway, and keeping it apart leaves the other lanes free.
+ *
+ * Each lane runs the queued Version with the highest priority first, then
+ * the one with the earliest deadline, then the oldest one.
+ * Compilations can be cancelled by Version ID or tag: queued ones are
+ * dropped, running child processes are terminated and in-process compilers
+ * stop at the next stage. A compilation past its deadline is cancelled too.
+ *
+ * A submitted Version takes the same in-flight slot used by
+ * Version::compile(): concurrent calls to compile() wait for the scheduled
+ * compilation instead of starting another one.
+ */
+class CompileScheduler {
+public:
+  /** \brief Compilation stages, in pipeline order. */
+  enum Stage { FRONTEND = 0, OPTIMIZER, CODEGEN, LOAD, NUM_STAGES };
+
+  /** \brief Scheduling parameters of a compilation. */
+  struct JobOptions {
+    /** \brief higher values run first. */
+    int priority = 0;
+
+    /** \brief the compilation is cancelled if not completed by then. */
+    CancellationToken::clock_t::time_point deadline =
+        CancellationToken::clock_t::time_point::max();
+
+    /** \brief also run the IR generation and optimization stages. */
+    bool prepareIR = true;
+  };
+
+  /** \brief Starts the lanes.
+   *
+   * Zero workers means one worker per hardware thread.
+   */
+  CompileScheduler(std::size_t frontendWorkers = 0,
+                   std::size_t optimizerWorkers = 0,
+                   std::size_t codegenWorkers = 0);
+
+  /** \brief Completes all the submitted Versions and joins the workers. */
+  ~CompileScheduler();
+
+  CompileScheduler(const CompileScheduler &) = delete;
+  CompileScheduler &operator=(const CompileScheduler &) = delete;
+
+  /** \brief Schedules the compilation of a Version. Never blocks.
+   *
+   * \param prepareIR also run the IR generation and optimization stages,
+   * like prepareIR() followed by compile(). They are skipped when the
+   * compiler has no IR support.
+   * \return handle to the compile() result. The Version object is kept alive
+   * until the compilation completes.
+   */
+  std::shared_future<bool> submit(const version_ptr_t &version,
+                                  bool prepareIR = true);
+
+  /** \brief Schedules the compilation of a Version with the given priority
+   * and deadline. Never blocks.
+   *
+   * If the Version is already scheduled, its priority is raised to
+   * options.priority, if higher, and the handle of the scheduled compilation
+   * is returned.
+   */
+  std::shared_future<bool> submit(const version_ptr_t &version,
+                                  const JobOptions &options);
+
+  /** \brief Schedules a batch of Versions.
+   *
+   * Handles are in the same order of versions.
+   */
+  std::vector<std::shared_future<bool>>
+  submit(const std::vector<version_ptr_t> &versions, bool prepareIR = true);
+
+  /** \brief Schedules a batch of Versions with the same options.
+   *
+   * Handles are in the same order of versions.
+   */
+  std::vector<std::shared_future<bool>>
+  submit(const std::vector<version_ptr_t> &versions,
+         const JobOptions &options);
+
+  /** \brief Cancels the compilations of the Versions whose ID or one of the
+   * tags is key. Their handles return false.
+   *
+   * \return number of cancelled compilations.
+   */
+  std::size_t cancel(const std::string &key);
+
+  /** \brief Changes the priority of the compilations of the Versions whose
+   * ID or one of the tags is key. It applies to their next stages.
+   *
+   * \return number of affected compilations.
+   */
+  std::size_t setPriority(const std::string &key, int priority);
+
+  /** \brief number of worker threads of a lane. */
+  std::size_t workers(Stage stage) const;
+
+  /** \brief number of Versions queued in a lane and not yet started. */
+  std::size_t pendingTasks(Stage stage) const;
+
+  /** \brief Scheduler owned by the library.
+   *
+   * It is started on first use with one worker per hardware thread in each
+   * compilation lane.
+   */
+  static CompileScheduler &getDefault();
+
+private:
+  /** \brief a Version travelling through the lanes. */
+  struct Job {
+    version_ptr_t version;
+    std::promise<bool> promise;
+    std::vector<Stage> stages;
+    std::size_t next = 0;
+    int priority = 0;
+    uint64_t sequence = 0;
+    cancel_token_t token;
+    /** \brief true while waiting in the queue of stages[next]. */
+    bool queued = false;
+    bool done = false;
+  };
+
+  typedef std::shared_ptr<Job> job_ptr_t;
+
+  /** \brief lane queue order: priority, deadline, submission order. */
+  struct JobOrder {
+    bool operator()(const job_ptr_t &a, const job_ptr_t &b) const;
+  };
+
+  std::array<std::unique_ptr<ThreadPool>, NUM_STAGES> lanes;
+
+  /** \brief Versions waiting for a lane worker, by lane. */
+  std::array<std::set<job_ptr_t, JobOrder>, NUM_STAGES> queues;
+
+  /** \brief submitted and not yet completed jobs. */
+  std::unordered_set<job_ptr_t> jobs;
+
+  uint64_t nextSequence = 0;
+
+  /** \brief protects queues, jobs and the job states. */
+  mutable std::mutex mtx;
+
+  /** \brief true if key is the ID or one of the tags of the job Version. */
+  static bool matches(const job_ptr_t &job, const std::string &key);
+
+  /** \brief Raises the priority of the compilation of the Version with the
+   * given ID to priority, if higher.
+   */
+  void raisePriority(const std::string &versionID, int priority);
+
+  /** \brief Sets the priority of job, keeping its queue sorted. Called with
+   * mtx held.
+   */
+  void updatePriority(const job_ptr_t &job, int priority);
+
+  /** \brief Enqueues the next stage of job, or completes it. */
+  void advance(const job_ptr_t &job, bool ok);
+
+  /** \brief Runs the first queued stage of a lane. Called from the lane
+   * workers.
+   */
+  void runNext(Stage lane);
+
+  /** \brief Frees the in-flight slot and publishes the result, once. */
+  void complete(const job_ptr_t &job, bool ok,
+                std::exception_ptr error = nullptr);
+};
+
+} // end namespace vc
+
+#endif /* end of include guard: LIB_VERSIONING_COMPILER_COMPILE_SCHEDULER_HPP */
@@ -21,8 +21,11 @@
 #ifndef LIB_VERSIONING_COMPILER_COMPILER_HPP
 #define LIB_VERSIONING_COMPILER_COMPILER_HPP
 
+#include "versioningCompiler/ArtifactCache.hpp"
 #include "versioningCompiler/Option.hpp"
+#include "versioningCompiler/ProcessLauncher.hpp"
 
+#include <chrono>
 #include <filesystem>
 #include <list>
 #include <map>
@@ -33,6 +36,11 @@
 
 namespace vc {
 
+/** \brief In-memory source files, indexed by the name used in the source list.
+ */
+typedef std::map<std::filesystem::path, std::shared_ptr<const std::string>>
+    source_buffer_map_t;
+
 /** \brief Abstract class that defines the general behaviour for a Compiler
  */
 class Compiler {
@@ -119,12 +127,207 @@ public:
    */
   virtual void releaseSymbol(void **handler);
 
+  /** \brief Returns true if symbols can be resolved one at a time, after
+   * openSharedObject. Otherwise loadSymbols must be used.
+   */
+  virtual bool supportsLazySymbols() const;
+
+  /** \brief Opens the binary shared object with the given dlopen flags and
+   * stores in *handler the reference to it, without resolving any symbol.
+   *
+   * Identical shared objects share the same handle. It is released by
+   * releaseSymbol.
+   *
+   * \return false on failure.
+   */
+  virtual bool openSharedObject(const std::filesystem::path &bin, int flags,
+                                void **handler);
+
+  /** \brief Resolves the symbol relative to the given function in a shared
+   * object opened by openSharedObject. nullptr if not found.
+   */
+  virtual void *resolveSymbol(void *handler, const std::string &func) const;
+
+  /** \brief Faults in the code and data of a loaded handler, so that the
+   * first calls into it take no page faults.
+   *
+   * \return false if nothing was prefaulted.
+   */
+  virtual bool prefaultSharedObject(void *handler) const;
+
+  /** \brief Returns the link options which align the code of a shared
+   * object to the huge page size. Empty list if not supported.
+   */
+  virtual opt_list_t getHugePageOptions() const;
+
+  /** \brief Moves the code of a loaded handler onto huge pages.
+   *
+   * \return false if the code was left where it is.
+   */
+  virtual bool remapHugePages(void *handler);
+
+  /** \brief Returns the compile and link options of the fast-load profile:
+   * no semantic interposition, symbolic binding, immediate binding, GNU hash
+   * table and garbage collection of unused sections. Empty list if not
+   * supported.
+   */
+  virtual opt_list_t getFastLoadOptions() const;
+
+  /** \brief Restricts the dynamic symbols of the shared objects to the
+   * functions of their Version, through a generated version script.
+   *
+   * Disabled by default, since other code may look up symbols of the
+   * shared objects that are not functions of the Version. Not to be
+   * changed while a compilation is running.
+   */
+  void enableExportMaps(bool enable = true);
+
+  /** \brief Returns true if the export maps are enabled. */
+  bool hasExportMaps() const;
+
+  /** \brief Releases any resource held on behalf of a Version.
+   *
+   * Called when the Version is destroyed. Default implementation drops the
+   * source buffers of the Version. Overrides must call it.
+   */
+  virtual void releaseVersion(const std::string &versionID);
+
+  /** \brief Returns true if the compiler holds the IR of a Version in memory,
+   * in place of the IR files named by generateIR and runOptimizer.
+   *
+   * Default implementation returns false.
+   */
+  virtual bool hasInMemoryIR(const std::string &versionID) const;
+
+  /** \brief Makes the in-memory sources of a Version available.
+   *
+   * Each buffer stands for the source file with the same name in the source
+   * list given to generateIR and generateBin. Nothing is written to disk.
+   */
+  void addSourceBuffers(const std::string &versionID,
+                        const source_buffer_map_t &buffers);
+
+  /** \brief Attaches a cancellation token to the compilations of a Version.
+   *
+   * Running child processes are terminated once the token is cancelled.
+   * nullptr detaches the token.
+   */
+  void setCancellationToken(const std::string &versionID,
+                            const cancel_token_t &token);
+
+  /** \brief Returns true if the compilation of a Version was cancelled. */
+  bool isCancelled(const std::string &versionID) const;
+
   /** \brief Converts an Option object into a compiler flag.
    *
    * Implementation specific.
    */
   virtual std::string getOptionString(const Option &o) const = 0;
 
+  /** \brief Returns a string which identifies the version of the underlying
+   * compiler (and optimizer) binaries.
+   *
+   * It is used to tell apart artifacts generated by different releases of the
+   * same compiler. Empty string if unknown.
+   */
+  virtual std::string getCompilerVersion() const;
+
+  /** \brief Returns the directory collecting the profile named profileID.
+   */
+  std::filesystem::path getProfileDirectory(const std::string &profileID) const;
+
+  /** \brief Returns the default directory of the Version manifest, which
+   * lets a later process reload the Versions compiled by this one.
+   * See VersionRegistry::saveManifest().
+   */
+  std::filesystem::path getManifestDirectory() const;
+
+  /** \brief Returns the options building an instrumented Version, which
+   * writes its execution profile into getProfileDirectory(profileID) when
+   * it is unloaded.
+   *
+   * The Version optimized with the same profileID reads it back. Empty list
+   * if profiling is not supported.
+   */
+  virtual opt_list_t
+  getProfileGenerateOptions(const std::string &profileID) const;
+
+  /** \brief Returns the options building a Version optimized with the
+   * profile named profileID, merging raw profiles first if needed.
+   *
+   * Empty list if no profile has been collected.
+   */
+  virtual opt_list_t getProfileUseOptions(const std::string &profileID);
+
+  /** \brief Merges raw LLVM profiles into an indexed profile.
+   *
+   * Default implementation runs `llvm-profdata merge`.
+   *
+   * \return false on failure.
+   */
+  virtual bool
+  mergeProfiles(const std::vector<std::filesystem::path> &rawProfiles,
+                const std::filesystem::path &profile);
+
+  /** \brief Enables the persistent artifact cache.
+   *
+   * Artifacts are stored in a subdirectory of the working directory and are
+   * reused by any Version, in this or in another process, that is compiled
+   * with the same inputs, options and compiler.
+   *
+   * \param failureTTL how long a failed configuration is not compiled again.
+   */
+  virtual void enableArtifactCache(
+      std::chrono::seconds failureTTL = std::chrono::seconds(300));
+
+  /** \brief Returns the artifact cache. nullptr if the cache is disabled. */
+  std::shared_ptr<ArtifactCache> getArtifactCache() const;
+
+  /** \brief Sets environment variables for the processes launched by the
+   * compiler, in addition to the ones of the calling process.
+   *
+   * Not to be called while a compilation is running.
+   */
+  void setEnvironment(const env_map_t &env);
+
+  /** \brief Enables the diskless mode for shared objects (Linux only).
+   *
+   * Shared objects are written into anonymous memory files (memfd) and
+   * loaded through their /proc file descriptor path. The descriptor is owned
+   * by the Version, hence no shared object is left on disk, even after a
+   * crash.
+   *
+   * \return false if the platform does not support anonymous memory files.
+   */
+  virtual bool enableMemoryBinaries(bool enable = true);
+
+  /** \brief Returns true if the diskless mode is enabled. */
+  bool hasMemoryBinaries() const;
+
+  /** \brief Prepares an empty anonymous memory file to receive the shared
+   * object of a Version.
+   *
+   * From now on getSharedObjectFileName(versionID) refers to it. The caller
+   * owns the returned descriptor and must close it after releaseVersion.
+   *
+   * \return the file descriptor. -1 on failure.
+   */
+  int prepareMemoryBinary(const std::string &versionID);
+
+  /** \brief Computes default fileName for LLVM-IR bitcode file.
+   */
+  std::filesystem::path getBitcodeFileName(const std::string &versionID) const;
+
+  /** \brief Computes default fileName for optimized LLVM-IR bitcode file.
+   */
+  std::filesystem::path
+  getOptBitcodeFileName(const std::string &versionID) const;
+
+  /** \brief Computes default fileName for binary shared object file.
+   */
+  std::filesystem::path
+  getSharedObjectFileName(const std::string &versionID) const;
+
 protected:
   /** \brief string used to call the compiler. WARNING: If it starts with / (on
    * linux), it will ignore the installDirectory prefix! See
@@ -147,28 +350,80 @@ protected:
   /** \brief flag to identify compilers with LLVM-IR bitcode support. */
   bool hasSupportIR;
 
-  /** \brief Execute a system call of `command` and log the output. */
-  void log_exec(const std::string &command) const;
+  /** \brief persistent artifact cache. nullptr when disabled. */
+  std::shared_ptr<ArtifactCache> artifactCache;
+
+  /** \brief flag to produce shared objects into anonymous memory files. */
+  bool memoryBinaries = false;
+
+  /** \brief flag to export only the functions of a Version. */
+  bool exportMaps = false;
+
+  /** \brief environment variables set for the compiler processes. */
+  env_map_t environment;
+
+  /** \brief Execute `command` and log the output.
+   *
+   * The command is split into arguments as sh would do, but it is not run
+   * through a shell: redirections, pipes and variable expansions are not
+   * supported.
+   *
+   * \return the exit status. -1 if the command did not exit normally.
+   */
+  int log_exec(const std::string &command) const;
+
+  /** \brief Execute the program argv[0] with arguments argv and log the
+   * output and the exit status.
+   *
+   * The output is buffered and appended to the log file when the process
+   * completes, hence processes sharing a log file run concurrently.
+   *
+   * \param input if not nullptr, it is written to the standard input.
+   * \param versionID if not empty, the process is terminated when the
+   * compilation of that Version is cancelled.
+   * \return the exit status. -1 if the process did not exit normally.
+   */
+  int log_exec(const std::vector<std::string> &argv,
+               const std::string *input = nullptr,
+               const std::string &versionID = "") const;
 
   /** \brief Write a string into the log file. */
   void log_string(const std::string &command) const;
 
-  /** \brief Check if file name exists. */
-  static bool exists(const std::filesystem::path &name);
+  /** \brief Returns the in-memory source named name of a Version.
+   * nullptr if name is a regular file.
+   */
+  std::shared_ptr<const std::string>
+  getSourceBuffer(const std::string &versionID,
+                  const std::filesystem::path &name) const;
 
-  /** \brief Computes default fileName for LLVM-IR bitcode file.
+  /** \brief Returns true if the Version has in-memory sources. */
+  bool hasSourceBuffers(const std::string &versionID) const;
+
+  /** \brief Writes the version script which exports only the given
+   * functions from the shared object of a Version.
+   *
+   * The caller removes it after the link.
+   *
+   * \return its path. Empty if export maps are disabled or on failure.
    */
-  std::filesystem::path getBitcodeFileName(const std::string &versionID) const;
+  std::filesystem::path writeExportMap(const std::vector<std::string> &func,
+                                       const std::string &versionID) const;
 
-  /** \brief Computes default fileName for optimized LLVM-IR bitcode file.
+  /** \brief Drops a partial shared object of a Version, either on disk or
+   * in its anonymous memory file.
    */
-  std::filesystem::path
-  getOptBitcodeFileName(const std::string &versionID) const;
+  void discardSharedObject(const std::string &versionID) const;
 
-  /** \brief Computes default fileName for binary shared object file.
+  /** \brief Check if file name exists. */
+  static bool exists(const std::filesystem::path &name);
+
+  /** \brief Check if file name exists and it is not empty.
+   *
+   * Anonymous memory files always exist, this tells whether an artifact was
+   * actually written.
    */
-  std::filesystem::path
-  getSharedObjectFileName(const std::string &versionID) const;
+  static bool existsNotEmpty(const std::filesystem::path &name);
 
   /** \brief Copies the file to a new location.
    */
@@ -199,6 +454,27 @@ private:
    */
   std::string id;
 
+  /** \brief in-memory sources, indexed by version ID. */
+  std::map<std::string, source_buffer_map_t> sourceBuffers;
+
+  /** \brief Mutex to regulate access to sourceBuffers. */
+  mutable std::mutex sourceBuffersMtx;
+
+  /** \brief anonymous memory files, indexed by version ID. */
+  std::map<std::string, int> memoryBinaryFds;
+
+  /** \brief Mutex to regulate access to memoryBinaryFds. */
+  mutable std::mutex memoryBinaryFdsMtx;
+
+  /** \brief cancellation tokens, indexed by version ID. */
+  std::map<std::string, cancel_token_t> cancelTokens;
+
+  /** \brief Mutex to regulate access to cancelTokens. */
+  mutable std::mutex cancelTokensMtx;
+
+  /** \brief Returns the cancellation token of a Version. nullptr if none. */
+  cancel_token_t getCancellationToken(const std::string &versionID) const;
+
   /** Mutex to regulate exclusive access to log file.
    * It also includes a reference counter.
    */
@@ -89,6 +89,11 @@ public:
   void HandleDiagnostic(clang::DiagnosticsEngine::Level DiagLevel,
                         const clang::Diagnostic &Info) override;
 
+  /// Returns the diagnostics collected so far and forgets them.
+  /// Used with an empty log file name to buffer the diagnostics of a single
+  /// compilation and write them to the log in one go.
+  std::string takeEntries();
+
   /// setPrefix - Set the diagnostic printer prefix string, which will be
   /// printed at the start of any diagnostics. If empty, no prefix string is
   /// used.
@@ -0,0 +1,64 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_CLANG_LLVM_IN_PROCESS_FRONTEND_HPP
+#define LIB_VERSIONING_COMPILER_CLANG_LLVM_IN_PROCESS_FRONTEND_HPP
+
+#include "versioningCompiler/Compiler.hpp"
+
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vc {
+
+/** \brief Returns a file system which serves the given in-memory sources on
+ * top of the real file system.
+ *
+ * Buffer names are resolved against the current working directory. Buffers
+ * are referenced, not copied: they must outlive the file system.
+ */
+llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>
+createSourceFileSystem(const source_buffer_map_t &buffers);
+
+/** \brief Runs the clang frontend in-process and returns the generated module.
+ *
+ * \param args driver command line. args[0] is the clang executable.
+ * \param fs file system used to read sources and headers.
+ * \param diagnostics set to the diagnostics emitted by the frontend.
+ * \param unsupported set to true if args does not describe exactly one
+ * frontend job (e.g. multiple source files).
+ * \return the module. nullptr on failure.
+ */
+std::unique_ptr<llvm::Module>
+runClangFrontend(const std::vector<const char *> &args,
+                 llvm::LLVMContext &context,
+                 llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs,
+                 std::string &diagnostics, bool &unsupported);
+
+} // namespace vc
+
+#endif /* end of include guard:                                               \
+          LIB_VERSIONING_COMPILER_CLANG_LLVM_IN_PROCESS_FRONTEND_HPP */
@@ -19,20 +19,17 @@
 
 #ifndef LIB_VERSIONING_COMPILER_CLANG_LLVM_TOOLS_OPT_NEWPMDRIVER_H
 #define LIB_VERSIONING_COMPILER_CLANG_LLVM_TOOLS_OPT_NEWPMDRIVER_H
-#if LLVM_VERSION_MAJOR > 14
-#include "llvm/ADT/ArrayRef.h"
-#endif
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/CommandLine.h"
 
+#include <memory>
+#include <string>
+#include <vector>
+
 namespace llvm {
-class StringRef;
 class Module;
-#if LLVM_VERSION_MAJOR > 14
-class PassPlugin;
-#endif
 class TargetMachine;
-class ToolOutputFile;
-class TargetLibraryInfoImpl;
+class raw_ostream;
 
 extern cl::opt<bool> DebugifyEach;
 extern cl::opt<std::string> DebugifyExport;
@@ -53,38 +50,69 @@ enum PGOKind { NoPGO, InstrGen, InstrUse, SampleUse };
 enum CSPGOKind { NoCSPGO, CSInstrGen, CSInstrUse };
 } // namespace opt_tool
 
-void printPasses(raw_ostream &OS);
+} // namespace llvm
 
-/// Driver function to run the new pass manager over a module.
+namespace vc {
+
+/// Configuration of a single optimizer run.
 ///
-/// This function only exists factored away from opt.cpp in order to prevent
-/// inclusion of the new pass manager headers and the old headers into the same
-/// file. It's interface is consequentially somewhat ad-hoc, but will go away
-/// when the transition finishes.
+/// Unlike the `opt` command line options, which are process-wide statics,
+/// a configuration object is private to the caller. This makes it possible to
+/// run several optimizer pipelines concurrently.
+struct OptimizerConfig {
+  /// Ordered textual pass pipeline elements, e.g. "default<O2>" or
+  /// "instcombine,simplifycfg".
+  std::vector<std::string> Pipeline;
+  /// Optimization level used to configure the target machine.
+  unsigned OptLevel = 0;
+  llvm::opt_tool::OutputKind OK = llvm::opt_tool::OK_OutputBitcode;
+  llvm::opt_tool::VerifierKind VK = llvm::opt_tool::VK_VerifyInAndOut;
+  bool StripDebug = false;
+  bool DisableSimplifyLibCalls = false;
+  bool PreserveBitcodeUseListOrder = false;
+  bool PreserveAssemblyUseListOrder = false;
+  bool DiscardValueNames = false;
+  std::string TargetTriple = "";
+  std::string DefaultDataLayout = "";
+  /// Options which are not handled and have been skipped.
+  std::vector<std::string> Ignored;
+};
+
+/// Builds an optimizer configuration from `opt`-like arguments.
 ///
-/// ThinLTOLinkOut is only used when OK is OK_OutputThinLTOBitcode, and can be
-/// nullptr.
-#if LLVM_VERSION_MAJOR > 14
-bool runPassPipeline(StringRef Arg0, Module &M, TargetMachine *TM,
-                     TargetLibraryInfoImpl *TLII, ToolOutputFile *Out,
-                     ToolOutputFile *ThinLinkOut, ToolOutputFile *OptRemarkFile,
-                     StringRef PassPipeline, ArrayRef<StringRef> PassInfos,
-                     ArrayRef<PassPlugin> PassPlugins, opt_tool::OutputKind OK,
-                     opt_tool::VerifierKind VK,
-                     bool ShouldPreserveAssemblyUseListOrder,
-                     bool ShouldPreserveBitcodeUseListOrder,
-                     bool EmitSummaryIndex, bool EmitModuleHash,
-                     bool EnableDebugify, bool VerifyDIPreserve);
-#else
-bool runPassPipeline(StringRef Arg0, Module &M, TargetMachine *TM,
-                     TargetLibraryInfoImpl *TLII, ToolOutputFile *Out,
-                     ToolOutputFile *ThinLinkOut, ToolOutputFile *OptRemarkFile,
-                     StringRef PassPipeline, ArrayRef<StringRef> PassInfos,
-                     opt_tool::OutputKind OK, opt_tool::VerifierKind VK,
-                     bool ShouldPreserveAssemblyUseListOrder,
-                     bool ShouldPreserveBitcodeUseListOrder,
-                     bool EmitSummaryIndex, bool EmitModuleHash,
-                     bool EnableDebugify);
-#endif
-} // namespace llvm
+/// Supported arguments: -O0 -O1 -O2 -O3 -Os -Oz, -passes=<pipeline>,
+/// -<pass-name>, -S, -strip-debug, -disable-verify, -verify-each,
+/// -disable-simplify-libcalls, -mtriple=<triple>, -data-layout=<layout>,
+/// -preserve-bc-uselistorder, -preserve-ll-uselistorder,
+/// -discard-value-names. Other arguments of the form -name=value are listed
+/// in OptimizerConfig::Ignored.
+///
+/// Returns false and sets Error on malformed arguments.
+bool parseOptimizerOptions(const std::vector<std::string> &Args,
+                           OptimizerConfig &Config, std::string &Error);
+
+/// Runs the new pass manager pipeline described by Config over M and writes
+/// the result to Out. Nothing is written if Config.OK is OK_NoOutput, in that
+/// case the optimized module is left in M.
+///
+/// It does not touch any global state, hence it can be called concurrently
+/// on modules owned by different LLVMContexts.
+///
+/// Returns false and sets Error on failure.
+bool runPassPipeline(llvm::Module &M, const OptimizerConfig &Config,
+                     llvm::raw_ostream &Out, std::string &Error);
+
+/// Creates a target machine for the host CPU and the triple of M.
+///
+/// Returns nullptr if M has no triple or its target is not registered.
+std::unique_ptr<llvm::TargetMachine>
+createHostTargetMachine(llvm::Module &M, unsigned OptLevel);
+
+/// Generates the native object code of M into Out.
+///
+/// Returns false and sets Error on failure.
+bool emitObjectCode(llvm::Module &M, unsigned OptLevel,
+                    llvm::SmallVectorImpl<char> &Out, std::string &Error);
+
+} // namespace vc
 #endif
@@ -35,6 +35,9 @@
 #include "llvm/Target/TargetMachine.h"
 
 #include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -72,20 +75,92 @@ public:
 
   virtual std::string getOptionString(const Option &o) const override;
 
+  virtual std::string getCompilerVersion() const override;
+
+  /** \brief Merges raw profiles in-process, without llvm-profdata. */
+  virtual bool
+  mergeProfiles(const std::vector<std::filesystem::path> &rawProfiles,
+                const std::filesystem::path &profile) override;
+
+  /** \brief Keeps the llvm::Module of each Version in memory from the
+   * frontend to the code generation.
+   *
+   * generateIR runs the clang frontend in-process, runOptimizer transforms
+   * the module in place and generateBin emits the object code directly from
+   * it. The IR file names returned by generateIR and runOptimizer identify
+   * the in-memory module and do not exist on disk, unless
+   * keepIntermediateFiles is set: such Versions report hasInMemoryIR(). Their
+   * binaries are not stored in the artifact cache, and their IR is not saved
+   * in manifests.
+   * Compilations of multiple source files fall back to the file-based flow.
+   */
+  void enableInMemoryPipeline(bool keepIntermediateFiles = false);
+
+  /** \brief Returns true if the in-memory pipeline is enabled. */
+  bool isInMemoryPipelineEnabled() const;
+
+  /** \brief Drops the in-memory module of the given Version, if any. */
+  virtual void releaseVersion(const std::string &versionID) override;
+
+  /** \brief true if the in-memory pipeline holds the module of a Version and
+   * no IR file is written for it.
+   */
+  virtual bool hasInMemoryIR(const std::string &versionID) const override;
+
 private:
   inline std::vector<std::string> getArgV(const opt_list_t optionList) const;
 
+  /** \brief Runs the clang driver on the given command line.
+   *
+   * Each invocation uses a private diagnostics engine. Driver diagnostics are
+   * appended to the log file once the compilation is over, so that
+   * compilations sharing the same log file can run concurrently.
+   *
+   * \return false if the compilation could not be created.
+   */
+  bool runDriver(const std::vector<const char *> &cmd_str, int &result) const;
+
 private:
-  llvm::IntrusiveRefCntPtr<clang::DiagnosticIDs> _diagnosticIDs;
-  llvm::IntrusiveRefCntPtr<clang::DiagnosticOptions> _diagnosticOptions;
-  llvm::IntrusiveRefCntPtr<clang::DiagnosticsEngine> _diagEngine;
-  std::shared_ptr<FileLogDiagnosticConsumer> _diagConsumer;
   std::shared_ptr<LLVMInstanceManager> _llvmManager;
 
-  /** \brief mutex to regulate exclusive access to static command line options
-   * during optimizer option parsing and processing.
+  /** \brief llvm::Module kept in memory between pipeline stages. */
+  struct InMemoryModule {
+    // the context must outlive the module
+    std::unique_ptr<llvm::LLVMContext> context;
+    std::unique_ptr<llvm::Module> module;
+    unsigned optLevel = 0;
+  };
+
+  bool _inMemoryPipeline = false;
+  bool _keepIntermediateFiles = false;
+
+  /** \brief in-memory modules, indexed by version ID. */
+  mutable std::map<std::string, std::shared_ptr<InMemoryModule>> _modules;
+  mutable std::mutex _modules_mtx;
+
+  /** \brief Runs the clang frontend in-process and stores the generated
+   * module into result. In-memory sources of the Version are read through a
+   * virtual file system.
+   *
+   * \param unsupported set to true when the command line cannot be handled
+   * in-process (e.g. multiple source files).
+   * \return true on success.
    */
-  static std::mutex opt_parse_mtx;
+  bool runFrontend(const std::vector<const char *> &cmd_str,
+                   const std::string &versionID,
+                   const std::vector<std::filesystem::path> &src,
+                   InMemoryModule &result, bool &unsupported) const;
+
+  /** \brief code generation level given by the last -O option. */
+  unsigned getOptLevel(const std::vector<std::string> &argv) const;
+
+  /** \brief in-memory module of a Version. nullptr if not available. */
+  std::shared_ptr<InMemoryModule> findModule(const std::string &versionID,
+                                             bool remove = false) const;
+
+  /** \brief writes a module as a bitcode file. */
+  bool writeBitcode(const llvm::Module &module,
+                    const std::filesystem::path &fileName) const;
 };
 } /* end namespace vc */
 
@@ -65,10 +65,6 @@ class JITCompiler : public Compiler {
 
 private:
   // ORC JIT initialization objects
-  llvm::IntrusiveRefCntPtr<clang::DiagnosticIDs> _diagnosticIDs;
-  llvm::IntrusiveRefCntPtr<clang::DiagnosticOptions> _diagnosticOptions;
-  llvm::IntrusiveRefCntPtr<clang::DiagnosticsEngine> _diagEngine;
-  std::shared_ptr<FileLogDiagnosticConsumer> _diagConsumer;
   std::shared_ptr<LLVMInstanceManager> _llvmManager;
   std::unique_ptr<llvm::orc::ExecutionSession> _ES;
   llvm::orc::JITTargetMachineBuilder _JTMB;
@@ -77,11 +73,6 @@ private:
   llvm::DataLayout _dataLayout;
   llvm::orc::JITDylib &_mainJD;
 
-  /** \brief mutex to regulate exclusive access to static command line options
-   * during optimizer option parsing and processing.
-   */
-  static std::mutex opt_parse_mtx;
-
 public:
   // Set of maps used to keep a state of the various versions requesting for JIT
   // functionalities.
@@ -139,12 +130,37 @@ public:
 
   void releaseSymbol(void **handler) override;
 
+  /** JIT symbols are resolved while the module is loaded. */
+  bool supportsLazySymbols() const override;
+
+  /** JIT compiled code is written in memory by the JIT itself. */
+  bool prefaultSharedObject(void *handler) const override;
+
+  /** JIT compiled code is placed by the JIT memory manager. */
+  opt_list_t getHugePageOptions() const override;
+
+  /** JIT compiled code is placed by the JIT memory manager. */
+  bool remapHugePages(void *handler) override;
+
+  /** JIT compiled code is not linked into a shared object. */
+  opt_list_t getFastLoadOptions() const override;
+
   std::vector<void *> loadSymbols(const std::filesystem::path &bin,
                                   const std::vector<std::string> &func,
                                   void **handler) override;
 
   std::string getOptionString(const Option &o) const override;
 
+  /** JIT compiled code does not produce reusable artifacts. */
+  void enableArtifactCache(std::chrono::seconds failureTTL) override;
+
+  /** JIT compiled code is already kept in memory. */
+  bool enableMemoryBinaries(bool enable) override;
+
+  /** JIT compiled code cannot be instrumented. */
+  opt_list_t
+  getProfileGenerateOptions(const std::string &profileID) const override;
+
   // JIT specific methods
   void addModule(std::unique_ptr<llvm::Module> m, const std::string &versionID);
 
@@ -153,6 +169,16 @@ public:
 
 private:
   inline std::vector<std::string> getArgV(const opt_list_t optionList) const;
+
+  /** \brief Runs the clang driver on the given command line.
+   *
+   * Each invocation uses a private diagnostics engine. Driver diagnostics are
+   * appended to the log file once the compilation is over, so that
+   * compilations sharing the same log file can run concurrently.
+   *
+   * \return false if the compilation could not be created.
+   */
+  bool runDriver(const std::vector<const char *> &cmd_str, int &result) const;
 };
 } /* end namespace vc */
 
@@ -24,7 +24,10 @@
 #include "versioningCompiler/Compiler.hpp"
 
 #include <filesystem>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 namespace vc {
 
@@ -61,6 +64,45 @@ public:
               const std::string &versionID, const opt_list_t options) override;
 
   virtual std::string getOptionString(const Option &o) const override;
+
+  virtual std::string getCompilerVersion() const override;
+
+protected:
+  /** \brief Runs `exe --version` and returns its output. */
+  static std::string queryVersion(const std::filesystem::path &exe);
+
+  /** \brief Appends the options to the argument vector. */
+  void appendOptions(std::vector<std::string> &argv,
+                     const opt_list_t &options) const;
+
+  /** \brief Appends the source list of a Version to the argument vector.
+   *
+   * The first in-memory source is read from the standard input of the
+   * compiler. Any other in-memory source is written to a temporary file,
+   * which is listed in temporaryFiles.
+   *
+   * \return the content to be fed to the standard input. nullptr if none.
+   */
+  std::shared_ptr<const std::string>
+  appendSources(std::vector<std::string> &argv,
+                const std::vector<std::filesystem::path> &src,
+                const std::string &versionID,
+                std::vector<std::filesystem::path> &temporaryFiles) const;
+
+  /** \brief Runs argv on behalf of a Version, feeding input, if any, to
+   * its standard input. Removes the temporary files afterwards.
+   */
+  void runCommand(const std::vector<std::string> &argv,
+                  const std::shared_ptr<const std::string> &input,
+                  const std::vector<std::filesystem::path> &temporaryFiles,
+                  const std::string &versionID) const;
+
+private:
+  /** \brief the compiler version is queried only once. */
+  mutable std::once_flag versionFlag;
+
+  /** \brief output of `compiler --version`. */
+  mutable std::string versionString;
 };
 
 } // end namespace vc
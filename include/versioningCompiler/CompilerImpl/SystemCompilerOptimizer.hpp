@@ -52,9 +52,18 @@ public:
                const std::string &versionID,
                const opt_list_t options) const override;
 
+  virtual std::string getCompilerVersion() const override;
+
 protected:
   std::filesystem::path optInstallDirectory;
   std::filesystem::path optCallString;
+
+private:
+  /** \brief the optimizer version is queried only once. */
+  mutable std::once_flag optVersionFlag;
+
+  /** \brief output of `optimizer --version`. */
+  mutable std::string optVersionString;
 };
 
 } // end namespace vc
@@ -0,0 +1,162 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_DISPATCHER_HPP
+#define LIB_VERSIONING_COMPILER_DISPATCHER_HPP
+
+#include "versioningCompiler/Epoch.hpp"
+#include "versioningCompiler/Version.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace vc {
+
+template <typename Signature> class Dispatcher;
+
+/** \brief Calls the symbol of the current Version of a function, which can be
+ * replaced at any time by another Version.
+ *
+ * The current Version is published through an atomic pointer: installing a
+ * new Version is a single atomic store and calls never take a lock.
+ * The previous Version, together with its shared object, is kept alive until
+ * every call which may still be running inside it has returned.
+ *
+ * Versions installed in a Dispatcher must not be folded: the shared object
+ * would be closed under the running calls.
+ */
+template <typename Ret, typename... Args> class Dispatcher<Ret(Args...)> {
+public:
+  typedef Ret (*function_t)(Args...);
+
+  /** \brief an empty dispatcher. It must not be called before a Version is
+   * installed.
+   */
+  Dispatcher() : current(nullptr) {}
+
+  /** \brief a dispatcher calling the symbol at index of version. */
+  explicit Dispatcher(const version_ptr_t &version, std::size_t index = 0)
+      : current(nullptr) {
+    install(version, index);
+  }
+
+  /** \brief Retires the current Version. */
+  ~Dispatcher() { retire(current.exchange(nullptr)); }
+
+  Dispatcher(const Dispatcher &) = delete;
+  Dispatcher &operator=(const Dispatcher &) = delete;
+
+  /** \brief Calls the current Version. */
+  Ret operator()(Args... args) const {
+    Epoch::Guard guard;
+    const Slot *slot = current.load();
+    return slot->entry(std::forward<Args>(args)...);
+  }
+
+  /** \brief Makes the symbol at index of version the one called from now on.
+   *
+   * \return false if version has no such loaded symbol. The current Version
+   * is kept in that case.
+   */
+  bool install(const version_ptr_t &version, std::size_t index = 0) {
+    if (!version || index >= version->getSymbolCount()) {
+      return false;
+    }
+    Slot *slot = new Slot();
+    slot->version = version;
+    slot->symbols = version->getSymbols();
+    slot->entry = reinterpret_cast<function_t>(slot->symbols[index]);
+    if (!slot->entry) {
+      delete slot;
+      return false;
+    }
+    retire(current.exchange(slot));
+    return true;
+  }
+
+  /** \brief Makes the symbol functionName of version the one called from now
+   * on.
+   *
+   * \return false if version has no such loaded symbol.
+   */
+  bool install(const version_ptr_t &version, const std::string &functionName) {
+    if (!version) {
+      return false;
+    }
+    const int index = version->getSymbolIndex(functionName);
+    return index >= 0 && install(version, (std::size_t)index);
+  }
+
+  /** \brief Removes the current Version. The dispatcher must not be called
+   * until another Version is installed.
+   */
+  void clear() { retire(current.exchange(nullptr)); }
+
+  /** \brief true if a Version is installed. */
+  bool ready() const { return current.load() != nullptr; }
+
+  /** \brief the Version currently installed. nullptr if none. */
+  version_ptr_t getVersion() const {
+    Epoch::Guard guard;
+    const Slot *slot = current.load();
+    return slot ? slot->version : nullptr;
+  }
+
+  /** \brief Calls f with all the symbols of the current Version.
+   *
+   * Symbols of the same group are always taken from the same Version and
+   * they stay valid until f returns. f receives an empty vector if no
+   * Version is installed.
+   */
+  template <typename F>
+  auto withSymbols(F &&f) const
+      -> decltype(f(std::declval<const std::vector<void *> &>())) {
+    static const std::vector<void *> none;
+    Epoch::Guard guard;
+    const Slot *slot = current.load();
+    return f(slot ? slot->symbols : none);
+  }
+
+private:
+  /** \brief an installed Version. Immutable once published. */
+  struct Slot {
+    version_ptr_t version;
+    std::vector<void *> symbols;
+    function_t entry = nullptr;
+  };
+
+  std::atomic<Slot *> current;
+
+  /** \brief Releases slot, and possibly its Version, after the running calls
+   * have returned.
+   */
+  static void retire(Slot *slot) {
+    if (slot) {
+      Epoch::retire([slot]() { delete slot; });
+    }
+  }
+};
+
+} // end namespace vc
+
+#endif /* end of include guard: LIB_VERSIONING_COMPILER_DISPATCHER_HPP */
@@ -0,0 +1,83 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_EPOCH_HPP
+#define LIB_VERSIONING_COMPILER_EPOCH_HPP
+
+#include <cstddef>
+#include <functional>
+
+namespace vc {
+
+/** \brief Epoch-based reclamation of objects shared with lock-free readers.
+ *
+ * Readers wrap every access to a shared object in a Guard. Writers unlink
+ * the object first, then retire it: it is destroyed only once every thread
+ * that was inside a Guard at retirement time has left it.
+ *
+ * Entering and leaving a Guard never blocks: each thread publishes the
+ * epoch it observed in a slot of its own. Guards can be nested.
+ */
+class Epoch {
+public:
+  /** \brief Read-side critical section. Retired objects reachable when the
+   * guard was created stay alive until it is destroyed.
+   */
+  class Guard {
+  public:
+    Guard() { Epoch::enter(); }
+    ~Guard() { Epoch::exit(); }
+    Guard(const Guard &) = delete;
+    Guard &operator=(const Guard &) = delete;
+  };
+
+  /** \brief Schedules deleter to run after the current grace period.
+   *
+   * The object must already be unreachable for new readers. deleter runs
+   * in the thread calling retire(), reclaim() or synchronize().
+   */
+  static void retire(std::function<void()> deleter);
+
+  /** \brief Runs the deleters whose grace period is over. Never blocks on
+   * readers.
+   *
+   * \return number of deleters run.
+   */
+  static std::size_t reclaim();
+
+  /** \brief Waits until all the retired objects are reclaimed.
+   *
+   * Must not be called inside a Guard.
+   */
+  static void synchronize();
+
+  /** \brief number of retired objects not yet reclaimed. */
+  static std::size_t pending();
+
+  /** \brief Enters a read-side critical section. Prefer Guard. */
+  static void enter();
+
+  /** \brief Leaves a read-side critical section. Prefer Guard. */
+  static void exit();
+};
+
+} // end namespace vc
+
+#endif /* end of include guard: LIB_VERSIONING_COMPILER_EPOCH_HPP */
@@ -0,0 +1,167 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_GUARDED_SPECIALIZATION_HPP
+#define LIB_VERSIONING_COMPILER_GUARDED_SPECIALIZATION_HPP
+
+#include "versioningCompiler/Compiler.hpp"
+#include "versioningCompiler/Version.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace vc {
+
+/** \brief A Version specialized on assumptions about its arguments, paired
+ * with a generic Version and a guard that checks the assumptions at every
+ * call.
+ *
+ * The guard is a small C function generated from the assumptions and
+ * compiled as a Version of its own: it calls the specialized Version when
+ * all the assumptions hold and the generic one otherwise.
+ *
+ * The specialized Version is built from the same configuration of the
+ * generic one, plus a define for each assumption:
+ * - assumeValue(p, v):        VC_ASSUME_VALUE_<p>=v
+ * - assumeAligned(p, a):      VC_ASSUME_ALIGNED_<p>=a
+ * - assumeNoAlias(p, q, s):   VC_ASSUME_NOALIAS_<p>_<q>=1
+ * - assumeAtMost(p, b):       VC_ASSUME_MAX_<p>=b
+ * The source code uses them to specialize, e.g. replacing an argument with
+ * a constant or adding alignment and restrict hints.
+ */
+class GuardedSpecialization {
+public:
+  /** \brief a parameter of the guarded function, as in its C prototype. */
+  struct Parameter {
+    std::string type;
+    std::string name;
+  };
+
+  /** \brief Guard for functionName, with the given C return type and
+   * parameters. The guard is compiled with compiler.
+   */
+  GuardedSpecialization(const compiler_ptr_t &compiler,
+                        const std::string &functionName,
+                        const std::string &returnType,
+                        const std::vector<Parameter> &parameters);
+
+  /** \brief Assumes the integer parameter is equal to value. */
+  void assumeValue(const std::string &parameter, long long value);
+
+  /** \brief Assumes the pointer parameter is aligned to alignment bytes,
+   * which must be a power of two.
+   */
+  void assumeAligned(const std::string &parameter, std::size_t alignment);
+
+  /** \brief Assumes the memory ranges of size bytes starting at the two
+   * pointer parameters do not overlap.
+   *
+   * \param size C expression, e.g. "n * sizeof(float)".
+   */
+  void assumeNoAlias(const std::string &first, const std::string &second,
+                     const std::string &size);
+
+  /** \brief Assumes the integer parameter is not greater than bound, e.g. a
+   * trip count.
+   */
+  void assumeAtMost(const std::string &parameter, long long bound);
+
+  /** \brief Adds a custom assumption.
+   *
+   * \param condition C expression of the parameters.
+   * \param define flag given to the specialized Version. Empty for none.
+   */
+  void assume(const std::string &condition, const std::string &define = "");
+
+  /** \brief Builds and compiles the generic and the specialized Versions
+   * from builder, then the guard.
+   *
+   * If the specialized Version does not compile, the generic one is called
+   * unconditionally.
+   *
+   * It blocks until the compilations complete, which run in the
+   * CompileScheduler lanes. It must not be called from a ThreadPool or
+   * CompileScheduler worker thread: the worker may be the one the
+   * compilations wait for.
+   *
+   * \return false if the generic Version or the guard cannot be compiled.
+   */
+  bool build(const Version::Builder &builder);
+
+  /** \brief Pairs two Versions and compiles the guard.
+   *
+   * The Versions not compiled yet and the guard are compiled in the calling
+   * thread. It waits only for compilations of the two Versions already
+   * running elsewhere: it must not be called from a ThreadPool or
+   * CompileScheduler worker thread while they may be running.
+   *
+   * \return false if the generic Version or the guard is not available.
+   */
+  bool build(const version_ptr_t &specialized, const version_ptr_t &generic);
+
+  /** \brief the guarded entry point. nullptr if not built. */
+  void *getSymbol() const;
+
+  /** \brief the guarded entry point cast to FnT. nullptr if not built. */
+  template <typename FnT> FnT getSymbol() const {
+    return reinterpret_cast<FnT>(getSymbol());
+  }
+
+  /** \brief C source code of the guard of the given Versions.
+   *
+   * Their IDs are embedded in the guard, so that guards of different
+   * Versions never share a shared object, nor the targets bound to it.
+   */
+  std::string getGuardSource(const std::string &specializedID = "",
+                             const std::string &genericID = "") const;
+
+  version_ptr_t getSpecialized() const { return specialized; }
+
+  version_ptr_t getGeneric() const { return generic; }
+
+  version_ptr_t getGuard() const { return guard; }
+
+private:
+  compiler_ptr_t compiler;
+
+  std::string functionName;
+
+  std::string returnType;
+
+  std::vector<Parameter> parameters;
+
+  /** \brief C conditions checked by the guard. */
+  std::vector<std::string> conditions;
+
+  /** \brief defines given to the specialized Version. */
+  std::vector<std::string> defines;
+
+  version_ptr_t specialized;
+
+  version_ptr_t generic;
+
+  version_ptr_t guard;
+};
+
+} // end namespace vc
+
+#endif /* end of include guard:                                             \
+          LIB_VERSIONING_COMPILER_GUARDED_SPECIALIZATION_HPP */
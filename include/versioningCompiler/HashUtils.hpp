@@ -0,0 +1,84 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_HASH_UTILS_HPP
+#define LIB_VERSIONING_COMPILER_HASH_UTILS_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace vc {
+
+/** FNV-1a 64 bit offset basis. */
+constexpr uint64_t hash_seed = 0xcbf29ce484222325ULL;
+
+/** Stable (not randomized) FNV-1a 64 bit hash of a memory region.
+ *
+ * It is used to compute content-based identifiers which have to be the same
+ * across different processes, hence std::hash is not suitable.
+ */
+inline uint64_t hashBytes(const void *data, std::size_t size,
+                          uint64_t seed = hash_seed) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  uint64_t h = seed;
+  for (std::size_t i = 0; i < size; i++) {
+    h ^= p[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+/** Hash a string. The length is included to avoid ambiguous concatenations. */
+inline uint64_t hashString(const std::string &s, uint64_t seed = hash_seed) {
+  const uint64_t len = s.size();
+  seed = hashBytes(&len, sizeof(len), seed);
+  return hashBytes(s.data(), s.size(), seed);
+}
+
+/** Hash the content of a file.
+ *
+ * Returns false if the file cannot be read.
+ */
+inline bool hashFile(const std::filesystem::path &fileName, uint64_t &h) {
+  std::ifstream in(fileName, std::ios::in | std::ios::binary);
+  if (!in.is_open()) {
+    return false;
+  }
+  char buf[4096];
+  while (in.read(buf, sizeof(buf)) || in.gcount() > 0) {
+    h = hashBytes(buf, static_cast<std::size_t>(in.gcount()), h);
+  }
+  return true;
+}
+
+/** Fixed-width hexadecimal representation of a hash value. */
+inline std::string hashToString(uint64_t h) {
+  char buf[17];
+  std::snprintf(buf, sizeof(buf), "%016llx",
+                static_cast<unsigned long long>(h));
+  return std::string(buf);
+}
+
+} // end namespace vc
+
+#endif /* end of include guard: LIB_VERSIONING_COMPILER_HASH_UTILS_HPP */
@@ -0,0 +1,209 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_MEMORY_BUDGET_MANAGER_HPP
+#define LIB_VERSIONING_COMPILER_MEMORY_BUDGET_MANAGER_HPP
+
+#include "versioningCompiler/Version.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+namespace vc {
+
+/** \brief Keeps the memory taken by loaded Versions within a budget.
+ *
+ * Tracked Versions are accounted either by the size of their mapped ELF
+ * sections or by their resident size, as reported by /proc/self/smaps.
+ * When the budget is exceeded, the least recently or the least frequently
+ * used Versions are folded. A folded Version is reloaded transparently when
+ * it is pinned again.
+ *
+ * Symbols of a tracked Version must be used only while the Version is
+ * pinned: unpinned Versions may be folded at any time by another thread.
+ */
+class MemoryBudgetManager {
+public:
+  /** \brief which Versions are folded first. */
+  enum Policy { LEAST_RECENTLY_USED, LEAST_FREQUENTLY_USED };
+
+  /** \brief how the memory of a Version is accounted. */
+  enum Metric { MAPPED_SIZE, RESIDENT_SIZE };
+
+  /** \brief Keeps a Version loaded while alive. Movable, not copyable. */
+  class Pin {
+  public:
+    Pin() = default;
+    Pin(Pin &&other);
+    Pin &operator=(Pin &&other);
+    Pin(const Pin &) = delete;
+    Pin &operator=(const Pin &) = delete;
+    ~Pin() { release(); }
+
+    /** \brief false if the Version could not be loaded. */
+    explicit operator bool() const { return version != nullptr; }
+
+    const version_ptr_t &getVersion() const { return version; }
+
+    /** \brief Same as Version::getSymbol<FnT>(index). */
+    template <typename FnT> FnT getSymbol(std::size_t index = 0) const {
+      return version ? version->getSymbol<FnT>(index) : nullptr;
+    }
+
+    /** \brief Unpins the Version before the Pin is destroyed. */
+    void release();
+
+  private:
+    friend class MemoryBudgetManager;
+
+    Pin(MemoryBudgetManager *manager, const version_ptr_t &version)
+        : manager(manager), version(version) {}
+
+    MemoryBudgetManager *manager = nullptr;
+
+    version_ptr_t version;
+  };
+
+  /** \brief budget in bytes. */
+  MemoryBudgetManager(std::size_t budget,
+                      Policy policy = LEAST_RECENTLY_USED,
+                      Metric metric = MAPPED_SIZE);
+
+  MemoryBudgetManager(const MemoryBudgetManager &) = delete;
+  MemoryBudgetManager &operator=(const MemoryBudgetManager &) = delete;
+
+  /** \brief Starts accounting a compiled Version, then enforces the budget.
+   *
+   * The Version is not kept alive by the manager.
+   *
+   * \return false if the Version has no loaded shared object.
+   */
+  bool track(const version_ptr_t &version);
+
+  /** \brief Stops accounting a Version. It is left loaded or folded. */
+  void untrack(const version_ptr_t &version);
+
+  /** \brief Records a use of a tracked Version and keeps it loaded until
+   * the Pin is released. Folded Versions are reloaded, and the budget is
+   * enforced on the others.
+   *
+   * \return an empty Pin if the Version is not tracked or cannot be
+   * reloaded.
+   */
+  Pin pin(const version_ptr_t &version);
+
+  /** \brief Reads the resident sizes from /proc/self/smaps, then enforces
+   * the budget.
+   *
+   * \return the memory accounted after enforcement.
+   */
+  std::size_t refresh();
+
+  /** \brief Folds unpinned Versions until the budget is met.
+   *
+   * \return the number of folded Versions.
+   */
+  std::size_t enforce();
+
+  /** \brief memory accounted to the loaded Versions, in bytes. */
+  std::size_t getUsage() const;
+
+  std::size_t getBudget() const;
+
+  /** \brief Changes the budget. It is enforced on the next track, pin,
+   * refresh or enforce.
+   */
+  void setBudget(std::size_t budget);
+
+  /** \brief Returns the total size of the sections of an ELF shared object
+   * which are mapped in memory. 0 if the file cannot be parsed.
+   */
+  static std::size_t getMappedSize(const std::filesystem::path &bin);
+
+private:
+  struct Entry {
+    std::weak_ptr<Version> version;
+    std::filesystem::path binary;
+    /** \brief identity of the binary, as listed in /proc/self/smaps. */
+    dev_t device = 0;
+    ino_t inode = 0;
+    std::size_t mappedSize = 0;
+    std::size_t residentSize = 0;
+    uint64_t lastUse = 0;
+    uint64_t uses = 0;
+    std::size_t pins = 0;
+    bool folded = false;
+  };
+
+  mutable std::mutex mtx;
+
+  /** \brief Serializes folds and reloads, which are run without holding mtx.
+   * It is always taken before mtx.
+   */
+  std::mutex loadMtx;
+
+  std::unordered_map<const Version *, Entry> entries;
+
+  std::size_t budget;
+
+  const Policy policy;
+
+  const Metric metric;
+
+  /** \brief logical clock, incremented at each use. */
+  uint64_t clock = 0;
+
+  /** \brief Unpins a Version. */
+  void unpin(const version_ptr_t &version);
+
+  /** \brief Memory accounted to an entry while loaded. */
+  std::size_t sizeOf(const Entry &entry) const;
+
+  /** \brief Lock must be held. */
+  std::size_t usage() const;
+
+  /** \brief Marks as folded the unpinned Versions to fold to meet the
+   * budget, and returns them. Lock must be held.
+   */
+  std::vector<version_ptr_t> selectVictims();
+
+  /** \brief Folds the Versions selected by selectVictims, unless they have
+   * been pinned in the meantime. Lock must not be held.
+   *
+   * \return the number of folded Versions.
+   */
+  std::size_t foldVictims(const std::vector<version_ptr_t> &victims);
+
+  /** \brief Reloads a pinned Version if it is folded. Lock must not be held.
+   */
+  bool reloadPinned(const version_ptr_t &version);
+};
+
+} // end namespace vc
+
+#endif /* end of include guard:                                             \
+          LIB_VERSIONING_COMPILER_MEMORY_BUDGET_MANAGER_HPP */
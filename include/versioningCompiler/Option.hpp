@@ -21,11 +21,22 @@
 #ifndef LIB_VERSIONING_COMPILER_OPTION_HPP
 #define LIB_VERSIONING_COMPILER_OPTION_HPP
 
+#include <atomic>
+#include <cstddef>
 #include <list>
 #include <string>
+#include <vector>
 
 namespace vc {
 
+/** \brief Compiler option.
+ *
+ * Options are interned: each distinct option is stored once in a process
+ * wide table and an Option is a counted reference to it. Copies are cheap,
+ * and comparisons and hashing use values precomputed at interning time.
+ * An interned option is released with the last Option referring to it, so
+ * the table holds only the options in use.
+ */
 class Option {
 
 public:
@@ -47,28 +58,75 @@ public:
   Option(const std::string &optionTag, const std::string &optionPrefix,
          const std::string &val = "");
 
-  Option(const Option &other) = default;
+  Option(const Option &other) : data(other.data) { acquire(); }
+
+  ~Option() { release(); }
 
-  std::string getTag() const;
+  const std::string &getTag() const;
 
-  std::string getValue() const;
+  const std::string &getValue() const;
 
-  std::string getPrefix() const;
+  const std::string &getPrefix() const;
 
-  inline Option &operator=(const Option &other) = default;
+  /** \brief Interned identifier. Options with the same tag, prefix and value
+   * have the same identifier. The identifier of a released option may be
+   * given to a new one.
+   */
+  inline std::size_t getID() const { return data->id; }
+
+  /** \brief Hash of the option string, i.e. prefix followed by value. */
+  inline std::size_t getHash() const { return data->hash; }
+
+  inline Option &operator=(const Option &other) {
+    if (data != other.data) {
+      other.acquire();
+      release();
+      data = other.data;
+    }
+    return *this;
+  }
 
-  inline bool operator==(const Option &other) {
-    return (getPrefix() + getValue()) == (other.getPrefix() + other.getValue());
+  inline bool operator==(const Option &other) const {
+    return data == other.data ||
+           (data->hash == other.data->hash && data->text == other.data->text);
   }
 
-  inline bool operator<(const Option &other) {
-    return (getPrefix() + getValue()) < (other.getPrefix() + other.getValue());
+  inline bool operator<(const Option &other) const {
+    return data != other.data && data->text < other.data->text;
   }
 
+  /** \brief Interned option. */
+  struct Data {
+    std::string tag;
+    std::string value;
+    std::string prefix;
+    /** \brief prefix followed by value. */
+    std::string text;
+    std::size_t id;
+    std::size_t hash;
+    /** \brief number of Options referring to it. */
+    mutable std::atomic<std::size_t> references{0};
+    /** \brief false while the entry is free in the table. */
+    bool interned = false;
+  };
+
 private:
-  std::string tag;
-  std::string value;
-  std::string prefix;
+  const Data *data;
+
+  inline void acquire() const {
+    data->references.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  inline void release() const {
+    if (data->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      unintern(data);
+    }
+  }
+
+  /** \brief Removes an option from the table, unless it has been referred
+   * to again in the meantime.
+   */
+  static void unintern(const Data *data);
 };
 
 /** static High-Level API - Option creation */
@@ -76,8 +134,8 @@ static inline Option make_option(const std::string &opt_string) {
   return Option("", opt_string);
 }
 
-/** Option list data type */
-typedef std::list<Option> opt_list_t;
+/** Option list data type. Options are kept in a contiguous array. */
+typedef std::vector<Option> opt_list_t;
 
 /** static High-Level API - Option list creation
  *
@@ -87,7 +145,8 @@ typedef std::list<Option> opt_list_t;
  */
 static inline opt_list_t make_option_list(const std::list<std::string> &l) {
   opt_list_t ol;
-  for (const auto elem : l) {
+  ol.reserve(l.size());
+  for (const auto &elem : l) {
     ol.push_back(make_option(elem));
   }
   return ol;
@@ -97,8 +156,8 @@ static inline opt_list_t make_option_list(const std::list<std::string> &l) {
 
 namespace std {
 template <> struct hash<vc::Option> {
-  std::size_t operator()(const vc::Option &key) {
-    return hash<std::string>()(key.getPrefix() + key.getValue());
+  std::size_t operator()(const vc::Option &key) const {
+    return key.getHash();
   }
 };
 } // end namespace std
@@ -0,0 +1,95 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_PROCESS_LAUNCHER_HPP
+#define LIB_VERSIONING_COMPILER_PROCESS_LAUNCHER_HPP
+
+#include "versioningCompiler/CancellationToken.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace vc {
+
+/** \brief Environment variables, by name. */
+typedef std::map<std::string, std::string> env_map_t;
+
+/** \brief Outcome of a child process. */
+struct ProcessResult {
+  /** \brief false if the process could not be started. */
+  bool launched = false;
+
+  /** \brief exit status. -1 if the process did not exit normally. */
+  int exitCode = -1;
+
+  /** \brief signal which terminated the process. 0 if none. */
+  int signal = 0;
+
+  /** \brief true if the process was stopped through its cancellation token.
+   */
+  bool cancelled = false;
+
+  /** \brief standard output and standard error, interleaved. */
+  std::string output;
+
+  /** \brief true if the process was started and exited with status 0. */
+  bool success() const { return launched && exitCode == 0; }
+};
+
+/** \brief Runs external programs without an intermediate shell.
+ *
+ * Processes are started with posix_spawn, which does not copy the page
+ * tables of the calling process. Standard output and standard error are
+ * collected through a pipe.
+ */
+class ProcessLauncher {
+public:
+  /** \brief Runs argv[0] with arguments argv and waits for its completion.
+   *
+   * argv[0] is looked up in PATH if it does not contain a slash.
+   *
+   * \param input if not nullptr, it is written to the standard input of the
+   * process. Otherwise the standard input is /dev/null.
+   * \param environment variables added to, or replacing, the ones of the
+   * calling process.
+   * \param cancel if not nullptr, it is polled while the process runs. Once
+   * cancelled, the process group of the child receives SIGTERM, then SIGKILL
+   * if it is still alive after a grace period.
+   */
+  static ProcessResult run(const std::vector<std::string> &argv,
+                           const std::string *input = nullptr,
+                           const env_map_t &environment = {},
+                           const CancellationToken *cancel = nullptr);
+
+  /** \brief Splits a command line into arguments.
+   *
+   * Blanks separate arguments. Single quotes, double quotes and backslashes
+   * are handled as in sh. No other shell expansion is performed.
+   */
+  static std::vector<std::string> tokenize(const std::string &command);
+
+  /** \brief Joins arguments into a command line, for logging purposes. */
+  static std::string join(const std::vector<std::string> &argv);
+};
+
+} // end namespace vc
+
+#endif /* end of include guard: LIB_VERSIONING_COMPILER_PROCESS_LAUNCHER_HPP */
@@ -0,0 +1,274 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_PROFILE_GUIDED_FUNCTION_HPP
+#define LIB_VERSIONING_COMPILER_PROFILE_GUIDED_FUNCTION_HPP
+
+#include "versioningCompiler/Dispatcher.hpp"
+#include "versioningCompiler/Epoch.hpp"
+#include "versioningCompiler/ThreadPool.hpp"
+#include "versioningCompiler/Version.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+namespace vc {
+
+template <typename Signature> class ProfileGuidedFunction;
+
+/** \brief Two-phase profile-guided optimization of a Version.
+ *
+ * The configuration given by the builder is first compiled with the
+ * instrumentation options of its Compiler, and the instrumented Version
+ * serves the calls while it collects the profile. Once minCalls calls have
+ * been made, in the library thread pool:
+ * - a plain Version of the same configuration replaces the instrumented one,
+ *   which is then unloaded and writes its profile;
+ * - the profile is merged, if needed, by Compiler::getProfileUseOptions;
+ * - the configuration is compiled again with the profile, and the resulting
+ *   Version replaces the plain one.
+ *
+ * Calls are never blocked during the switches. The instrumented Version
+ * writes its profile only when unloaded, hence it must not be shared with
+ * other owners. Each object has a profile of its own, removed with it.
+ */
+template <typename Ret, typename... Args>
+class ProfileGuidedFunction<Ret(Args...)> {
+public:
+  /** \brief progress of the workflow. FAILED means that a plain or the
+   * instrumented Version serves the calls, without profile.
+   */
+  enum State { INSTRUMENTED, OPTIMIZING, OPTIMIZED, FAILED };
+
+  /** \brief Compiles the instrumented Version.
+   *
+   * Falls back to a plain Version if the Compiler does not support
+   * profiling.
+   */
+  ProfileGuidedFunction(const Version::Builder &builder, std::size_t minCalls)
+      : builder(builder), minCalls(minCalls), serial(nextSerial()),
+        state(FAILED), calls(0), triggered(false) {
+    const compiler_ptr_t compiler = builder._compiler;
+    if (!compiler) {
+      return;
+    }
+    // objects of the same configuration, even in other processes, must
+    // not write into each other's profile
+    profileID = "vc_pgo_" + builder.getConfigurationKey() + "_" +
+                std::to_string(getpid()) + "_" + std::to_string(serial);
+    std::error_code ec;
+    std::filesystem::remove_all(compiler->getProfileDirectory(profileID), ec);
+    const opt_list_t generate = compiler->getProfileGenerateOptions(profileID);
+    if (!generate.empty()) {
+      version_ptr_t v = build(generate);
+      if (v->compile() && dispatcher.install(v)) {
+        instrumented = v;
+        state = INSTRUMENTED;
+        return;
+      }
+    }
+    // no profile: the plain Version serves the calls
+    version_ptr_t v = build({});
+    if (v->compile()) {
+      dispatcher.install(v);
+    }
+  }
+
+  /** \brief Waits for the background optimization, if any, and removes
+   * the profile.
+   */
+  ~ProfileGuidedFunction() {
+    std::shared_future<bool> pending;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      pending = optimization;
+    }
+    if (pending.valid()) {
+      pending.wait();
+    }
+    if (instrumented) {
+      // not optimized yet: the profile is written now, not after removal
+      instrumented->fold();
+    }
+    if (!profileID.empty()) {
+      std::error_code ec;
+      std::filesystem::remove_all(
+          builder._compiler->getProfileDirectory(profileID), ec);
+    }
+  }
+
+  ProfileGuidedFunction(const ProfileGuidedFunction &) = delete;
+  ProfileGuidedFunction &operator=(const ProfileGuidedFunction &) = delete;
+
+  /** \brief false if no Version could be compiled. */
+  bool ready() const { return dispatcher.ready(); }
+
+  /** \brief Calls the current Version. Requires ready(). */
+  Ret operator()(Args... args) {
+    if (state.load(std::memory_order_relaxed) == INSTRUMENTED) {
+      // calls are counted in batches to keep the counter off the hot path.
+      // Objects sharing a cache entry reset each other's batch: less than a
+      // batch of calls may be missed.
+      struct Batch {
+        uint64_t serial;
+        unsigned tick;
+      };
+      static thread_local Batch batches[cacheSize] = {};
+      Batch &batch = batches[serial % cacheSize];
+      if (batch.serial != serial) {
+        batch.serial = serial;
+        batch.tick = 0;
+      }
+      if (++batch.tick == countBatch) {
+        batch.tick = 0;
+        if (calls.fetch_add(countBatch) + countBatch >= minCalls) {
+          optimize();
+        }
+      }
+    }
+    return dispatcher(std::forward<Args>(args)...);
+  }
+
+  /** \brief Starts the optimization now, whatever the number of calls. */
+  void optimize() {
+    if (state.load() != INSTRUMENTED || triggered.exchange(true)) {
+      return;
+    }
+    state = OPTIMIZING;
+    std::lock_guard<std::mutex> lock(mtx);
+    optimization = ThreadPool::getDefault().async([this]() {
+      const bool ok = rebuild();
+      state = ok ? OPTIMIZED : FAILED;
+      return ok;
+    });
+    return;
+  }
+
+  /** \brief Waits until the optimization, if started, completes.
+   *
+   * \return true if the profile-optimized Version is in use.
+   */
+  bool waitOptimization() const {
+    std::shared_future<bool> pending;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      pending = optimization;
+    }
+    return pending.valid() && pending.get();
+  }
+
+  State getState() const { return state.load(); }
+
+  /** \brief name of the profile, as given to the Compiler. */
+  const std::string &getProfileID() const { return profileID; }
+
+  /** \brief Returns the Version serving the calls. */
+  version_ptr_t getVersion() const { return dispatcher.getVersion(); }
+
+private:
+  static constexpr unsigned countBatch = 16;
+
+  /** \brief entries of the per-thread call batch cache. */
+  static constexpr std::size_t cacheSize = 8;
+
+  const Version::Builder builder;
+
+  const std::size_t minCalls;
+
+  /** \brief identifies this object in the per-thread call batches. */
+  const uint64_t serial;
+
+  std::string profileID;
+
+  Dispatcher<Ret(Args...)> dispatcher;
+
+  /** \brief released as soon as the plain Version is installed. */
+  version_ptr_t instrumented;
+
+  std::atomic<State> state;
+
+  std::atomic<std::size_t> calls;
+
+  std::atomic<bool> triggered;
+
+  /** \brief protects optimization. */
+  mutable std::mutex mtx;
+
+  std::shared_future<bool> optimization;
+
+  /** \brief serials are never reused, unlike addresses. */
+  static uint64_t nextSerial() {
+    static std::atomic<uint64_t> last(0);
+    return ++last;
+  }
+
+  /** \brief Builds the configuration with additional options. */
+  version_ptr_t build(const opt_list_t &extra) const {
+    Version::Builder b(builder);
+    b._optionList.insert(b._optionList.end(), extra.begin(), extra.end());
+    if (b._compiler->hasIRSupport()) {
+      // instrumentation and profile use happen in the frontend
+      b._genIROptionList.insert(b._genIROptionList.end(), extra.begin(),
+                                extra.end());
+    }
+    return b.build();
+  }
+
+  /** \brief Flushes the profile and compiles the optimized Version. */
+  bool rebuild() {
+    version_ptr_t plain = build({});
+    if (!plain->compile() || !dispatcher.install(plain)) {
+      return false;
+    }
+    // calls running at install time may still be in the instrumented
+    // Version: wait for the grace period of its slot only
+    auto graceOver = std::make_shared<std::atomic<bool>>(false);
+    Epoch::retire([graceOver]() { *graceOver = true; });
+    while (!*graceOver) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      Epoch::reclaim();
+    }
+    // unloading it here writes the profile before it is read
+    instrumented->fold();
+    instrumented = nullptr;
+    const opt_list_t use =
+        builder._compiler->getProfileUseOptions(profileID);
+    if (use.empty()) {
+      return false;
+    }
+    version_ptr_t optimized = build(use);
+    return optimized->compile() && dispatcher.install(optimized);
+  }
+};
+
+} // end namespace vc
+
+#endif /* end of include guard:                                                \
+          LIB_VERSIONING_COMPILER_PROFILE_GUIDED_FUNCTION_HPP */
@@ -0,0 +1,402 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_PROFILED_FUNCTION_HPP
+#define LIB_VERSIONING_COMPILER_PROFILED_FUNCTION_HPP
+
+#include "versioningCompiler/Dispatcher.hpp"
+#include "versioningCompiler/GuardedSpecialization.hpp"
+#include "versioningCompiler/ThreadPool.hpp"
+#include "versioningCompiler/Version.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace vc {
+
+/** \brief Sampling parameters of a ProfiledFunction. */
+struct ProfilingOptions {
+  /** \brief one call every samplingPeriod, per thread, is sampled. */
+  unsigned samplingPeriod = 64;
+
+  /** \brief samples kept by the reservoir of each thread. */
+  std::size_t reservoirSize = 64;
+
+  /** \brief samples needed before looking for near-constant arguments. */
+  std::size_t minSamples = 256;
+
+  /** \brief an argument is near-constant if this fraction of the samples
+   * has the same value.
+   */
+  double threshold = 0.9;
+
+  /** \brief at most this many arguments are assumed constant, the most
+   * frequent values first.
+   */
+  std::size_t maxAssumptions = 4;
+
+  /** \brief the specialization is skipped when this many ProfiledFunction
+   * objects of the process are already specialized. Each specialization
+   * keeps two more Versions loaded, and their defines interned.
+   */
+  std::size_t maxSpecializations = 256;
+};
+
+namespace detail {
+/** \brief number of specialized ProfiledFunction objects of the process. */
+inline std::atomic<std::size_t> activeSpecializations(0);
+} // namespace detail
+
+template <typename Signature> class ProfiledFunction;
+
+/** \brief Calls a generic Version while sampling its integer arguments, and
+ * switches to a specialized Version once some arguments turn out to be
+ * near-constant.
+ *
+ * This automates the #ifdef knobs of hand-written specializations for
+ * long-running programs whose parameters settle after startup.
+ * Each calling thread keeps its own sampling counter and reservoir of
+ * sampled values. When enough samples are collected, a task of the library
+ * thread pool merges the reservoirs: every integer argument whose most
+ * frequent value reaches the threshold is assumed to be constant. The task
+ * compiles the generic configuration again with VC_ASSUME_VALUE_<name>=<value>
+ * defines, and wraps it in a GuardedSpecialization that falls back to the
+ * generic Version on other values. The guarded entry point then replaces the
+ * generic one. Profiling stops after that decision.
+ *
+ * The specialized Version bypasses the registry of the builder, hence the
+ * task compiles it by itself and never waits for other tasks.
+ */
+template <typename Ret, typename... Args>
+class ProfiledFunction<Ret(Args...)> {
+public:
+  /** \brief progress of the automatic specialization. */
+  enum State { PROFILING, SPECIALIZING, SPECIALIZED, GENERIC };
+
+  /** \brief Compiles the generic Version from builder.
+   *
+   * \param returnType C return type of the function.
+   * \param parameters C types and names of the function parameters, used by
+   * the guard and by the specialization defines.
+   */
+  ProfiledFunction(const Version::Builder &builder,
+                   const std::string &returnType,
+                   const std::vector<GuardedSpecialization::Parameter>
+                       &parameters,
+                   const ProfilingOptions &options = ProfilingOptions())
+      : builder(builder), returnType(returnType), parameters(parameters),
+        options(options), serial(nextSerial()), state(PROFILING), samples(0),
+        analyzed(false), counted(false) {
+    static_assert(sizeof...(Args) > 0, "nothing to profile");
+    if (this->options.samplingPeriod == 0) {
+      this->options.samplingPeriod = 1;
+    }
+    generic = Version::Builder(builder).build();
+    if (parameters.size() != sizeof...(Args) || !generic->compile() ||
+        !dispatcher.install(generic)) {
+      state = GENERIC;
+    }
+  }
+
+  /** \brief Waits for the background specialization, if any. */
+  ~ProfiledFunction() {
+    std::shared_future<bool> pending;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      pending = specialization;
+    }
+    if (pending.valid()) {
+      pending.wait();
+    }
+    if (counted) {
+      detail::activeSpecializations--;
+    }
+  }
+
+  ProfiledFunction(const ProfiledFunction &) = delete;
+  ProfiledFunction &operator=(const ProfiledFunction &) = delete;
+
+  /** \brief false if the generic Version could not be compiled. */
+  bool ready() const { return dispatcher.ready(); }
+
+  /** \brief Calls the current Version, sampling the arguments from time to
+   * time. Requires ready().
+   */
+  Ret operator()(Args... args) {
+    if (state.load(std::memory_order_relaxed) == PROFILING) {
+      Reservoir &reservoir = getReservoir();
+      if (++reservoir.tick % options.samplingPeriod == 0) {
+        sample(reservoir, args...);
+      }
+    }
+    return dispatcher(std::forward<Args>(args)...);
+  }
+
+  State getState() const { return state.load(); }
+
+  /** \brief values assumed constant by the specialization, by parameter
+   * name. Empty until a decision is taken.
+   */
+  std::map<std::string, long long> getAssumptions() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return assumptions;
+  }
+
+  /** \brief Waits until the specialization, if started, completes.
+   *
+   * \return true if the specialized Version is in use.
+   */
+  bool waitSpecialization() const {
+    std::shared_future<bool> pending;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      pending = specialization;
+    }
+    return pending.valid() && pending.get();
+  }
+
+private:
+  static constexpr std::size_t arity = sizeof...(Args);
+
+  typedef std::array<long long, arity> sample_t;
+
+  /** \brief sampling state of a thread. Only the owner thread writes it,
+   * the lock is contended only by the analysis.
+   */
+  struct Reservoir {
+    /** \brief calls of the owner thread, not protected by mtx. */
+    unsigned tick = 0;
+    std::mutex mtx;
+    std::vector<sample_t> values;
+    std::size_t seen = 0;
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+  };
+
+  const Version::Builder builder;
+
+  const std::string returnType;
+
+  const std::vector<GuardedSpecialization::Parameter> parameters;
+
+  ProfilingOptions options;
+
+  /** \brief entries of the per-thread reservoir cache. */
+  static constexpr std::size_t cacheSize = 8;
+
+  /** \brief identifies this object in the per-thread reservoir caches. */
+  const uint64_t serial;
+
+  Dispatcher<Ret(Args...)> dispatcher;
+
+  version_ptr_t generic;
+
+  std::atomic<State> state;
+
+  std::atomic<std::size_t> samples;
+
+  std::atomic<bool> analyzed;
+
+  /** \brief true if this object counts in activeSpecializations. */
+  bool counted;
+
+  /** \brief protects reservoirs, assumptions, specialization and guarded. */
+  mutable std::mutex mtx;
+
+  /** \brief reservoirs of the calling threads. */
+  std::unordered_map<std::thread::id, std::unique_ptr<Reservoir>> reservoirs;
+
+  std::map<std::string, long long> assumptions;
+
+  std::shared_future<bool> specialization;
+
+  /** \brief keeps the specialized and the generic Versions alive. */
+  std::shared_ptr<GuardedSpecialization> guarded;
+
+  template <typename T> static long long valueOf(const T &v) {
+    if constexpr (std::is_integral<T>::value || std::is_enum<T>::value) {
+      return (long long)v;
+    } else {
+      return 0;
+    }
+  }
+
+  static constexpr std::array<bool, arity> integral = {
+      {(std::is_integral<std::decay_t<Args>>::value ||
+        std::is_enum<std::decay_t<Args>>::value)...}};
+
+  /** \brief serials are never reused, unlike addresses. */
+  static uint64_t nextSerial() {
+    static std::atomic<uint64_t> last(0);
+    return ++last;
+  }
+
+  /** \brief Returns the reservoir of the calling thread, creating it on
+   * its first call.
+   */
+  Reservoir &getReservoir() {
+    // direct-mapped per-thread cache, trivially destructible
+    struct CacheEntry {
+      uint64_t serial;
+      Reservoir *reservoir;
+    };
+    static thread_local CacheEntry cache[cacheSize] = {};
+    CacheEntry &entry = cache[serial % cacheSize];
+    if (entry.serial != serial) {
+      std::lock_guard<std::mutex> lock(mtx);
+      std::unique_ptr<Reservoir> &owned =
+          reservoirs[std::this_thread::get_id()];
+      if (!owned) {
+        owned = std::make_unique<Reservoir>();
+        owned->values.reserve(options.reservoirSize);
+      }
+      entry.serial = serial;
+      entry.reservoir = owned.get();
+    }
+    return *entry.reservoir;
+  }
+
+  void sample(Reservoir &reservoir, const Args &...args) {
+    const sample_t values = {{valueOf(args)...}};
+    {
+      std::lock_guard<std::mutex> lock(reservoir.mtx);
+      reservoir.seen++;
+      if (reservoir.values.size() < options.reservoirSize) {
+        reservoir.values.push_back(values);
+      } else {
+        // xorshift: uniform replacement keeps an unbiased reservoir
+        reservoir.rng ^= reservoir.rng << 13;
+        reservoir.rng ^= reservoir.rng >> 7;
+        reservoir.rng ^= reservoir.rng << 17;
+        const std::size_t j = reservoir.rng % reservoir.seen;
+        if (j < reservoir.values.size()) {
+          reservoir.values[j] = values;
+        }
+      }
+    }
+    if (++samples >= options.minSamples && !analyzed.exchange(true)) {
+      // the calling thread only hands the reservoirs over
+      state = SPECIALIZING;
+      std::lock_guard<std::mutex> lock(mtx);
+      specialization =
+          ThreadPool::getDefault().async([this]() { return specialize(); });
+    }
+    return;
+  }
+
+  /** \brief Looks for near-constant arguments. */
+  std::map<std::string, long long> analyze() {
+    std::vector<sample_t> merged;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      for (const auto &reservoir : reservoirs) {
+        std::lock_guard<std::mutex> reservoirLock(reservoir.second->mtx);
+        merged.insert(merged.end(), reservoir.second->values.begin(),
+                      reservoir.second->values.end());
+      }
+    }
+    // most frequent values first
+    std::multimap<std::size_t, std::pair<std::string, long long>,
+                  std::greater<std::size_t>>
+        candidates;
+    for (std::size_t a = 0; a < arity; a++) {
+      if (!integral[a]) {
+        continue;
+      }
+      std::map<long long, std::size_t> histogram;
+      for (const auto &s : merged) {
+        histogram[s[a]]++;
+      }
+      for (const auto &bin : histogram) {
+        if (bin.second >= options.threshold * merged.size()) {
+          candidates.emplace(bin.second,
+                             std::make_pair(parameters[a].name, bin.first));
+        }
+      }
+    }
+    std::map<std::string, long long> found;
+    for (const auto &candidate : candidates) {
+      if (found.size() == options.maxAssumptions) {
+        break;
+      }
+      found.insert(candidate.second);
+    }
+    return found;
+  }
+
+  /** \brief Analyzes the samples and builds the guarded specialization.
+   * Runs in the library thread pool.
+   */
+  bool specialize() {
+    const std::map<std::string, long long> found = analyze();
+    if (found.empty() ||
+        ++detail::activeSpecializations > options.maxSpecializations) {
+      if (!found.empty()) {
+        detail::activeSpecializations--;
+      }
+      state = GENERIC;
+      return false;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      assumptions = found;
+    }
+    Version::Builder specializedBuilder(builder);
+    // a new Version, compiled by this task: nothing to wait for
+    specializedBuilder._registry = nullptr;
+    auto g = std::make_shared<GuardedSpecialization>(
+        builder._compiler, builder._functionName.at(0), returnType,
+        parameters);
+    for (const auto &value : found) {
+      specializedBuilder.addDefine("VC_ASSUME_VALUE_" + value.first,
+                                   value.second);
+      g->assumeValue(value.first, value.second);
+    }
+    const bool ok = g->build(specializedBuilder.build(), generic) &&
+                    g->getSpecialized() && dispatcher.install(g->getGuard());
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      guarded = g;
+    }
+    if (ok) {
+      counted = true;
+    } else {
+      detail::activeSpecializations--;
+    }
+    state = ok ? SPECIALIZED : GENERIC;
+    return ok;
+  }
+};
+
+} // end namespace vc
+
+#endif /* end of include guard: LIB_VERSIONING_COMPILER_PROFILED_FUNCTION_HPP */
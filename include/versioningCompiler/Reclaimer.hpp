@@ -0,0 +1,113 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_RECLAIMER_HPP
+#define LIB_VERSIONING_COMPILER_RECLAIMER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vc {
+
+/** \brief Background thread releasing the resources of destroyed Versions.
+ *
+ * Unloading a shared object and removing files may block, so the Version
+ * destructor queues them here instead of running them in the thread which
+ * drops the last reference. Tasks run in order. All the file removals
+ * queued while the thread is busy are then done in one batch. A file is
+ * removed only after the tasks queued before it have run.
+ */
+class Reclaimer {
+public:
+  typedef std::function<void()> task_t;
+
+  /** \brief Starts the reclaimer thread. */
+  Reclaimer();
+
+  /** \brief Completes the queued work and joins the thread. */
+  ~Reclaimer();
+
+  Reclaimer(const Reclaimer &) = delete;
+  Reclaimer &operator=(const Reclaimer &) = delete;
+
+  /** \brief Enqueues a task. Never blocks on task execution. */
+  void defer(task_t task);
+
+  /** \brief Enqueues the removal of a file. */
+  void removeFile(const std::filesystem::path &file);
+
+  /** \brief number of tasks and file removals queued or running. */
+  std::size_t pending() const;
+
+  /** \brief Waits until the queued work is done.
+   *
+   * Must not be called by a task of this reclaimer.
+   */
+  void drain();
+
+  /** \brief When disabled, work runs in the thread which queues it.
+   * Enabled by default.
+   */
+  void setEnabled(bool enable);
+
+  bool isEnabled() const;
+
+  /** \brief Reclaimer used by the Version destructor.
+   *
+   * Queued work is completed before the process exits. It is disabled
+   * while the process exits: Versions destroyed then, such as static ones,
+   * are torn down inline.
+   */
+  static Reclaimer &getDefault();
+
+private:
+  mutable std::mutex mtx;
+
+  std::condition_variable wakeup;
+
+  /** \brief notified when the queue becomes empty. */
+  std::condition_variable idle;
+
+  std::deque<task_t> tasks;
+
+  std::vector<std::filesystem::path> files;
+
+  /** \brief number of tasks and file removals being run. */
+  std::size_t running;
+
+  std::atomic<bool> enabled;
+
+  bool stopping;
+
+  std::thread worker;
+
+  void workerLoop();
+};
+
+} // end namespace vc
+
+#endif /* end of include guard: LIB_VERSIONING_COMPILER_RECLAIMER_HPP */
@@ -0,0 +1,145 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_SHARED_OBJECT_MANAGER_HPP
+#define LIB_VERSIONING_COMPILER_SHARED_OBJECT_MANAGER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+namespace vc {
+
+/** \brief Process-wide table of the open shared objects.
+ *
+ * Shared objects are deduplicated by file (device and inode), and by content
+ * when enabled with setContentDedupe(), so that Versions built from
+ * identical binaries share one mapping. Each handle is reference counted
+ * and closed when its last user releases it. Symbols are resolved on demand
+ * and cached per handle.
+ *
+ * Objects opened with different dlopen flags are never shared, since flags
+ * such as RTLD_DEEPBIND change how the object is bound.
+ */
+class SharedObjectManager {
+public:
+  /** \brief Returns a handle to the shared object bin, opened with flags.
+   *
+   * \param error if not nullptr, receives the reason of a failure.
+   * \return nullptr on failure.
+   */
+  void *acquire(const std::filesystem::path &bin, int flags,
+                std::string *error = nullptr);
+
+  /** \brief Drops a reference to handle. The shared object is closed when
+   * no reference is left.
+   *
+   * \return false if dlclose failed.
+   */
+  bool release(void *handle, std::string *error = nullptr);
+
+  /** \brief Returns the address of symbol in handle. nullptr if not found.
+   */
+  void *resolve(void *handle, const std::string &symbol);
+
+  /** \brief Faults in the pages of the segments of handle, so that the
+   * first calls into it do not wait for the disk or the page tables.
+   *
+   * Writable segments are made private in advance when the kernel supports
+   * it, their content is never modified.
+   *
+   * \return number of bytes prefaulted. Zero if handle is not mapped.
+   */
+  std::size_t prefault(void *handle) const;
+
+  /** \brief Moves the code of handle onto huge pages, to reduce the iTLB
+   * misses when many objects are called.
+   *
+   * Explicit huge pages are used if reserved, transparent ones otherwise.
+   * Only code segments aligned to the huge page size, i.e. linked with
+   * Compiler::getHugePageOptions(), are moved. The code is no longer backed
+   * by the file, so profilers may not attribute it to the object.
+   *
+   * \return false if nothing was moved. The object is left as is.
+   */
+  bool remapHugePages(void *handle);
+
+  /** \brief number of distinct shared objects currently open. */
+  std::size_t size() const;
+
+  /** \brief Shares one handle among the files with identical content.
+   *
+   * Disabled by default: Versions sharing a handle share its global and
+   * static variables too, so they must be enabled only for objects without
+   * state. Applies to the objects opened from now on.
+   */
+  void setContentDedupe(bool enable);
+
+  bool hasContentDedupe() const;
+
+  /** \brief Manager used by the Compilers. */
+  static SharedObjectManager &getDefault();
+
+private:
+  typedef std::tuple<dev_t, ino_t, int> file_key_t;
+
+  typedef std::tuple<uint64_t, off_t, int> content_key_t;
+
+  struct Entry {
+    std::size_t refs = 0;
+    /** \brief the file which was opened. Its inode cannot be reused while it
+     * is mapped, unlike the inodes of files with the same content.
+     */
+    file_key_t file;
+    content_key_t content;
+    /** \brief true if registered in byContent. */
+    bool byContent = false;
+    /** \brief resolved symbols, nullptr for missing ones. */
+    std::unordered_map<std::string, void *> symbols;
+    /** \brief true once the code is on huge pages. */
+    bool hugePages = false;
+  };
+
+  mutable std::mutex mtx;
+
+  std::unordered_map<void *, Entry> entries;
+
+  std::map<file_key_t, void *> byFile;
+
+  std::map<content_key_t, void *> byContent;
+
+  std::atomic<bool> contentDedupe{false};
+
+  /** \brief Takes a reference to an open handle. Lock must be held. */
+  void *share(void *handle);
+};
+
+} // end namespace vc
+
+#endif /* end of include guard:                                             \
+          LIB_VERSIONING_COMPILER_SHARED_OBJECT_MANAGER_HPP */
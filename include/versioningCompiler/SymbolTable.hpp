@@ -0,0 +1,98 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_SYMBOL_TABLE_HPP
+#define LIB_VERSIONING_COMPILER_SYMBOL_TABLE_HPP
+
+#include "versioningCompiler/Version.hpp"
+
+#include <array>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace vc {
+
+/** \brief Typed view of the symbols of a Version.
+ *
+ * Signatures lists the function types of the Version symbols, in the same
+ * order of the function names given to the Version::Builder. Symbols are
+ * accessed by a compile-time index, without any lookup or cast at the call
+ * site:
+ *
+ *     SymbolTable<float(int), int(float)> table(version);
+ *     float y = table.call<0>(3);
+ *
+ * The table copies the symbol addresses: it is valid as long as the Version
+ * is alive and not folded.
+ */
+template <typename... Signatures> class SymbolTable {
+public:
+  /** \brief number of symbols. */
+  static constexpr std::size_t size = sizeof...(Signatures);
+
+  /** \brief function pointer type of the symbol at index I. */
+  template <std::size_t I>
+  using function_t = std::add_pointer_t<
+      std::tuple_element_t<I, std::tuple<Signatures...>>>;
+
+  /** \brief an empty table. */
+  SymbolTable() { symbols.fill(nullptr); }
+
+  /** \brief a table holding the first size symbols of version. */
+  explicit SymbolTable(const Version &version) {
+    symbols.fill(nullptr);
+    const std::vector<void *> loaded = version.getSymbols();
+    for (std::size_t i = 0; i < size && i < loaded.size(); i++) {
+      symbols[i] = loaded[i];
+    }
+  }
+
+  /** \brief true if all the symbols are available. */
+  bool valid() const {
+    for (const auto s : symbols) {
+      if (!s) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /** \brief the symbol at index I. nullptr if not loaded. */
+  template <std::size_t I> function_t<I> get() const {
+    static_assert(I < size, "symbol index out of range");
+    return reinterpret_cast<function_t<I>>(symbols[I]);
+  }
+
+  /** \brief Calls the symbol at index I. */
+  template <std::size_t I, typename... Args>
+  decltype(auto) call(Args &&...args) const {
+    return get<I>()(std::forward<Args>(args)...);
+  }
+
+private:
+  std::array<void *, size> symbols;
+};
+
+} // end namespace vc
+
+#endif /* end of include guard: LIB_VERSIONING_COMPILER_SYMBOL_TABLE_HPP */
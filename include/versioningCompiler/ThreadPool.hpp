@@ -0,0 +1,126 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_THREAD_POOL_HPP
+#define LIB_VERSIONING_COMPILER_THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vc {
+
+/** \brief Bounded pool of worker threads with work stealing.
+ *
+ * Each worker owns a task queue. Tasks submitted by a worker are pushed in
+ * its own queue, tasks submitted by other threads are spread over the queues
+ * in round-robin. An idle worker first consumes its own queue (most recent
+ * task first), then steals the oldest task from the other queues.
+ *
+ * Tasks should not block waiting for other tasks of the same pool.
+ */
+class ThreadPool {
+public:
+  typedef std::function<void()> task_t;
+
+  /** \brief Starts numWorkers threads.
+   *
+   * \param numWorkers number of worker threads. Zero means one worker per
+   * hardware thread.
+   */
+  explicit ThreadPool(std::size_t numWorkers = 0);
+
+  /** \brief Completes all the queued tasks and joins the workers. */
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /** \brief Enqueues a task. Never blocks on task execution. */
+  void submit(task_t task);
+
+  /** \brief Enqueues a callable and returns a handle to its result.
+   *
+   * Exceptions thrown by the callable are rethrown by the handle get().
+   */
+  template <typename F>
+  auto async(F &&f) -> std::shared_future<decltype(f())> {
+    typedef decltype(f()) result_t;
+    auto task = std::make_shared<std::packaged_task<result_t()>>(
+        std::forward<F>(f));
+    std::shared_future<result_t> result = task->get_future().share();
+    submit([task]() { (*task)(); });
+    return result;
+  }
+
+  /** \brief number of worker threads. */
+  std::size_t size() const;
+
+  /** \brief number of tasks queued and not yet started. */
+  std::size_t pendingTasks() const;
+
+  /** \brief Pool owned by the library and used by the asynchronous
+   * compilation API.
+   *
+   * It is started on first use with one worker per hardware thread.
+   */
+  static ThreadPool &getDefault();
+
+private:
+  /** \brief task queue owned by a worker. */
+  struct WorkQueue {
+    std::mutex mtx;
+    std::deque<task_t> tasks;
+  };
+
+  std::vector<std::unique_ptr<WorkQueue>> queues;
+
+  std::vector<std::thread> workers;
+
+  /** \brief protects the sleep/wake-up protocol of idle workers. */
+  std::mutex sleep_mtx;
+
+  std::condition_variable wakeup;
+
+  /** \brief number of queued tasks. */
+  std::atomic<std::size_t> pending;
+
+  /** \brief round-robin counter for tasks submitted from outside. */
+  std::atomic<std::size_t> next_queue;
+
+  bool stopping;
+
+  /** \brief Pops a task from the owned queue or steals one from the others.
+   */
+  bool tryPop(std::size_t index, task_t &task);
+
+  void workerLoop(std::size_t index);
+};
+
+} // end namespace vc
+
+#endif /* end of include guard: LIB_VERSIONING_COMPILER_THREAD_POOL_HPP */
@@ -23,10 +23,17 @@
 
 #include "versioningCompiler/Compiler.hpp"
 #include "versioningCompiler/Option.hpp"
+#include "versioningCompiler/VersionRegistry.hpp"
 
+#include <atomic>
+#include <cstddef>
+#include <dlfcn.h>
 #include <filesystem>
+#include <functional>
+#include <future>
 #include <list>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <uuid/uuid.h>
@@ -50,15 +57,15 @@ namespace vc {
  *
  * A Version object can be configured only through a Version::Builder.
  */
-class Version {
+class Version : public std::enable_shared_from_this<Version> {
 public:
   class Builder;
 
   /** \brief String representation of the Version unique identifier. */
-  std::string getID() const;
+  const std::string &getID() const;
 
   /** \brief User defined string description of the Version. */
-  std::vector<std::string> getTags() const;
+  const std::vector<std::string> &getTags() const;
 
   /** \brief Return true if an IR representation of this Version is available.
    * False otherwise.
@@ -70,6 +77,16 @@ public:
    */
   bool hasOptimizedIR() const;
 
+  /** \brief Return true if the IR of this Version is held in memory by the
+   * compiler, see ClangLibCompiler::enableInMemoryPipeline.
+   *
+   * getFileName_IR() and getFileName_IR_opt() then identify the in-memory
+   * module, but no such file exists on disk. The module is released once the
+   * binary is generated. In-memory IR is neither cached nor saved in
+   * manifests.
+   */
+  bool hasInMemoryIR() const;
+
   /** \brief Return true if the binary code of this Version is available.
    * False otherwise.
    */
@@ -81,6 +98,11 @@ public:
    */
   bool hasLoadedSymbol() const;
 
+  /** \brief Return true if the code of the loaded shared object has been
+   * moved onto huge pages. See Builder::setHugePages().
+   */
+  bool hasHugePages() const;
+
   /** \brief Return the first symbol, if was correctly loaded.
    * nullptr otherwise.
    *
@@ -99,8 +121,8 @@ public:
    */
   void *getSymbol(const int index) const;
 
-  /** \brief Return symbols, if were correctly loaded.
-   * empty vector otherwise.
+  /** \brief Return a copy of the symbols, if were correctly loaded.
+   * empty vector otherwise. Symbols not resolved yet are resolved first.
    *
    * Please note that these symbol will stay valid only as long as the Version
    * object is still alive.
@@ -108,6 +130,11 @@ public:
    */
   std::vector<void *> getSymbols() const;
 
+  /** \brief Return the number of symbols, if were correctly loaded. 0
+   * otherwise.
+   */
+  std::size_t getSymbolCount() const;
+
   /** \brief Return symbol corresponding to functionName, if was correctly
    * loaded. nullptr otherwise.
    *
@@ -117,10 +144,30 @@ public:
    */
   void *getSymbol(const std::string &functionName) const;
 
+  /** \brief Return the symbol at index cast to the function pointer type
+   * FnT, if was correctly loaded. nullptr otherwise.
+   *
+   * Same validity rules of getSymbol(index).
+   */
+  template <typename FnT> FnT getSymbol(std::size_t index = 0) const {
+    if (index >= symbol.size()) {
+      return nullptr;
+    }
+    return reinterpret_cast<FnT>(resolveSymbol(index));
+  }
+
+  /** \brief Return the index of the symbol corresponding to functionName.
+   * -1 if functionName is not a symbol of this Version.
+   *
+   * Resolve the index once and use getSymbol(index) on hot paths: it does not
+   * hash the name.
+   */
+  int getSymbolIndex(const std::string &functionName) const;
+
   /** \brief Closes the shared object to save memory resources.
    *
    * After folding a Version it is not possible to access its symbol before
-   * reloading it.
+   * reloading it. Versions installed in a Dispatcher must not be folded.
    */
   void fold();
 
@@ -134,6 +181,8 @@ public:
   /** \brief Generate the LLVM-IR code of the function.
    *
    * The compiler is invoked only if a LLVM-IR file is not yet available.
+   * Concurrent callers wait for the same in-flight generation and share its
+   * result.
    *
    * \return true if a LLVM-IR file was made available. False elsewhere.
    */
@@ -142,51 +191,79 @@ public:
   /** \brief Generate the binary code of the function and load it.
    *
    * The compiler is invoked only if a binary file is not yet available.
+   * Concurrent callers wait for the same in-flight compilation and share its
+   * result.
    *
    * \return true if a symbol was made available. False elsewhere.
    */
   bool compile();
 
+  /** \brief Asynchronous version of prepareIR().
+   *
+   * The work is enqueued in the library thread pool and this method returns
+   * immediately. The Version object is kept alive until the work completes.
+   *
+   * \return handle to the prepareIR() result.
+   */
+  std::shared_future<bool> prepareIRAsync();
+
+  /** \brief Asynchronous version of compile().
+   *
+   * The work is enqueued in the library thread pool and this method returns
+   * immediately. The Version object is kept alive until the work completes.
+   *
+   * \return handle to the compile() result.
+   */
+  std::shared_future<bool> compileAsync();
+
   /** \brief ordered list of options used to build this version. */
-  const opt_list_t getOptionList() const;
+  const opt_list_t &getOptionList() const;
 
   /** \brief ordered list of options used to generate the IR for this version.
    */
-  const opt_list_t getGenIRoptionList() const;
+  const opt_list_t &getGenIRoptionList() const;
 
   /** \brief ordered list of options used to run the optimizer on this version.
    */
-  const opt_list_t getOptOptionList() const;
+  const opt_list_t &getOptOptionList() const;
 
   /** \brief Compiler used to compile this Version. */
   std::string getCompilerId() const;
 
   /** \brief name of the versioned function. */
-  std::string getFunctionName() const;
+  const std::string &getFunctionName() const;
 
   /** \brief name of the versioned function at index. */
-  std::string getFunctionName(int index) const;
+  const std::string &getFunctionName(int index) const;
 
   /** \brief names of the versioned functions. */
-  std::vector<std::string> getFunctionNames() const;
+  const std::vector<std::string> &getFunctionNames() const;
 
   /** \brief file name where the source code, if available, is stored. */
-  std::filesystem::path getFileName_src() const;
+  const std::filesystem::path &getFileName_src() const;
 
   /** \brief file name where the source code, if available, is stored. */
-  std::filesystem::path getFileName_src(const int index) const;
+  const std::filesystem::path &getFileName_src(const int index) const;
 
   /** \brief file name where the source code, if available, is stored. */
-  std::vector<std::filesystem::path> getFileNames_src() const;
+  const std::vector<std::filesystem::path> &getFileNames_src() const;
 
-  /** \brief file name where the IR, if available, is stored. */
-  std::filesystem::path getFileName_IR() const;
+  /** \brief file name where the IR, if available, is stored. It does not
+   * exist on disk if hasInMemoryIR().
+   */
+  const std::filesystem::path &getFileName_IR() const;
 
-  /** \brief file name where the optimized IR, if available, is stored. */
-  std::filesystem::path getFileName_IR_opt() const;
+  /** \brief file name where the optimized IR, if available, is stored. It
+   * does not exist on disk if hasInMemoryIR().
+   */
+  const std::filesystem::path &getFileName_IR_opt() const;
 
-  /** \brief file name where the binary, if available, is stored. */
-  std::filesystem::path getFileName_bin() const;
+  /** \brief file name where the binary, if available, is stored.
+   *
+   * In diskless mode it is the /proc path of an anonymous memory file, which
+   * is valid only as long as the Version object is alive.
+   */
+  const std::filesystem::path &getFileName_bin() const;
 
   inline bool operator==(const Version &other) {
     return getID() == other.getID();
@@ -196,7 +273,9 @@ public:
     return getID() < other.getID();
   }
 
-  /** default destructor*/
+  /** \brief Unloads the shared object and removes the files of this
+   * Version, if enabled, in the background. See Reclaimer.
+   */
   ~Version();
 
 private:
@@ -208,31 +287,46 @@ private:
   /** \brief unique identifier. */
   std::string id;
 
+  /* The configuration is immutable: each component is shared with the
+   * Versions built by the same Builder, as long as it is unchanged.
+   */
+
   /** \brief User-defined description. */
-  std::vector<std::string> tags;
+  std::shared_ptr<const std::vector<std::string>> tags;
 
   /** \brief Remove files when the object is deallocated. */
   bool autoremoveFilesEnable;
 
   /** \brief ordered list of options used to build this version. */
-  opt_list_t optionList;
+  std::shared_ptr<const opt_list_t> optionList;
+
+  /** \brief optionList without the huge page and fast-load link options,
+   * which the Builder adds from its flags.
+   */
+  std::shared_ptr<const opt_list_t> baseOptionList;
 
   /** \brief ordered list of options used to generate the IR for this version.
    */
-  opt_list_t genIRoptionList;
+  std::shared_ptr<const opt_list_t> genIRoptionList;
 
   /** \brief ordered list of options used to run the optimizer on this version.
    */
-  opt_list_t optOptionList;
+  std::shared_ptr<const opt_list_t> optOptionList;
 
   /** \brief Compiler used to compile this Version. */
   compiler_ptr_t compiler;
 
   /** \brief name of the versioned function. */
-  std::vector<std::string> functionName;
+  std::shared_ptr<const std::vector<std::string>> functionName;
+
+  /** \brief index of each name in functionName. */
+  std::shared_ptr<const std::unordered_map<std::string, int>> mapFnToIndex;
 
   /** \brief file name where the source code, if available, is stored. */
-  std::vector<std::filesystem::path> fileName_src;
+  std::shared_ptr<const std::vector<std::filesystem::path>> fileName_src;
+
+  /** \brief in-memory sources, referenced by name in fileName_src. */
+  std::shared_ptr<const source_buffer_map_t> sourceBuffers;
 
   /** \brief file name where the IR, if available, is stored. */
   std::filesystem::path fileName_IR;
@@ -240,26 +334,155 @@ private:
   /** \brief file name where the optimized IR, if available, is stored. */
   std::filesystem::path fileName_IR_opt;
 
+  /** \brief the IR files are not written: the compiler holds the IR. */
+  bool inMemoryIR;
+
   /** \brief file name where the binary, if available, is stored. */
   std::filesystem::path fileName_bin;
 
-  /** \brief Loaded symbol, if available. */
-  std::vector<void *> symbol;
-
-  std::unordered_map<std::string, int> mapFnToIndex;
+  /** \brief Loaded symbol, if available. Entries of a lazily loaded shared
+   * object are nullptr until first requested, and are then written
+   * atomically.
+   */
+  mutable std::vector<void *> symbol;
 
   void *lib_handle;
 
-  bool removeFile(const std::filesystem::path &fileName);
+  /** \brief dlopen flags of the shared object. */
+  int loadFlags;
+
+  /** \brief prefault and bind the shared object once loaded. */
+  bool warmUp;
+
+  /** \brief user warm-up, run after the shared object is warm. */
+  std::function<void(const Version &)> warmUpCallback;
+
+  /** \brief move the code onto huge pages once loaded. */
+  bool hugePages;
+
+  /** \brief the code of the loaded shared object is on huge pages. */
+  bool hugePagesMapped;
+
+  /** \brief link the shared object with the fast-load profile. */
+  bool fastLoad;
+
+  /** \brief true if symbols are resolved on first request. */
+  bool lazySymbols;
+
+  /** \brief anonymous memory file holding the shared object. -1 if the
+   * shared object is a regular file.
+   */
+  int binaryFd;
+
+  /** \brief serializes the compilation stages of this Version. */
+  std::mutex stageMtx;
+
+  /** \brief protects the in-flight handles. */
+  std::mutex inFlightMtx;
+
+  /** \brief result of the running prepareIR, if any. */
+  std::shared_future<bool> inFlightIR;
+
+  /** \brief result of the running compile, if any. */
+  std::shared_future<bool> inFlightCompile;
+
+  /** \brief Runs stage unless isDone, or joins the same stage if already
+   * running in another thread.
+   */
+  bool runOnce(std::shared_future<bool> &inFlight,
+               const std::function<bool()> &isDone,
+               const std::function<bool()> &stage);
+
+  /** \brief Claims the in-flight slot of a stage.
+   *
+   * \param result the future of the stage, whoever runs it.
+   * \return true if the caller must run the stage and fulfil promise.
+   */
+  bool claimStage(std::shared_future<bool> &inFlight,
+                  std::promise<bool> &promise,
+                  std::shared_future<bool> &result);
+
+  /** \brief Frees the in-flight slot of a stage once it is over. */
+  void releaseStage(std::shared_future<bool> &inFlight);
+
+  /** \brief prepareIR() body. */
+  bool runPrepareIR();
+
+  /** \brief compile() body. */
+  bool runCompile();
+
+  /** \brief Generates the IR, if not yet available.
+   * Returns false if the compiler has no IR support.
+   */
+  bool generateIRStage();
+
+  /** \brief Runs the optimizer on the IR, if the compiler has one and the
+   * optimized IR is not yet available.
+   */
+  bool optimizeStage();
+
+  /** \brief Generates the binary from the most refined available input, if
+   * not yet available.
+   */
+  bool generateBinStage();
+
+  /** \brief Loads the symbols from the binary, and warms them up if
+   * requested.
+   */
+  bool loadStage();
+
+  /** \brief Prefaults the shared object, resolves all the symbols and runs
+   * the user warm-up.
+   */
+  void warmUpStage();
+
+  friend class CompileScheduler;
+  friend class VersionRegistry;
 
   /** \brief Loads function pointer symbol from the shared object.
    * Shared object must already exists.
    */
   void loadSymbol();
+
+  /** \brief Returns the symbol at index, resolving it if needed.
+   * index must be valid.
+   */
+  void *resolveSymbol(std::size_t index) const;
+
+  /** \brief Computes the artifact cache key of a compilation stage.
+   *
+   * The key depends on the stage, on the compiler, on the ordered option list
+   * and on the content of the input files.
+   * Returns an empty string if an input file cannot be read.
+   */
+  std::string getCacheKey(const std::string &stage,
+                          const std::vector<std::filesystem::path> &input,
+                          const opt_list_t &options) const;
+
+  /** \brief Runs a compilation stage through the compiler artifact cache.
+   *
+   * On cache hit the artifact is restored in place of the compiler output and
+   * generate is not invoked. Falls back to generate when the cache is
+   * disabled.
+   */
+  std::filesystem::path
+  runCachedStage(const std::string &stage,
+                 const std::vector<std::filesystem::path> &input,
+                 const opt_list_t &options,
+                 const std::filesystem::path &artifact,
+                 const std::function<std::filesystem::path()> &generate);
 };
 
 typedef std::shared_ptr<Version> version_ptr_t;
 
+/** \brief Compiles a batch of Versions in the library compile scheduler.
+ *
+ * Returns immediately. Handles are in the same order of versions.
+ * See CompileScheduler to also pipeline IR generation and optimization.
+ */
+std::vector<std::shared_future<bool>>
+submit(const std::vector<version_ptr_t> &versions);
+
 /** \brief Version::Builder is used to configure a new version object.
  *
  * Once configuration is done, builder can finalize a Version object through
@@ -290,7 +513,8 @@ public:
                                     const std::string &functionName,
                                     const compiler_ptr_t &compiler,
                                     const bool autoremoveFilesEnable = true,
-                                    const std::vector<std::string> &tag = {});
+                                    const std::vector<std::string> &tag = {},
+                                    int loadFlags = RTLD_NOW | RTLD_LOCAL);
 
   /** \brief construct a Version using an already existing shared object. */
   static version_ptr_t
@@ -298,11 +522,29 @@ public:
                const std::vector<std::string> &functionNames,
                const compiler_ptr_t &compiler,
                const bool autoremoveFilesEnable = true,
-               const std::vector<std::string> &tag = {});
+               const std::vector<std::string> &tag = {},
+               int loadFlags = RTLD_NOW | RTLD_LOCAL);
 
-  /** \brief actually create an immutable object Version. */
+  /** \brief actually create an immutable object Version.
+   *
+   * If a registry is set and it holds a live Version with the same
+   * configuration, that Version is returned instead of a new one.
+   * Tags are not part of the configuration.
+   */
   version_ptr_t build();
 
+  /** \brief set the registry used to deduplicate identical Versions.
+   * nullptr disables deduplication.
+   */
+  void setRegistry(const std::shared_ptr<VersionRegistry> &registry) {
+    _registry = registry;
+  }
+
+  /** \brief Returns a key which identifies the configuration of the Version
+   * to be built. Source files are identified by their content.
+   */
+  std::string getConfigurationKey() const;
+
   /** \brief Reset builder to its default values. */
   void reset();
 
@@ -310,6 +552,15 @@ public:
    */
   void addSourceFile(const std::filesystem::path &src);
 
+  /** \brief Add a source file whose content is kept in memory.
+   *
+   * name is not required to exist on disk, but its extension selects the
+   * source language. Relative includes are resolved against the current
+   * working directory.
+   */
+  void addSourceBuffer(const std::filesystem::path &name,
+                       const std::string &contents);
+
   /** \brief Add a symbol name to be obtained from the compiled code. Returns
    * the symbol index.
    */
@@ -360,6 +611,43 @@ public:
   /** \brief set the compiler for this builder.
    */
   void setCompiler(const compiler_ptr_t &c) { _compiler = c; }
+
+  /** \brief Sets the dlopen flags of the shared object. Shared objects are
+   * shared with other Versions only if they are loaded with the same flags.
+   */
+  void setLoadFlags(int flags) { _loadFlags = flags; }
+
+  /** \brief Backs the code of the Version with huge pages, to reduce the
+   * iTLB misses of hot Versions.
+   *
+   * The shared object is linked with the huge page alignment of the
+   * compiler, and its code is moved onto huge pages once loaded. The
+   * Version works as usual when huge pages are not available: see
+   * Version::hasHugePages() and SharedObjectManager::remapHugePages().
+   */
+  void setHugePages(bool enable) { _hugePages = enable; }
+
+  /** \brief Links the shared object with the fast-load profile of the
+   * compiler, to reduce the cost of loading it and of calling into it.
+   *
+   * References within the shared object are bound to its own definitions,
+   * hence they cannot be interposed, and the shared object is fully bound
+   * at load even with RTLD_LAZY. See Compiler::getFastLoadOptions().
+   */
+  void setFastLoad(bool enable) { _fastLoad = enable; }
+
+  /** \brief Warms up the Version once loaded, before compile() returns.
+   *
+   * The pages of the shared object are faulted in and all the symbols are
+   * resolved, then callback, if any, is run. The callback can call the
+   * symbols to warm up caches and branch predictors. Binding of the shared
+   * object itself follows the load flags: RTLD_NOW binds it at load.
+   */
+  void setWarmUp(bool enable,
+                 std::function<void(const Version &)> callback = nullptr) {
+    _warmUp = enable;
+    _warmUpCallback = std::move(callback);
+  }
   /** \brief Insert a define in the compilation stages to enable the
    * compilation of the given functions.
    */
@@ -381,7 +669,24 @@ public:
   std::vector<std::string> _tags;
 
   /** \brief Remove compiled files from disk when Version object is freed. */
-  bool _autoremoveFilesEnable;
+  bool _autoremoveFilesEnable = true;
+
+  /** \brief dlopen flags of the shared object: RTLD_LAZY or RTLD_NOW,
+   * possibly combined with RTLD_LOCAL, RTLD_GLOBAL or RTLD_DEEPBIND.
+   */
+  int _loadFlags = RTLD_NOW | RTLD_LOCAL;
+
+  /** \brief Warm up the Version once loaded. See setWarmUp(). */
+  bool _warmUp = false;
+
+  /** \brief user warm-up of the Version. See setWarmUp(). */
+  std::function<void(const Version &)> _warmUpCallback;
+
+  /** \brief Back the code with huge pages. See setHugePages(). */
+  bool _hugePages = false;
+
+  /** \brief Link with the fast-load profile. See setFastLoad(). */
+  bool _fastLoad = false;
 
   /** \brief Compiler to be used to compile this Version. */
   compiler_ptr_t _compiler;
@@ -395,6 +700,9 @@ public:
   /** \brief file name where the source code, if available, is stored. */
   std::vector<std::filesystem::path> _fileName_src;
 
+  /** \brief in-memory sources, referenced by name in _fileName_src. */
+  source_buffer_map_t _sourceBuffers;
+
   /** \brief file name where the IR, if available, is stored. */
   std::filesystem::path _fileName_IR;
 
@@ -408,10 +716,32 @@ public:
    * this version. */
   opt_list_t _optOptionList;
 
+  /** \brief registry used to deduplicate identical Versions. */
+  std::shared_ptr<VersionRegistry> _registry;
+
 private:
   /** \brief shared pointer to the object to be built. */
   version_ptr_t _version_ptr;
 
+  /** \brief creates a new Version, bypassing the registry.
+   *
+   * Configuration components equal to the ones of the previous Version are
+   * shared with it.
+   */
+  version_ptr_t buildNew();
+
+  /** \brief Computes the option lists of the Version to be built, i.e.
+   * with the defines, the huge page and the fast-load options.
+   *
+   * \param linkOptions set to the number of huge page and fast-load options
+   * appended to optionList.
+   * \return false if they are the same of the Builder, and the lists are
+   * left empty.
+   */
+  bool getEffectiveOptions(opt_list_t &optionList,
+                           opt_list_t &genIROptionList,
+                           std::size_t &linkOptions) const;
+
   /** \brief Returns a flag to be enabled in order to compile the given
    * function.
    *
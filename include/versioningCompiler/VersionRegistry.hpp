@@ -0,0 +1,114 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_VERSION_REGISTRY_HPP
+#define LIB_VERSIONING_COMPILER_VERSION_REGISTRY_HPP
+
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace vc {
+
+class Compiler;
+class Version;
+
+/** \brief Interning table of Versions, indexed by configuration.
+ *
+ * A Version::Builder attached to a registry returns the already existing
+ * Version when it is asked to build a configuration which is still alive.
+ * Hence identical requests share the same compilation and the same shared
+ * object. The registry does not keep Versions alive.
+ */
+class VersionRegistry {
+public:
+  /** \brief Returns the live Version stored under key, if any. Otherwise it
+   * stores and returns the Version returned by create.
+   */
+  std::shared_ptr<Version>
+  getOrCreate(const std::string &key,
+              const std::function<std::shared_ptr<Version>()> &create);
+
+  /** \brief Returns the live Version stored under key. nullptr if none. */
+  std::shared_ptr<Version> find(const std::string &key) const;
+
+  /** \brief number of live Versions. */
+  std::size_t size() const;
+
+  /** \brief Writes the manifest of the live Versions into directory.
+   *
+   * See saveManifest(directory, versions).
+   */
+  bool saveManifest(const std::filesystem::path &directory) const;
+
+  /** \brief Writes the manifest of versions into directory.
+   *
+   * The manifest records the configuration of each Version: identifier,
+   * tags, function names, the three option lists, the load, warm-up, huge
+   * page and fast-load settings, the compiler identifier and its artifacts.
+   * Warm-up callbacks are not recorded. Artifacts and in-memory sources are
+   * copied into directory under the name of their content hash, so the
+   * manifest stays valid when the Versions remove their files. A previous
+   * manifest in directory is replaced. Versions must not be compiling.
+   *
+   * \return false if the manifest cannot be written.
+   */
+  static bool
+  saveManifest(const std::filesystem::path &directory,
+               const std::vector<std::shared_ptr<Version>> &versions);
+
+  /** \brief Rebuilds the Versions of the manifest in directory and stores
+   * them in this registry.
+   *
+   * Each Version is bound to the compiler with its compiler identifier, and
+   * its artifacts are restored only if their content hash matches. Versions
+   * whose compiler is missing or whose artifacts are corrupted are skipped.
+   * Restored Versions get a new identifier, as they must not clash with the
+   * working files of the process which saved them. If a Version with the
+   * same configuration is alive, that one is returned instead.
+   *
+   * \param preload loads the restored binaries in background.
+   * \return the restored Versions, in manifest order.
+   */
+  std::vector<std::shared_ptr<Version>>
+  loadManifest(const std::filesystem::path &directory,
+               const std::vector<std::shared_ptr<Compiler>> &compilers,
+               bool preload = true);
+
+private:
+  mutable std::mutex mtx;
+
+  std::unordered_map<std::string, std::weak_ptr<Version>> versions;
+
+  /** \brief size of the table after the last removal of expired entries. */
+  std::size_t lastPurgeSize = 0;
+
+  /** \brief Removes the entries of destroyed Versions. Lock must be held. */
+  void purge();
+};
+
+} // end namespace vc
+
+#endif /* end of include guard: LIB_VERSIONING_COMPILER_VERSION_REGISTRY_HPP */
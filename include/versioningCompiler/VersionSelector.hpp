@@ -0,0 +1,278 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef LIB_VERSIONING_COMPILER_VERSION_SELECTOR_HPP
+#define LIB_VERSIONING_COMPILER_VERSION_SELECTOR_HPP
+
+#include "versioningCompiler/Epoch.hpp"
+#include "versioningCompiler/Version.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace vc {
+
+template <typename Signature> class VersionSelector;
+
+/** \brief Calls, among several Versions of the same function, the one which
+ * performs best on the current input.
+ *
+ * A user-provided feature function maps the call arguments to a feature
+ * class, e.g. a size class or a runtime flag. The model is a branch table
+ * with the candidate to be called for each class. It is trained from the
+ * execution times measured through measure(), or recorded with record().
+ *
+ * Calls never take a lock: the branch table is immutable once published
+ * and replaced models are reclaimed as Dispatcher slots are.
+ * Until trained, every class calls the first candidate.
+ *
+ * Candidates must not be folded while installed in a selector.
+ */
+template <typename Ret, typename... Args> class VersionSelector<Ret(Args...)> {
+public:
+  typedef Ret (*function_t)(Args...);
+
+  /** \brief maps the call arguments to a feature class. */
+  typedef std::function<std::size_t(const Args &...)> feature_t;
+
+  /** \brief Selector over numClasses feature classes. Feature classes beyond
+   * the last one are clamped to the last one.
+   */
+  VersionSelector(feature_t feature, std::size_t numClasses)
+      : feature(std::move(feature)),
+        numClasses(numClasses > 0 ? numClasses : 1), current(nullptr) {}
+
+  /** \brief Retires the current model. */
+  ~VersionSelector() { retire(current.exchange(nullptr)); }
+
+  VersionSelector(const VersionSelector &) = delete;
+  VersionSelector &operator=(const VersionSelector &) = delete;
+
+  /** \brief Adds the symbol at index of version as a candidate.
+   *
+   * \return the candidate index. -1 if version has no such loaded symbol.
+   */
+  int addVersion(const version_ptr_t &version, std::size_t index = 0) {
+    if (!version || index >= version->getSymbolCount()) {
+      return -1;
+    }
+    const function_t entry = version->getSymbol<function_t>(index);
+    if (!entry) {
+      return -1;
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    candidates.push_back(version);
+    entries.push_back(entry);
+    stats.resize(numClasses * entries.size());
+    if (decision.empty()) {
+      decision.assign(numClasses, 0);
+    }
+    publish();
+    return (int)entries.size() - 1;
+  }
+
+  /** \brief Calls the candidate selected for the arguments. At least one
+   * candidate must have been added.
+   */
+  Ret operator()(Args... args) const {
+    Epoch::Guard guard;
+    const Model *model = current.load();
+    return model->table[classOf(args...)](std::forward<Args>(args)...);
+  }
+
+  /** \brief Calls the least measured candidate of the feature class of the
+   * arguments and records its execution time.
+   */
+  Ret measure(Args... args) {
+    const std::size_t c = classOf(args...);
+    std::size_t candidate = 0;
+    function_t entry = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      for (std::size_t i = 1; i < entries.size(); i++) {
+        if (stat(c, i).samples < stat(c, candidate).samples) {
+          candidate = i;
+        }
+      }
+      // candidates are never removed: entry stays valid
+      entry = entries.at(candidate);
+    }
+    const auto start = std::chrono::steady_clock::now();
+    struct Recorder {
+      VersionSelector *selector;
+      std::size_t c;
+      std::size_t candidate;
+      std::chrono::steady_clock::time_point start;
+      ~Recorder() {
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        selector->record(c, candidate, elapsed.count());
+      }
+    } recorder{this, c, candidate, start};
+    return entry(std::forward<Args>(args)...);
+  }
+
+  /** \brief Records an execution time, in seconds, of a candidate on an input
+   * of the given feature class.
+   */
+  void record(std::size_t featureClass, std::size_t candidate,
+              double seconds) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (featureClass >= numClasses || candidate >= entries.size()) {
+      return;
+    }
+    Stat &s = stat(featureClass, candidate);
+    s.samples++;
+    s.seconds += seconds;
+    return;
+  }
+
+  /** \brief Builds and publishes the branch table.
+   *
+   * Each feature class selects the candidate with the lowest mean execution
+   * time. Classes without measurements take the decision of the closest
+   * measured class.
+   *
+   * \return false if nothing was measured yet.
+   */
+  bool train() {
+    std::lock_guard<std::mutex> lock(mtx);
+    std::vector<int> best(numClasses, -1);
+    for (std::size_t c = 0; c < numClasses; c++) {
+      double best_mean = std::numeric_limits<double>::max();
+      for (std::size_t i = 0; i < entries.size(); i++) {
+        const Stat &s = stat(c, i);
+        if (s.samples > 0 && s.seconds / s.samples < best_mean) {
+          best_mean = s.seconds / s.samples;
+          best[c] = (int)i;
+        }
+      }
+    }
+    bool trained = false;
+    std::vector<int> filled = best;
+    for (std::size_t c = 0; c < numClasses; c++) {
+      for (std::size_t d = 1; d < numClasses && filled[c] < 0; d++) {
+        if (c >= d && best[c - d] >= 0) {
+          filled[c] = best[c - d];
+        } else if (c + d < numClasses && best[c + d] >= 0) {
+          filled[c] = best[c + d];
+        }
+      }
+      trained = trained || filled[c] >= 0;
+    }
+    if (!trained) {
+      return false;
+    }
+    for (std::size_t c = 0; c < numClasses; c++) {
+      decision[c] = (std::size_t)filled[c];
+    }
+    publish();
+    return true;
+  }
+
+  /** \brief index of the candidate called for the given feature class. */
+  std::size_t getDecision(std::size_t featureClass) const {
+    Epoch::Guard guard;
+    const Model *model = current.load();
+    if (!model) {
+      return 0;
+    }
+    return model->decision[clamp(featureClass)];
+  }
+
+  /** \brief number of candidates. */
+  std::size_t size() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return entries.size();
+  }
+
+private:
+  /** \brief measurements of a candidate on a feature class. */
+  struct Stat {
+    std::size_t samples = 0;
+    double seconds = 0;
+  };
+
+  /** \brief a published branch table. Immutable. */
+  struct Model {
+    std::vector<function_t> table;
+    std::vector<std::size_t> decision;
+    std::vector<version_ptr_t> versions;
+  };
+
+  const feature_t feature;
+
+  const std::size_t numClasses;
+
+  std::atomic<Model *> current;
+
+  /** \brief protects the candidates, the measurements and the decisions. */
+  mutable std::mutex mtx;
+
+  std::vector<version_ptr_t> candidates;
+
+  std::vector<function_t> entries;
+
+  /** \brief measurements, by candidate and feature class. */
+  std::vector<Stat> stats;
+
+  /** \brief candidate index, by feature class. */
+  std::vector<std::size_t> decision;
+
+  std::size_t clamp(std::size_t featureClass) const {
+    return featureClass < numClasses ? featureClass : numClasses - 1;
+  }
+
+  std::size_t classOf(const Args &...args) const {
+    return clamp(feature(args...));
+  }
+
+  Stat &stat(std::size_t featureClass, std::size_t candidate) {
+    return stats[candidate * numClasses + featureClass];
+  }
+
+  /** \brief Publishes the current decisions. Called with mtx held. */
+  void publish() {
+    Model *model = new Model();
+    model->decision = decision;
+    model->versions = candidates;
+    for (const auto d : decision) {
+      model->table.push_back(entries[d]);
+    }
+    retire(current.exchange(model));
+    return;
+  }
+
+  static void retire(Model *model) {
+    if (model) {
+      Epoch::retire([model]() { delete model; });
+    }
+  }
+};
+
+} // end namespace vc
+
+#endif /* end of include guard: LIB_VERSIONING_COMPILER_VERSION_SELECTOR_HPP */
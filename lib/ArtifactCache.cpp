@@ -0,0 +1,160 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "versioningCompiler/ArtifactCache.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace vc;
+
+// ----------------------------------------------------------------------------
+// --------------------------- detailed constructor ---------------------------
+// ----------------------------------------------------------------------------
+ArtifactCache::ArtifactCache(const std::filesystem::path &cacheDir,
+                             std::chrono::seconds failureTTL)
+    : directory(cacheDir), failureTimeToLive(failureTTL) {
+  std::error_code ec;
+  std::filesystem::create_directories(directory, ec);
+}
+
+// ----------------------------------------------------------------------------
+// --------------------------- get cache directory ----------------------------
+// ----------------------------------------------------------------------------
+std::filesystem::path ArtifactCache::getDirectory() const { return directory; }
+
+// ----------------------------------------------------------------------------
+// ----------------------------- lookup artifact ------------------------------
+// ----------------------------------------------------------------------------
+bool ArtifactCache::lookup(const std::string &key,
+                           const std::string &extension,
+                           const std::filesystem::path &destination) const {
+  const std::filesystem::path entry = getEntryFileName(key, extension);
+  std::error_code ec;
+  if (!std::filesystem::exists(entry, ec)) {
+    return false;
+  }
+  // entries are never modified after publication, a plain copy is safe
+  std::filesystem::copy_file(entry, destination,
+                             std::filesystem::copy_options::overwrite_existing,
+                             ec);
+  return !ec;
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------------- publish artifact -----------------------------
+// ----------------------------------------------------------------------------
+bool ArtifactCache::publish(const std::string &key,
+                            const std::string &extension,
+                            const std::filesystem::path &artifact) const {
+  const std::filesystem::path entry = getEntryFileName(key, extension);
+  std::error_code ec;
+  if (std::filesystem::exists(entry, ec)) {
+    return true;
+  }
+  if (artifact.empty() || !std::filesystem::exists(artifact, ec)) {
+    return false;
+  }
+  // copy to a private temporary file, then atomically move it in place
+  const std::filesystem::path tmp = getTemporaryFileName(key);
+  std::filesystem::copy_file(artifact, tmp,
+                             std::filesystem::copy_options::overwrite_existing,
+                             ec);
+  if (ec) {
+    std::filesystem::remove(tmp, ec);
+    return false;
+  }
+  std::filesystem::rename(tmp, entry, ec);
+  if (ec) {
+    std::filesystem::remove(tmp, ec);
+    return false;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// --------------------------- check failure record ---------------------------
+// ----------------------------------------------------------------------------
+bool ArtifactCache::isKnownFailure(const std::string &key) const {
+  const std::filesystem::path marker = getEntryFileName(key, ".fail");
+  struct stat buffer;
+  if (stat(marker.c_str(), &buffer) != 0) {
+    return false;
+  }
+  const auto age = std::chrono::system_clock::now() -
+                   std::chrono::system_clock::from_time_t(buffer.st_mtime);
+  if (age < failureTimeToLive) {
+    return true;
+  }
+  clearFailure(key);
+  return false;
+}
+
+// ----------------------------------------------------------------------------
+// -------------------------- record failed attempt ---------------------------
+// ----------------------------------------------------------------------------
+void ArtifactCache::recordFailure(const std::string &key) const {
+  const std::filesystem::path tmp = getTemporaryFileName(key);
+  std::ofstream marker(tmp, std::ofstream::trunc);
+  if (!marker.is_open()) {
+    return;
+  }
+  marker << key << std::endl;
+  marker.close();
+  std::error_code ec;
+  std::filesystem::rename(tmp, getEntryFileName(key, ".fail"), ec);
+  if (ec) {
+    std::filesystem::remove(tmp, ec);
+  }
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// -------------------------- forget failed attempt ---------------------------
+// ----------------------------------------------------------------------------
+void ArtifactCache::clearFailure(const std::string &key) const {
+  std::error_code ec;
+  std::filesystem::remove(getEntryFileName(key, ".fail"), ec);
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------- compose entry file name --------------------------
+// ----------------------------------------------------------------------------
+std::filesystem::path
+ArtifactCache::getEntryFileName(const std::string &key,
+                                const std::string &extension) const {
+  return directory / std::filesystem::u8path(key + extension);
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------- compose temporary file name ------------------------
+// ----------------------------------------------------------------------------
+std::filesystem::path
+ArtifactCache::getTemporaryFileName(const std::string &key) const {
+  // pid makes it unique across processes, counter across threads
+  static std::atomic<uint64_t> counter(0);
+  const std::string name = ".tmp_" + key + "_" + std::to_string(getpid()) +
+                           "_" + std::to_string(counter++);
+  return directory / std::filesystem::u8path(name);
+}
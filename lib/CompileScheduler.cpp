@@ -0,0 +1,335 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "versioningCompiler/CompileScheduler.hpp"
+
+using namespace vc;
+
+// ----------------------------------------------------------------------------
+// --------------------------- detailed constructor ---------------------------
+// ----------------------------------------------------------------------------
+CompileScheduler::CompileScheduler(std::size_t frontendWorkers,
+                                   std::size_t optimizerWorkers,
+                                   std::size_t codegenWorkers) {
+  lanes[FRONTEND] = std::make_unique<ThreadPool>(frontendWorkers);
+  lanes[OPTIMIZER] = std::make_unique<ThreadPool>(optimizerWorkers);
+  lanes[CODEGEN] = std::make_unique<ThreadPool>(codegenWorkers);
+  lanes[LOAD] = std::make_unique<ThreadPool>(1);
+}
+
+// ----------------------------------------------------------------------------
+// ---------------------------- default destructor ----------------------------
+// ----------------------------------------------------------------------------
+CompileScheduler::~CompileScheduler() {
+  // in pipeline order: a draining lane still feeds the following ones
+  for (auto &lane : lanes) {
+    lane.reset();
+  }
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------ submit version ------------------------------
+// ----------------------------------------------------------------------------
+std::shared_future<bool>
+CompileScheduler::submit(const version_ptr_t &version, bool prepareIR) {
+  JobOptions options;
+  options.prepareIR = prepareIR;
+  return submit(version, options);
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------- submit version with options ------------------------
+// ----------------------------------------------------------------------------
+std::shared_future<bool>
+CompileScheduler::submit(const version_ptr_t &version,
+                         const JobOptions &options) {
+  job_ptr_t job = std::make_shared<Job>();
+  job->version = version;
+  job->priority = options.priority;
+  job->token = std::make_shared<CancellationToken>(options.deadline);
+  std::shared_future<bool> result;
+  if (!version->claimStage(version->inFlightCompile, job->promise, result)) {
+    // already compiling: raise its priority if it is ours
+    raisePriority(version->getID(), options.priority);
+    return result;
+  }
+  if (options.prepareIR && version->compiler->hasIRSupport()) {
+    job->stages.push_back(FRONTEND);
+    job->stages.push_back(OPTIMIZER);
+  }
+  job->stages.push_back(CODEGEN);
+  job->stages.push_back(LOAD);
+  version->compiler->setCancellationToken(version->getID(), job->token);
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    job->sequence = nextSequence++;
+    jobs.insert(job);
+  }
+  advance(job, true);
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------- submit batch -------------------------------
+// ----------------------------------------------------------------------------
+std::vector<std::shared_future<bool>>
+CompileScheduler::submit(const std::vector<version_ptr_t> &versions,
+                         bool prepareIR) {
+  JobOptions options;
+  options.prepareIR = prepareIR;
+  return submit(versions, options);
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------ submit batch with options -------------------------
+// ----------------------------------------------------------------------------
+std::vector<std::shared_future<bool>>
+CompileScheduler::submit(const std::vector<version_ptr_t> &versions,
+                         const JobOptions &options) {
+  std::vector<std::shared_future<bool>> result;
+  result.reserve(versions.size());
+  for (const auto &v : versions) {
+    result.push_back(submit(v, options));
+  }
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// ---------------------------------- cancel ----------------------------------
+// ----------------------------------------------------------------------------
+std::size_t CompileScheduler::cancel(const std::string &key) {
+  std::vector<job_ptr_t> dropped;
+  std::size_t count = 0;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (const auto &job : jobs) {
+      if (!matches(job, key)) {
+        continue;
+      }
+      // running stages notice the token
+      job->token->cancel();
+      count++;
+      if (job->queued) {
+        queues[job->stages[job->next]].erase(job);
+        job->queued = false;
+        dropped.push_back(job);
+      }
+    }
+  }
+  for (const auto &job : dropped) {
+    complete(job, false);
+  }
+  return count;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------- set priority -------------------------------
+// ----------------------------------------------------------------------------
+std::size_t CompileScheduler::setPriority(const std::string &key,
+                                          int priority) {
+  std::lock_guard<std::mutex> lock(mtx);
+  std::size_t count = 0;
+  for (const auto &job : jobs) {
+    if (!matches(job, key)) {
+      continue;
+    }
+    count++;
+    updatePriority(job, priority);
+  }
+  return count;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------ raise priority ------------------------------
+// ----------------------------------------------------------------------------
+void CompileScheduler::raisePriority(const std::string &versionID,
+                                     int priority) {
+  std::lock_guard<std::mutex> lock(mtx);
+  for (const auto &job : jobs) {
+    // tags are not matched: they may equal the ID of another Version
+    if (job->version->getID() == versionID && priority > job->priority) {
+      updatePriority(job, priority);
+    }
+  }
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------------- update priority ------------------------------
+// ----------------------------------------------------------------------------
+void CompileScheduler::updatePriority(const job_ptr_t &job, int priority) {
+  if (job->queued) {
+    // the priority is part of the queue order
+    auto &queue = queues[job->stages[job->next]];
+    queue.erase(job);
+    job->priority = priority;
+    queue.insert(job);
+  } else {
+    job->priority = priority;
+  }
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------ lane workers --------------------------------
+// ----------------------------------------------------------------------------
+std::size_t CompileScheduler::workers(Stage stage) const {
+  return lanes.at(stage)->size();
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------ pending tasks -------------------------------
+// ----------------------------------------------------------------------------
+std::size_t CompileScheduler::pendingTasks(Stage stage) const {
+  std::lock_guard<std::mutex> lock(mtx);
+  return queues.at(stage).size();
+}
+
+// ----------------------------------------------------------------------------
+// ---------------------------- default scheduler -----------------------------
+// ----------------------------------------------------------------------------
+CompileScheduler &CompileScheduler::getDefault() {
+  // intentionally leaked, see ThreadPool::getDefault()
+  static CompileScheduler *scheduler = new CompileScheduler();
+  return *scheduler;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------- queue order --------------------------------
+// ----------------------------------------------------------------------------
+bool CompileScheduler::JobOrder::operator()(const job_ptr_t &a,
+                                            const job_ptr_t &b) const {
+  if (a->priority != b->priority) {
+    return a->priority > b->priority;
+  }
+  if (a->token->getDeadline() != b->token->getDeadline()) {
+    return a->token->getDeadline() < b->token->getDeadline();
+  }
+  return a->sequence < b->sequence;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------- match job ----------------------------------
+// ----------------------------------------------------------------------------
+bool CompileScheduler::matches(const job_ptr_t &job, const std::string &key) {
+  if (job->version->getID() == key) {
+    return true;
+  }
+  for (const auto &tag : job->version->getTags()) {
+    if (tag == key) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------- next stage ---------------------------------
+// ----------------------------------------------------------------------------
+void CompileScheduler::advance(const job_ptr_t &job, bool ok) {
+  if (!ok || job->next == job->stages.size()) {
+    complete(job, ok);
+    return;
+  }
+  const Stage lane = job->stages[job->next];
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (job->done) {
+      return;
+    }
+    queues[lane].insert(job);
+    job->queued = true;
+  }
+  // one worker task per queued stage, it runs whichever job comes first
+  lanes[lane]->submit([this, lane]() { runNext(lane); });
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// -------------------------------- run stage ---------------------------------
+// ----------------------------------------------------------------------------
+void CompileScheduler::runNext(Stage lane) {
+  job_ptr_t job;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (queues[lane].empty()) {
+      return; // its job was cancelled
+    }
+    job = *queues[lane].begin();
+    queues[lane].erase(queues[lane].begin());
+    job->queued = false;
+  }
+  if (job->token->isCancelled()) {
+    complete(job, false); // past its deadline
+    return;
+  }
+  Version &v = *job->version;
+  bool ok = false;
+  try {
+    // other stages of the same Version may run through prepareIR()
+    std::lock_guard<std::mutex> lock(v.stageMtx);
+    switch (lane) {
+    case FRONTEND:
+      ok = v.generateIRStage();
+      break;
+    case OPTIMIZER:
+      ok = v.optimizeStage();
+      break;
+    case CODEGEN:
+      ok = v.generateBinStage();
+      break;
+    case LOAD:
+      ok = v.loadStage();
+      break;
+    default:
+      break;
+    }
+  } catch (...) {
+    complete(job, false, std::current_exception());
+    return;
+  }
+  job->next++;
+  advance(job, ok && !job->token->isCancelled());
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// -------------------------------- complete ----------------------------------
+// ----------------------------------------------------------------------------
+void CompileScheduler::complete(const job_ptr_t &job, bool ok,
+                                std::exception_ptr error) {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (job->done) {
+      return;
+    }
+    job->done = true;
+    jobs.erase(job);
+  }
+  Version &v = *job->version;
+  v.compiler->setCancellationToken(v.getID(), nullptr);
+  v.releaseStage(v.inFlightCompile);
+  if (error) {
+    job->promise.set_exception(error);
+  } else {
+    job->promise.set_value(ok);
+  }
+  return;
+}
@@ -19,12 +19,15 @@
  * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
  */
 #include "versioningCompiler/Compiler.hpp"
+#include "versioningCompiler/SharedObjectManager.hpp"
 
 #include <cstdio>
 #include <dlfcn.h> // needed for loadSymbol
 #include <filesystem>
 #include <fstream>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 using namespace vc;
 
@@ -54,29 +57,311 @@ std::string Compiler::getId() const { return id; }
 bool Compiler::hasIRSupport() const { return hasSupportIR; }
 
 // ----------------------------------------------------------------------------
-// --------------- print a command to log file and execute it -----------------
+// ------------------------- get compiler version -----------------------------
 // ----------------------------------------------------------------------------
-void Compiler::log_exec(const std::string &command) const {
-  FILE *output;
-  std::ofstream logstream;
-  std::string _command = command;
-  char buf[256];
-  if (!logFile.empty()) {
-    _command = _command + " 2>&1";
-    lockMutex(logFile);
-    logstream.open(logFile, std::ofstream::app);
-    logstream << _command << std::endl;
+std::string Compiler::getCompilerVersion() const { return ""; }
+
+// ---------------------------------------------------------------------------
+// -------------------------- get profile directory --------------------------
+// ---------------------------------------------------------------------------
+std::filesystem::path
+Compiler::getProfileDirectory(const std::string &profileID) const {
+  return libWorkingDirectory / std::filesystem::u8path("vc_profiles") /
+         std::filesystem::u8path(profileID);
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------- get manifest directory --------------------------
+// ---------------------------------------------------------------------------
+std::filesystem::path Compiler::getManifestDirectory() const {
+  return libWorkingDirectory / std::filesystem::u8path("vc_manifest");
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------- get profile generate options -----------------------
+// ---------------------------------------------------------------------------
+opt_list_t
+Compiler::getProfileGenerateOptions(const std::string &profileID) const {
+  opt_list_t options = {
+      Option("profile", "-fprofile-generate=",
+             getProfileDirectory(profileID).string()),
+      // instrumented Versions are called from many threads
+      Option("profile-update", "-fprofile-update=", "atomic")};
+  if (getCompilerVersion().find("clang") == std::string::npos) {
+    // gcc names its profiles after the output file, which differs between
+    // the instrumented and the optimized Version
+    options.push_back(Option("dumpbase", "-dumpbase ", profileID));
   }
-  output = popen(_command.c_str(), "r");
-  if (!logFile.empty()) {
-    while (fgets(buf, sizeof(buf), output) != 0) {
-      logstream << buf;
+  return options;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------- get profile use options -------------------------
+// ---------------------------------------------------------------------------
+opt_list_t Compiler::getProfileUseOptions(const std::string &profileID) {
+  const std::filesystem::path dir = getProfileDirectory(profileID);
+  std::vector<std::filesystem::path> rawProfiles;
+  bool gcovProfiles = false;
+  std::error_code ec;
+  std::filesystem::recursive_directory_iterator it(dir, ec);
+  for (; !ec && it != std::filesystem::recursive_directory_iterator();
+       it.increment(ec)) {
+    const std::filesystem::path extension = it->path().extension();
+    if (extension == ".profraw") {
+      rawProfiles.push_back(it->path());
+    } else if (extension == ".gcda") {
+      gcovProfiles = true;
     }
-    logstream << std::endl;
-    logstream.close();
-    unlockMutex(logFile);
   }
-  pclose(output);
+  if (!rawProfiles.empty()) {
+    const std::filesystem::path profile =
+        dir / std::filesystem::u8path(profileID + ".profdata");
+    if (!mergeProfiles(rawProfiles, profile)) {
+      log_string("cannot merge the profiles in " + dir.string());
+      return {};
+    }
+    return {Option("profile", "-fprofile-use=", profile.string())};
+  }
+  if (gcovProfiles) {
+    return {Option("profile", "-fprofile-use=", dir.string()),
+            Option("dumpbase", "-dumpbase ", profileID)};
+  }
+  log_string("no profile collected in " + dir.string());
+  return {};
+}
+
+// ---------------------------------------------------------------------------
+// ----------------------------- merge profiles ------------------------------
+// ---------------------------------------------------------------------------
+bool Compiler::mergeProfiles(
+    const std::vector<std::filesystem::path> &rawProfiles,
+    const std::filesystem::path &profile) {
+  std::vector<std::string> argv = {
+      (installDirectory / std::filesystem::u8path("llvm-profdata")).string(),
+      "merge", "-o", profile.string()};
+  for (const auto &raw : rawProfiles) {
+    argv.push_back(raw.string());
+  }
+  return log_exec(argv) == 0 && existsNotEmpty(profile);
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------------- has in-memory IR -----------------------------
+// ----------------------------------------------------------------------------
+bool Compiler::hasInMemoryIR(const std::string &) const { return false; }
+
+// ----------------------------------------------------------------------------
+// ----------------------------- release version ------------------------------
+// ----------------------------------------------------------------------------
+void Compiler::releaseVersion(const std::string &versionID) {
+  {
+    std::lock_guard<std::mutex> lock(sourceBuffersMtx);
+    sourceBuffers.erase(versionID);
+  }
+  {
+    std::lock_guard<std::mutex> lock(cancelTokensMtx);
+    cancelTokens.erase(versionID);
+  }
+  std::lock_guard<std::mutex> lock(memoryBinaryFdsMtx);
+  memoryBinaryFds.erase(versionID);
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------- set cancellation token ---------------------------
+// ----------------------------------------------------------------------------
+void Compiler::setCancellationToken(const std::string &versionID,
+                                    const cancel_token_t &token) {
+  std::lock_guard<std::mutex> lock(cancelTokensMtx);
+  if (token) {
+    cancelTokens[versionID] = token;
+  } else {
+    cancelTokens.erase(versionID);
+  }
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------- get cancellation token ---------------------------
+// ----------------------------------------------------------------------------
+cancel_token_t
+Compiler::getCancellationToken(const std::string &versionID) const {
+  std::lock_guard<std::mutex> lock(cancelTokensMtx);
+  const auto it = cancelTokens.find(versionID);
+  if (it == cancelTokens.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------ is cancelled --------------------------------
+// ----------------------------------------------------------------------------
+bool Compiler::isCancelled(const std::string &versionID) const {
+  const cancel_token_t token = getCancellationToken(versionID);
+  return token && token->isCancelled();
+}
+
+// ----------------------------------------------------------------------------
+// --------------------------- add source buffers -----------------------------
+// ----------------------------------------------------------------------------
+void Compiler::addSourceBuffers(const std::string &versionID,
+                                const source_buffer_map_t &buffers) {
+  std::lock_guard<std::mutex> lock(sourceBuffersMtx);
+  source_buffer_map_t &entry = sourceBuffers[versionID];
+  for (const auto &buffer : buffers) {
+    entry[buffer.first] = buffer.second;
+  }
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// ---------------------------- get source buffer -----------------------------
+// ----------------------------------------------------------------------------
+std::shared_ptr<const std::string>
+Compiler::getSourceBuffer(const std::string &versionID,
+                          const std::filesystem::path &name) const {
+  std::lock_guard<std::mutex> lock(sourceBuffersMtx);
+  const auto version = sourceBuffers.find(versionID);
+  if (version == sourceBuffers.end()) {
+    return nullptr;
+  }
+  const auto buffer = version->second.find(name);
+  if (buffer == version->second.end()) {
+    return nullptr;
+  }
+  return buffer->second;
+}
+
+// ----------------------------------------------------------------------------
+// --------------------------- has source buffers -----------------------------
+// ----------------------------------------------------------------------------
+bool Compiler::hasSourceBuffers(const std::string &versionID) const {
+  std::lock_guard<std::mutex> lock(sourceBuffersMtx);
+  return sourceBuffers.find(versionID) != sourceBuffers.end();
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------- enable artifact cache ----------------------------
+// ----------------------------------------------------------------------------
+void Compiler::enableArtifactCache(std::chrono::seconds failureTTL) {
+  artifactCache = std::make_shared<ArtifactCache>(
+      libWorkingDirectory / std::filesystem::u8path("vc_cache"), failureTTL);
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// --------------------------- get artifact cache -----------------------------
+// ----------------------------------------------------------------------------
+std::shared_ptr<ArtifactCache> Compiler::getArtifactCache() const {
+  return artifactCache;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------- enable memory binaries ---------------------------
+// ----------------------------------------------------------------------------
+bool Compiler::enableMemoryBinaries(bool enable) {
+#ifdef __linux__
+  memoryBinaries = enable;
+  return true;
+#else
+  memoryBinaries = false;
+  return !enable;
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// --------------------------- has memory binaries ----------------------------
+// ----------------------------------------------------------------------------
+bool Compiler::hasMemoryBinaries() const { return memoryBinaries; }
+
+// ----------------------------------------------------------------------------
+// ------------------------- prepare memory binary ----------------------------
+// ----------------------------------------------------------------------------
+int Compiler::prepareMemoryBinary(const std::string &versionID) {
+#ifdef __linux__
+  std::lock_guard<std::mutex> lock(memoryBinaryFdsMtx);
+  const auto it = memoryBinaryFds.find(versionID);
+  if (it != memoryBinaryFds.end()) {
+    // drop any partial output of a previous attempt
+    ftruncate(it->second, 0);
+    return it->second;
+  }
+  const std::string name = "lib" + versionID + ".so";
+  const int fd = memfd_create(name.c_str(), MFD_CLOEXEC);
+  if (fd < 0) {
+    log_string("cannot create memory file for " + name);
+    return -1;
+  }
+  memoryBinaryFds[versionID] = fd;
+  return fd;
+#else
+  return -1;
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------- discard shared object ----------------------------
+// ----------------------------------------------------------------------------
+void Compiler::discardSharedObject(const std::string &versionID) const {
+  {
+    // the memory file outlives any path: empty it
+    std::lock_guard<std::mutex> lock(memoryBinaryFdsMtx);
+    const auto it = memoryBinaryFds.find(versionID);
+    if (it != memoryBinaryFds.end()) {
+      ftruncate(it->second, 0);
+      return;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::remove(getSharedObjectFileName(versionID), ec);
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// --------------- print a command to log file and execute it -----------------
+// ----------------------------------------------------------------------------
+int Compiler::log_exec(const std::string &command) const {
+  return log_exec(ProcessLauncher::tokenize(command));
+}
+
+// ----------------------------------------------------------------------------
+// ------------- execute a command and log its output and status --------------
+// ----------------------------------------------------------------------------
+int Compiler::log_exec(const std::vector<std::string> &argv,
+                       const std::string *input,
+                       const std::string &versionID) const {
+  const cancel_token_t token =
+      versionID.empty() ? nullptr : getCancellationToken(versionID);
+  const ProcessResult result =
+      ProcessLauncher::run(argv, input, environment, token.get());
+  if (logFile.empty()) {
+    return result.exitCode;
+  }
+  // the log file is locked only to append the whole record
+  std::string record = ProcessLauncher::join(argv);
+  if (input) {
+    record += " < (in-memory buffer)";
+  }
+  record += "\n" + result.output;
+  if (result.cancelled) {
+    record += "cancelled\n";
+  } else if (!result.launched) {
+    record += "process not started\n";
+  } else if (result.signal != 0) {
+    record += "terminated by signal " + std::to_string(result.signal) + "\n";
+  } else if (result.exitCode != 0) {
+    record += "exit status " + std::to_string(result.exitCode) + "\n";
+  }
+  log_string(record);
+  return result.exitCode;
+}
+
+// ----------------------------------------------------------------------------
+// ---------------------------- set environment -------------------------------
+// ----------------------------------------------------------------------------
+void Compiler::setEnvironment(const env_map_t &env) {
+  environment = env;
   return;
 }
 
@@ -99,10 +384,9 @@ void Compiler::log_string(const std::string &command) const {
 // ----------------------------- releaseSymbol -------------------------------
 // ---------------------------------------------------------------------------
 void Compiler::releaseSymbol(void **handler) {
-  if (dlclose(*handler)) {
-    char *error = dlerror();
-    std::string error_str(error);
-    log_string(error_str);
+  std::string error;
+  if (!SharedObjectManager::getDefault().release(*handler, &error)) {
+    log_string(error);
   }
   *handler = nullptr;
   return;
@@ -115,32 +399,124 @@ std::vector<void *> Compiler::loadSymbols(const std::filesystem::path &bin,
                                           const std::vector<std::string> &func,
                                           void **handler) {
   std::vector<void *> symbols = {};
-  if (exists(bin)) {
-    *handler = dlopen(bin.c_str(), RTLD_NOW);
-  } else {
-    std::string error_str =
-        "cannot load symbol from " + bin.string() + " : file not found";
-    log_string(error_str);
+  if (!openSharedObject(bin, RTLD_NOW | RTLD_LOCAL, handler)) {
     return symbols;
   }
-  if (*handler) {
-    for (const std::string &f : func) {
-      void *symbol = dlsym(*handler, f.c_str());
-      if (!symbol) {
-        std::string error_str = "cannot load symbol " + f + " from " +
-                                bin.string() + " : symbol not found";
-        log_string(error_str);
-      }
-      symbols.push_back(symbol);
-    } // end for
-  } else {
-    char *error = dlerror();
-    std::string error_str(error);
-    log_string(error_str);
-  }
+  for (const std::string &f : func) {
+    symbols.push_back(resolveSymbol(*handler, f));
+  } // end for
   return symbols;
 }
 
+// ---------------------------------------------------------------------------
+// -------------------------- supportsLazySymbols ----------------------------
+// ---------------------------------------------------------------------------
+bool Compiler::supportsLazySymbols() const { return true; }
+
+// ---------------------------------------------------------------------------
+// ---------------------------- openSharedObject -----------------------------
+// ---------------------------------------------------------------------------
+bool Compiler::openSharedObject(const std::filesystem::path &bin, int flags,
+                                void **handler) {
+  std::string error;
+  *handler = SharedObjectManager::getDefault().acquire(bin, flags, &error);
+  if (!*handler) {
+    log_string("cannot load symbol from " + error);
+    return false;
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// ----------------------------- resolveSymbol -------------------------------
+// ---------------------------------------------------------------------------
+void *Compiler::resolveSymbol(void *handler, const std::string &func) const {
+  void *symbol = SharedObjectManager::getDefault().resolve(handler, func);
+  if (!symbol) {
+    log_string("cannot load symbol " + func + " : symbol not found");
+  }
+  return symbol;
+}
+
+// ---------------------------------------------------------------------------
+// -------------------------- prefaultSharedObject ---------------------------
+// ---------------------------------------------------------------------------
+bool Compiler::prefaultSharedObject(void *handler) const {
+  return SharedObjectManager::getDefault().prefault(handler) > 0;
+}
+
+// ---------------------------------------------------------------------------
+// --------------------------- getHugePageOptions ----------------------------
+// ---------------------------------------------------------------------------
+opt_list_t Compiler::getHugePageOptions() const {
+  // segments start at a 2 MiB boundary, the loader keeps the alignment
+  return {Option("huge-max-page", "-Wl,-z,max-page-size=", "0x200000"),
+          Option("huge-common-page", "-Wl,-z,common-page-size=", "0x200000")};
+}
+
+// ---------------------------------------------------------------------------
+// ----------------------------- remapHugePages ------------------------------
+// ---------------------------------------------------------------------------
+bool Compiler::remapHugePages(void *handler) {
+  return SharedObjectManager::getDefault().remapHugePages(handler);
+}
+
+// ---------------------------------------------------------------------------
+// --------------------------- getFastLoadOptions ----------------------------
+// ---------------------------------------------------------------------------
+opt_list_t Compiler::getFastLoadOptions() const {
+  // direct binding of internal references, no lazy binding at call time,
+  // unreferenced sections dropped
+  return {Option("fast-interposition", "-fno-semantic-interposition", ""),
+          Option("fast-function-sections", "-ffunction-sections", ""),
+          Option("fast-data-sections", "-fdata-sections", ""),
+          Option("fast-gc-sections", "-Wl,--gc-sections", ""),
+          Option("fast-hash-style", "-Wl,--hash-style=", "gnu"),
+          Option("fast-now", "-Wl,-z,now", ""),
+          Option("fast-symbolic", "-Wl,-Bsymbolic", "")};
+}
+
+// ---------------------------------------------------------------------------
+// --------------------------- enable export maps ----------------------------
+// ---------------------------------------------------------------------------
+void Compiler::enableExportMaps(bool enable) {
+  exportMaps = enable;
+  return;
+}
+
+// ---------------------------------------------------------------------------
+// ----------------------------- has export maps -----------------------------
+// ---------------------------------------------------------------------------
+bool Compiler::hasExportMaps() const { return exportMaps; }
+
+// ---------------------------------------------------------------------------
+// ---------------------------- write export map -----------------------------
+// ---------------------------------------------------------------------------
+std::filesystem::path
+Compiler::writeExportMap(const std::vector<std::string> &func,
+                         const std::string &versionID) const {
+  if (!exportMaps || func.empty()) {
+    return "";
+  }
+  const std::filesystem::path mapFileName =
+      libWorkingDirectory / std::filesystem::u8path(versionID + "_exports.map");
+  std::ofstream mapFile(mapFileName);
+  mapFile << "{\n  global:\n";
+  for (const auto &f : func) {
+    // quoted names are not glob patterns
+    mapFile << "    \"" << f << "\";\n";
+  }
+  mapFile << "  local: *;\n};\n";
+  mapFile.close();
+  if (!mapFile) {
+    log_string("Unable to write the export map " + mapFileName.string());
+    std::error_code ec;
+    std::filesystem::remove(mapFileName, ec);
+    return "";
+  }
+  return mapFileName;
+}
+
 // ----------------------------------------------------------------------------
 // -------------------------- check file existence ----------------------------
 // ----------------------------------------------------------------------------
@@ -149,6 +525,14 @@ bool Compiler::exists(const std::filesystem::path &name) {
   return (stat(name.c_str(), &buffer) == 0);
 }
 
+// ----------------------------------------------------------------------------
+// ------------------- check file existence and content -----------------------
+// ----------------------------------------------------------------------------
+bool Compiler::existsNotEmpty(const std::filesystem::path &name) {
+  struct stat buffer;
+  return (stat(name.c_str(), &buffer) == 0 && buffer.st_size > 0);
+}
+
 // ----------------------------------------------------------------------------
 // ---------------------- compose intermediate file name ----------------------
 // ----------------------------------------------------------------------------
@@ -175,6 +559,15 @@ Compiler::getOptBitcodeFileName(const std::string &versionID) const {
 // ----------------------------------------------------------------------------
 std::filesystem::path
 Compiler::getSharedObjectFileName(const std::string &versionID) const {
+  {
+    // the /proc path of this process is valid in the compiler processes too
+    std::lock_guard<std::mutex> lock(memoryBinaryFdsMtx);
+    const auto it = memoryBinaryFds.find(versionID);
+    if (it != memoryBinaryFds.end()) {
+      return std::filesystem::u8path("/proc/" + std::to_string(getpid()) +
+                                     "/fd/" + std::to_string(it->second));
+    }
+  }
   const std::filesystem::path filename =
       libWorkingDirectory / std::filesystem::path("lib" + versionID + ".so");
   return filename;
@@ -269,9 +662,15 @@ void Compiler::lockMutex(const std::filesystem::path &logFileName) {
   if (logFileName.empty()) {
     return;
   }
+  std::shared_ptr<std::mutex> mtx;
+  mtx_map_mtx.lock();
   auto it = log_access_mtx_map.find(logFileName);
   if (it != log_access_mtx_map.end()) {
-    it->second.second->lock();
+    mtx = it->second.second;
+  }
+  mtx_map_mtx.unlock();
+  if (mtx) {
+    mtx->lock();
   }
   return;
 }
@@ -283,9 +682,15 @@ void Compiler::unlockMutex(const std::filesystem::path &logFileName) {
   if (logFileName.empty()) {
     return;
   }
+  std::shared_ptr<std::mutex> mtx;
+  mtx_map_mtx.lock();
   auto it = log_access_mtx_map.find(logFileName);
   if (it != log_access_mtx_map.end()) {
-    it->second.second->unlock();
+    mtx = it->second.second;
+  }
+  mtx_map_mtx.unlock();
+  if (mtx) {
+    mtx->unlock();
   }
   return;
 }
@@ -205,6 +205,18 @@ void FileLogDiagnosticConsumer::EndSourceFile() {
   return;
 }
 
+// ----------------------------------------------------------------------------
+// ------------------------------ take entries --------------------------------
+// ----------------------------------------------------------------------------
+std::string FileLogDiagnosticConsumer::takeEntries() {
+  std::string result = "";
+  for (auto &e : Entries) {
+    result = result + "\n" + e;
+  }
+  Entries.clear();
+  return result;
+}
+
 // ----------------------------------------------------------------------------
 // ---------------------------- handle diagnostic -----------------------------
 // ----------------------------------------------------------------------------
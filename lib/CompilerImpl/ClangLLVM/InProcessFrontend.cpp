@@ -0,0 +1,104 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "versioningCompiler/CompilerImpl/ClangLLVM/InProcessFrontend.hpp"
+#include "versioningCompiler/CompilerImpl/ClangLLVM/FileLogDiagnosticConsumer.hpp"
+
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/DiagnosticIDs.h"
+#include "clang/Basic/DiagnosticOptions.h"
+#include "clang/CodeGen/CodeGenAction.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Frontend/Utils.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <filesystem>
+
+// ----------------------------------------------------------------------------
+// ------------------------ create source file system -------------------------
+// ----------------------------------------------------------------------------
+llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>
+vc::createSourceFileSystem(const source_buffer_map_t &buffers) {
+  llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> overlay =
+      new llvm::vfs::OverlayFileSystem(llvm::vfs::getRealFileSystem());
+  llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> memory =
+      new llvm::vfs::InMemoryFileSystem();
+  // the overlay forwards its working directory to the in-memory layer
+  overlay->pushOverlay(memory);
+  for (const auto &buffer : buffers) {
+    const std::string name = std::filesystem::absolute(buffer.first).string();
+    memory->addFile(name, 0,
+                    llvm::MemoryBuffer::getMemBuffer(*buffer.second, name,
+                                                     false));
+  }
+  return overlay;
+}
+
+// ----------------------------------------------------------------------------
+// --------------------------- run clang frontend -----------------------------
+// ----------------------------------------------------------------------------
+std::unique_ptr<llvm::Module>
+vc::runClangFrontend(const std::vector<const char *> &args,
+                     llvm::LLVMContext &context,
+                     llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs,
+                     std::string &diagnostics, bool &unsupported) {
+  unsupported = false;
+  if (!fs) {
+    fs = llvm::vfs::getRealFileSystem();
+  }
+  llvm::IntrusiveRefCntPtr<clang::DiagnosticOptions> diagnosticOptions =
+      new clang::DiagnosticOptions();
+  vc::FileLogDiagnosticConsumer diagConsumer(std::filesystem::u8path(""),
+                                             diagnosticOptions.get());
+  llvm::IntrusiveRefCntPtr<clang::DiagnosticsEngine> diagEngine =
+      new clang::DiagnosticsEngine(new clang::DiagnosticIDs(),
+                                   diagnosticOptions.get(), &diagConsumer,
+                                   false);
+
+  // the invocation takes the arguments of the only cc1 job
+  clang::CreateInvocationOptions invocationOptions;
+  invocationOptions.Diags = diagEngine;
+  invocationOptions.VFS = fs;
+  std::shared_ptr<clang::CompilerInvocation> invocation =
+      clang::createInvocation(args, invocationOptions);
+  if (!invocation) {
+    unsupported = true;
+    diagnostics = diagConsumer.takeEntries();
+    return nullptr;
+  }
+
+  clang::CompilerInstance CI;
+  CI.setInvocation(std::move(invocation));
+#if LLVM_VERSION_MAJOR >= 20
+  CI.createDiagnostics(*fs, &diagConsumer, false);
+#else
+  CI.createDiagnostics(&diagConsumer, false);
+#endif
+  CI.createFileManager(fs);
+
+  clang::EmitLLVMOnlyAction action(&context);
+  const bool success = CI.ExecuteAction(action);
+  diagnostics = diagConsumer.takeEntries();
+  if (!success) {
+    return nullptr;
+  }
+  return action.takeModule();
+}
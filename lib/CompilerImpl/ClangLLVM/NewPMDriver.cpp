@@ -0,0 +1,337 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "versioningCompiler/CompilerImpl/ClangLLVM/NewPMDriver.h"
+
+#include "llvm/Analysis/CGSCCPassManager.h"
+#include "llvm/Analysis/LoopAnalysisManager.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Bitcode/BitcodeWriterPass.h"
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#if LLVM_VERSION_MAJOR < 17
+#include "llvm/ADT/Triple.h"
+#include "llvm/IR/IRPrintingPasses.h"
+#include "llvm/Support/Host.h"
+#else
+#include "llvm/IRPrinter/IRPrintingPasses.h"
+#include "llvm/TargetParser/Host.h"
+#include "llvm/TargetParser/Triple.h"
+#endif
+
+#include <memory>
+
+using namespace vc;
+
+namespace {
+
+// remove one level of single or double quotes
+std::string unquote(const std::string &s) {
+  if (s.length() > 1 && (s.front() == '\'' || s.front() == '\"') &&
+      s.back() == s.front()) {
+    return s.substr(1, s.length() - 2);
+  }
+  return s;
+}
+
+// strip leading dashes, `opt` accepts both -name and --name
+std::string stripDashes(const std::string &s) {
+  std::size_t i = 0;
+  while (i < s.length() && i < 2 && s[i] == '-') {
+    i++;
+  }
+  return s.substr(i);
+}
+
+// legacy spelling "defaultO3" is accepted as "default<O3>"
+std::string normalizePipeline(const std::string &pipeline) {
+  std::string result = "";
+  std::size_t begin = 0;
+  while (begin <= pipeline.length()) {
+    std::size_t end = pipeline.find(',', begin);
+    if (end == std::string::npos) {
+      end = pipeline.length();
+    }
+    std::string element = pipeline.substr(begin, end - begin);
+    if (element.length() == 9 && element.compare(0, 8, "defaultO") == 0) {
+      element = "default<O" + element.substr(8) + ">";
+    }
+    result = result.empty() ? element : result + "," + element;
+    begin = end + 1;
+  }
+  return result;
+}
+
+#if LLVM_VERSION_MAJOR < 18
+llvm::CodeGenOpt::Level getCodeGenOptLevel(unsigned optLevel) {
+  switch (optLevel) {
+  case 0:
+    return llvm::CodeGenOpt::None;
+  case 1:
+    return llvm::CodeGenOpt::Less;
+  case 2:
+    return llvm::CodeGenOpt::Default;
+  default:
+    return llvm::CodeGenOpt::Aggressive;
+  }
+}
+#else
+llvm::CodeGenOptLevel getCodeGenOptLevel(unsigned optLevel) {
+  switch (optLevel) {
+  case 0:
+    return llvm::CodeGenOptLevel::None;
+  case 1:
+    return llvm::CodeGenOptLevel::Less;
+  case 2:
+    return llvm::CodeGenOptLevel::Default;
+  default:
+    return llvm::CodeGenOptLevel::Aggressive;
+  }
+}
+#endif
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+// ------------------------ create host target machine ------------------------
+// ----------------------------------------------------------------------------
+std::unique_ptr<llvm::TargetMachine>
+vc::createHostTargetMachine(llvm::Module &M, unsigned OptLevel) {
+  llvm::Triple moduleTriple(M.getTargetTriple());
+  if (!moduleTriple.getArch()) {
+    return nullptr;
+  }
+  std::string lookupError;
+  const llvm::Target *TheTarget =
+      llvm::TargetRegistry::lookupTarget("", moduleTriple, lookupError);
+  // Some modules don't specify a triple, and this is okay.
+  if (!TheTarget) {
+    return nullptr;
+  }
+#if LLVM_VERSION_MAJOR < 19
+  llvm::StringMap<bool> features;
+  llvm::sys::getHostCPUFeatures(features);
+#else
+  llvm::StringMap<bool> features = llvm::sys::getHostCPUFeatures();
+#endif
+  std::string featuresStr;
+  for (const auto &feature : features) {
+    if (!featuresStr.empty()) {
+      featuresStr += ",";
+    }
+    featuresStr += (feature.second ? "+" : "-") + feature.first().str();
+  }
+#if LLVM_VERSION_MAJOR < 17
+  llvm::Optional<llvm::Reloc::Model> reloc =
+      llvm::Optional<llvm::Reloc::Model>(llvm::Reloc::Model::PIC_);
+  llvm::Optional<llvm::CodeModel::Model> code_model =
+      llvm::Optional<llvm::CodeModel::Model>(llvm::CodeModel::Model::Small);
+#else
+  std::optional<llvm::Reloc::Model> reloc =
+      std::make_optional<llvm::Reloc::Model>(llvm::Reloc::Model::PIC_);
+  std::optional<llvm::CodeModel::Model> code_model =
+      std::make_optional<llvm::CodeModel::Model>(
+          llvm::CodeModel::Model::Small);
+#endif
+  return std::unique_ptr<llvm::TargetMachine>(TheTarget->createTargetMachine(
+      moduleTriple.getTriple(), llvm::sys::getHostCPUName().str(), featuresStr,
+      llvm::TargetOptions(), reloc, code_model, getCodeGenOptLevel(OptLevel)));
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------- parse optimizer options --------------------------
+// ----------------------------------------------------------------------------
+bool vc::parseOptimizerOptions(const std::vector<std::string> &Args,
+                               OptimizerConfig &Config, std::string &Error) {
+  for (const auto &raw_arg : Args) {
+    const std::string arg = unquote(raw_arg);
+    if (arg.empty()) {
+      continue;
+    }
+    if (arg[0] != '-') {
+      Error = "Unexpected positional argument " + arg;
+      return false;
+    }
+    const std::string opt = stripDashes(arg);
+    const std::size_t eq = opt.find('=');
+    const std::string name = opt.substr(0, eq);
+    const std::string value =
+        (eq == std::string::npos) ? "" : unquote(opt.substr(eq + 1));
+    if (name == "O0" || name == "O1" || name == "O2" || name == "O3") {
+      Config.OptLevel = static_cast<unsigned>(name[1] - '0');
+      Config.Pipeline.push_back("default<" + name + ">");
+    } else if (name == "Os" || name == "Oz") {
+      Config.OptLevel = 2;
+      Config.Pipeline.push_back("default<" + name + ">");
+    } else if (name == "passes") {
+      if (value.empty()) {
+        Error = "Empty pass pipeline";
+        return false;
+      }
+      Config.Pipeline.push_back(normalizePipeline(value));
+    } else if (name == "S") {
+      Config.OK = llvm::opt_tool::OK_OutputAssembly;
+    } else if (name == "strip-debug") {
+      Config.StripDebug = true;
+    } else if (name == "disable-verify") {
+      Config.VK = llvm::opt_tool::VK_NoVerifier;
+    } else if (name == "verify-each") {
+      Config.VK = llvm::opt_tool::VK_VerifyEachPass;
+    } else if (name == "disable-simplify-libcalls") {
+      Config.DisableSimplifyLibCalls = true;
+    } else if (name == "mtriple") {
+      Config.TargetTriple = value;
+    } else if (name == "data-layout") {
+      Config.DefaultDataLayout = value;
+    } else if (name == "preserve-bc-uselistorder") {
+      Config.PreserveBitcodeUseListOrder = true;
+    } else if (name == "preserve-ll-uselistorder") {
+      Config.PreserveAssemblyUseListOrder = true;
+    } else if (name == "discard-value-names") {
+      Config.DiscardValueNames = true;
+    } else if (eq == std::string::npos) {
+      // legacy `opt -pass-name` syntax, validated by the pipeline parser
+      Config.Pipeline.push_back(name);
+    } else {
+      Config.Ignored.push_back(raw_arg);
+    }
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// ---------------------------- run pass pipeline -----------------------------
+// ----------------------------------------------------------------------------
+bool vc::runPassPipeline(llvm::Module &M, const OptimizerConfig &Config,
+                         llvm::raw_ostream &Out, std::string &Error) {
+  // Strip debug info before running the verifier.
+  if (Config.StripDebug) {
+    llvm::StripDebugInfo(M);
+  }
+
+  // Immediately run the verifier to catch any problems before starting up the
+  // pass pipelines.
+  if (Config.VK != llvm::opt_tool::VK_NoVerifier) {
+    std::string verifier_str;
+    llvm::raw_string_ostream verifier_stream(verifier_str);
+    if (llvm::verifyModule(M, &verifier_stream)) {
+      Error = "Verifier check fail: input module is broken!\n" +
+              verifier_stream.str();
+      return false;
+    }
+  }
+
+  if (!Config.TargetTriple.empty()) {
+    M.setTargetTriple(llvm::Triple::normalize(Config.TargetTriple));
+  }
+  if (M.getDataLayout().isDefault() && !Config.DefaultDataLayout.empty()) {
+    M.setDataLayout(Config.DefaultDataLayout);
+  }
+
+  std::unique_ptr<llvm::TargetMachine> TM =
+      createHostTargetMachine(M, Config.OptLevel);
+
+  llvm::TargetLibraryInfoImpl TLII(llvm::Triple(M.getTargetTriple()));
+  // The -disable-simplify-libcalls flag actually disables all builtin optzns.
+  if (Config.DisableSimplifyLibCalls) {
+    TLII.disableAllFunctions();
+  }
+
+  // all the analysis managers are local to this invocation
+  llvm::LoopAnalysisManager LAM;
+  llvm::FunctionAnalysisManager FAM;
+  llvm::CGSCCAnalysisManager CGAM;
+  llvm::ModuleAnalysisManager MAM;
+  llvm::PassBuilder PB(TM.get());
+
+  FAM.registerPass([&] { return llvm::TargetLibraryAnalysis(TLII); });
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  llvm::ModulePassManager MPM;
+  for (const auto &element : Config.Pipeline) {
+    if (auto Err = PB.parsePassPipeline(MPM, element)) {
+      Error = "Invalid pass pipeline \"" + element +
+              "\": " + llvm::toString(std::move(Err));
+      return false;
+    }
+    if (Config.VK == llvm::opt_tool::VK_VerifyEachPass) {
+      MPM.addPass(llvm::VerifierPass());
+    }
+  }
+
+  // Check that the module is well formed on completion of optimization
+  if (Config.VK == llvm::opt_tool::VK_VerifyInAndOut) {
+    MPM.addPass(llvm::VerifierPass());
+  }
+
+  // Write bitcode or assembly to the output as the last step...
+  if (Config.OK == llvm::opt_tool::OK_OutputAssembly) {
+    MPM.addPass(
+        llvm::PrintModulePass(Out, "", Config.PreserveAssemblyUseListOrder));
+  } else if (Config.OK != llvm::opt_tool::OK_NoOutput) {
+    MPM.addPass(
+        llvm::BitcodeWriterPass(Out, Config.PreserveBitcodeUseListOrder));
+  }
+
+  MPM.run(M, MAM);
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// ---------------------------- emit object code ------------------------------
+// ----------------------------------------------------------------------------
+bool vc::emitObjectCode(llvm::Module &M, unsigned OptLevel,
+                        llvm::SmallVectorImpl<char> &Out, std::string &Error) {
+  std::unique_ptr<llvm::TargetMachine> TM =
+      createHostTargetMachine(M, OptLevel);
+  if (!TM) {
+    Error = "Unable to create a target machine for triple " +
+            std::string(M.getTargetTriple());
+    return false;
+  }
+  M.setDataLayout(TM->createDataLayout());
+  llvm::raw_svector_ostream OS(Out);
+  // code generation still relies on the legacy pass manager
+  llvm::legacy::PassManager CodeGenPasses;
+#if LLVM_VERSION_MAJOR < 18
+  const auto FileType = llvm::CGFT_ObjectFile;
+#else
+  const auto FileType = llvm::CodeGenFileType::ObjectFile;
+#endif
+  if (TM->addPassesToEmitFile(CodeGenPasses, OS, nullptr, FileType)) {
+    Error = "Target does not support object file emission";
+    return false;
+  }
+  CodeGenPasses.run(M);
+  return true;
+}
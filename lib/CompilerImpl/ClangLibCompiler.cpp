@@ -27,17 +27,25 @@
 
 #include "versioningCompiler/CompilerImpl/ClangLibCompiler.hpp"
 #include "versioningCompiler/CompilerImpl/ClangLLVM/FileLogDiagnosticConsumer.hpp"
+#include "versioningCompiler/CompilerImpl/ClangLLVM/InProcessFrontend.hpp"
 #include "versioningCompiler/CompilerImpl/ClangLLVM/OptUtils.hpp" // opt stuff
 #include "versioningCompiler/DebugUtils.hpp"
 
+#include "clang/Basic/Version.h"
 #include "clang/CodeGen/CodeGenAction.h"
 #include "clang/Driver/Compilation.h"
 #include "clang/Driver/Driver.h"
 #include "clang/Driver/Job.h"
 #include "clang/Frontend/CompilerInvocation.h"
 
+#include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/CodeGen/CommandFlags.h"
+#include "llvm/ProfileData/InstrProfReader.h"
+#include "llvm/ProfileData/InstrProfWriter.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
 
+#include <fstream>
 #include <vector>
 #if LLVM_VERSION_MAJOR < 17
 #include "llvm/ADT/Optional.h"
@@ -50,8 +58,6 @@
 using namespace vc;
 using namespace clang;
 
-// static mutex object initialization
-std::mutex ClangLibCompiler::opt_parse_mtx;
 
 // ----------------------------------------------------------------------------
 // ----------------------- zero-parameters constructor ------------------------
@@ -77,14 +83,6 @@ ClangLibCompiler::ClangLibCompiler(const std::string &compilerID,
       ) {
   // initialize LLVM stuff and shutdown everything at program tear down
   _llvmManager = LLVMInstanceManager::getInstance();
-
-  // custom diagnostic engine creation
-  _diagnosticOptions = new clang::DiagnosticOptions();
-  _diagnosticIDs = new clang::DiagnosticIDs();
-  _diagConsumer = std::make_shared<vc::FileLogDiagnosticConsumer>(
-      log, _diagnosticOptions.get());
-  _diagEngine = new clang::DiagnosticsEngine(
-      _diagnosticIDs, _diagnosticOptions.get(), _diagConsumer.get(), false);
   return;
 }
 
@@ -118,6 +116,12 @@ ClangLibCompiler::generateIR(const std::vector<std::filesystem::path> &src,
     return;
   };
 
+  // stop between stages once the compilation is cancelled
+  if (isCancelled(versionID)) {
+    report_error("compilation cancelled");
+    return failureFileName;
+  }
+
   const std::filesystem::path &command_filename =
       _llvmManager->getClangExePath();
 
@@ -151,30 +155,43 @@ ClangLibCompiler::generateIR(const std::vector<std::filesystem::path> &src,
   }
   Compiler::log_string(log_str);
 
-  clang::driver::Driver NikiLauda(_llvmManager->getClangExePath().string(),
-                           _llvmManager->getDefaultTriple()->str(),
-                           *_diagEngine);
-  NikiLauda.setTitle("clang as a library");
-  NikiLauda.setCheckInputsExist(false);
-  NikiLauda.CCPrintOptionsFilename = logFile.c_str();
-  Compiler::lockMutex(logFile);
-#ifdef VC_DEBUG
-  NikiLauda.CCPrintOptions = true;
-#else
-  NikiLauda.CCPrintOptions = false;
-#endif
+  // in-memory sources can only be read by the in-process frontend
+  const bool fromBuffers = hasSourceBuffers(versionID);
+  if (_inMemoryPipeline || fromBuffers) {
+    auto entry = std::make_shared<InMemoryModule>();
+    bool unsupported = false;
+    if (runFrontend(cmd_str, versionID, src, *entry, unsupported)) {
+      if ((!_inMemoryPipeline || _keepIntermediateFiles) &&
+          !writeBitcode(*entry->module, llvmIRfileName)) {
+        report_error("Unable to write " + llvmIRfileName.string());
+        if (!_inMemoryPipeline) {
+          return failureFileName;
+        }
+      }
+      if (_inMemoryPipeline) {
+        std::lock_guard<std::mutex> lock(_modules_mtx);
+        _modules[versionID] = entry;
+      }
+      return llvmIRfileName;
+    }
+    if (unsupported && fromBuffers) {
+      report_error("In-memory sources require a single translation unit");
+      return failureFileName;
+    }
+    if (!unsupported) {
+      report_error("In-memory frontend failed");
+      return failureFileName;
+    }
+    Compiler::log_string("ClangLibCompiler::generateIR version " + versionID +
+                         " not supported in memory, using files");
+  }
 
-  std::unique_ptr<clang::driver::Compilation> C(NikiLauda.BuildCompilation(cmd_str));
-  if (!C) {
+  int res = 0;
+  if (!runDriver(cmd_str, res)) {
     report_error("clang::driver::Compilation not created");
-    Compiler::unlockMutex(logFile);
     return failureFileName;
   }
 
-  llvm::SmallVector<std::pair<int, const clang::driver::Command *>, 1> failCmd;
-  const auto res = NikiLauda.ExecuteCompilation(*C, failCmd);
-  Compiler::unlockMutex(logFile);
-
   if (exists(llvmIRfileName)) {
     return llvmIRfileName;
   }
@@ -200,14 +217,15 @@ ClangLibCompiler::generateIR(const std::vector<std::filesystem::path> &src,
  * This implementation tries to reuse as much as possible LLVM/Clang APIs.
  * Unfortunatly there is no driver for accessing easily `opt`, like there is
  * for clang.
- * Therefore, this method is just an adapted copy of the original `opt`.
- * It supports all the options of `opt` but the ones related to output
- * management.
+ * Therefore, this method mimics the original `opt`.
+ * It supports the subset of `opt` options handled by
+ * vc::parseOptimizerOptions (see NewPMDriver.h).
  * It is a constraint for this method to generate a well-formed output file.
  * If this method is not able to generate a well-formed optimized output file,
  * it will return an empty path string as generated failureFileName.
  *
- * This method only supports the legacy pass manager.
+ * This method relies on the new pass manager. The options are parsed into a
+ * per-call configuration, hence it is reentrant.
  */
 std::filesystem::path
 ClangLibCompiler::runOptimizer(const std::filesystem::path &src_IR,
@@ -230,330 +248,89 @@ ClangLibCompiler::runOptimizer(const std::filesystem::path &src_IR,
     return;
   };
 
-  llvm::LLVMContext optContext;
+  if (isCancelled(versionID)) {
+    report_error("compilation cancelled");
+    return failureFileName;
+  }
+
   const std::vector<std::string> &argv_owner = getArgV(options);
-  const size_t argc = argv_owner.size() + 1; // opt <options>
-  std::vector<const char *> argv;
-  std::string log_str =
-      std::filesystem::u8path(OPT_EXE_FULLPATH).c_str(); // "opt(-version) "...
+  std::string log_str = std::filesystem::u8path(OPT_EXE_FULLPATH).string(); // "opt "...
   log_str += " ";
-  argv.reserve(argc);
-  argv.push_back(std::move(std::filesystem::u8path(OPT_EXE_FULLPATH).c_str()));
   for (const auto &arg : argv_owner) {
-    argv.push_back(arg.c_str());
     log_str = log_str + arg + " ";
   }
   Compiler::log_string(log_str);
 
-  // command line options are static and should be accessed exclusively
-  opt_parse_mtx.lock();
-
-  resetOptOptions();
-  llvm::cl::ParseCommandLineOptions(argc,
-                                    const_cast<const char **>(argv.data()),
-                                    "ClangLibCompiler::runOptimizer");
-
-  optContext.setDiscardValueNames(DiscardValueNames);
-  if (!DisableDITypeMap) {
-    optContext.enableDebugTypeODRUniquing();
-  }
-
-  // load llvm::Module
-  llvm::SMDiagnostic parsingInputErrorCode;
-  auto module =
-      llvm::parseIRFile(src_IR.string(), parsingInputErrorCode, optContext);
-  if (!module) {
-    std::string parsing_error_str;
-    llvm::raw_string_ostream s_ostream(parsing_error_str);
-    parsingInputErrorCode.print(argv[0], s_ostream);
-    report_error("Unable to load module from source file\n" + s_ostream.str());
-    if (!Compiler::exists(src_IR)) {
-      report_error("Cannot find source file " + src_IR.string());
-    }
+  // per-call configuration: no process-wide option is touched, so several
+  // optimizer runs can proceed concurrently
+  vc::OptimizerConfig config;
+  std::string error_str;
+  if (!vc::parseOptimizerOptions(argv_owner, config, error_str)) {
+    report_error(error_str);
     return failureFileName;
   }
-
-  // Strip debug info before running the verifier.
-  if (StripDebug) {
-    llvm::StripDebugInfo(*module);
-  }
-
-  // Immediately run the verifier to catch any problems before starting up the
-  // pass pipelines.  Otherwise we can crash on broken code during
-  // doInitialization().
-  if (!NoVerify && llvm::verifyModule(*module, &llvm::errs())) {
-    report_error("Verifier check fail: input module is broken!\n");
-    return failureFileName;
-  }
-
-  // If we are supposed to override the target triple, do so now.
-  if (!TargetTriple.empty()) {
-    module->setTargetTriple(llvm::Triple::normalize(TargetTriple));
+  for (const auto &ignored : config.Ignored) {
+    Compiler::log_string("ClangLibCompiler::runOptimizer ignoring option " + ignored);
   }
 
-  // retrieve module triple and prepare Target Machine object (may be empty)
-  llvm::Triple moduleTriple(module->getTargetTriple());
-  std::string optCPUStr, optFeaturesStr;
-  llvm::TargetMachine *optTMachine = nullptr;
-
-  const llvm::TargetOptions Options = llvm::TargetOptions();
-  optCPUStr = sys::getHostCPUName().str();
-#if LLVM_VERSION_MAJOR < 19
-  // on LLVM 19 and later, getHostCPUFeatures returns StringMap<bool> directly,
-  // while on LLVM 18 and earlier it gets its return value as a passed argument
-  llvm::StringMap<bool> features;
-  llvm::sys::getHostCPUFeatures(features);
-#else
-  llvm::StringMap<bool> features = llvm::sys::getHostCPUFeatures();
-#endif
-   // llvm static helper function
-   std::string lookupError;
-   if (moduleTriple.getArch()) {
-     optCPUStr = sys::getHostCPUName().str();
-    std::string featuresStr;
-    for (const auto &feature : features) {
-      if (feature.second) {
-        if (!featuresStr.empty())
-          featuresStr += ",";
-        featuresStr += feature.first().str();
+  // in-memory pipeline: the module is transformed in place
+  std::shared_ptr<InMemoryModule> inMemory = findModule(versionID);
+  if (inMemory) {
+    inMemory->optLevel = config.OptLevel;
+    if (!_keepIntermediateFiles) {
+      config.OK = llvm::opt_tool::OK_NoOutput;
+      if (!vc::runPassPipeline(*inMemory->module, config, llvm::nulls(),
+                               error_str)) {
+        report_error(error_str);
+        return failureFileName;
       }
+      return optBCfilename;
     }
-    optFeaturesStr = featuresStr;
   }
-#if LLVM_VERSION_MAJOR < 15
-  const llvm::Target *TheTarget = llvm::TargetRegistry::lookupTarget(
-      llvm::codegen::getMArch(), moduleTriple, lookupError);
-#else
-  const llvm::Target *TheTarget = llvm::TargetRegistry::lookupTarget(
-      "", moduleTriple, lookupError);
-#endif
-  // Some modules don't specify a triple, and this is okay.
-  if (!TheTarget) {
-    optTMachine = nullptr;
-  } else {
-    // llvm::codegen::getCodeModel returns zero (casted to Tiny), which is wrong!
-    // Going with small which is the default model for majority of supported targets
-    #if LLVM_VERSION_MAJOR < 17
-      llvm::Optional<Reloc::Model> reloc = llvm::Optional<Reloc::Model>(Reloc::Model::Static);
-      llvm::Optional<CodeModel::Model> code_model = llvm::Optional<CodeModel::Model>(CodeModel::Model::Small);
-    #else
-      std::optional<Reloc::Model> reloc = std::make_optional<Reloc::Model>(Reloc::Model::Static);
-      std::optional<CodeModel::Model> code_model = std::make_optional<CodeModel::Model>(CodeModel::Model::Small);
-    #endif
-    optTMachine = TheTarget->createTargetMachine(
-        moduleTriple.getTriple(), optCPUStr, optFeaturesStr, Options,
-        reloc,
-        code_model,
-        GetCodeGenOptLevel());
-  }
-
-  std::unique_ptr<llvm::TargetMachine> actualTM(optTMachine);
-  
-  // Create a PassManager to hold and optimize the collection of passes we are
-  // about to build.
-  llvm::legacy::PassManager Passes;
-
-  // Add an appropriate TargetLibraryInfo pass for the module's triple.
-  llvm::TargetLibraryInfoImpl TLII(moduleTriple);
-
-  // The -disable-simplify-libcalls flag actually disables all builtin optzns.
-  if (DisableSimplifyLibCalls) {
-    TLII.disableAllFunctions();
-  }
-  Passes.add(new llvm::TargetLibraryInfoWrapperPass(TLII));
-
-  // Add an appropriate DataLayout instance for this module.
-  const llvm::DataLayout &DL = module->getDataLayout();
-  if (DL.isDefault() && !DefaultDataLayout.empty()) {
-    module->setDataLayout(DefaultDataLayout);
-  }
-
-  // Add internal analysis passes from the target machine.
-  Passes.add(llvm::createTargetTransformInfoWrapperPass(
-      (actualTM) ? actualTM->getTargetIRAnalysis() : llvm::TargetIRAnalysis()));
-
-  std::unique_ptr<llvm::legacy::FunctionPassManager> FPasses;
-  if (OptLevelO0 || OptLevelO1 || OptLevelO2 || OptLevelOs || OptLevelOz ||
-      OptLevelO3) {
-    FPasses.reset(new llvm::legacy::FunctionPassManager(module.get()));
-    FPasses->add(llvm::createTargetTransformInfoWrapperPass(
-        actualTM ? actualTM->getTargetIRAnalysis() : llvm::TargetIRAnalysis()));
-  }
-
-  // Create a new optimization pass for each one specified on the command line
-  for (uint64_t i = 0; i < PassList.size(); ++i) {
-    if (StandardLinkOpts &&
-        StandardLinkOpts.getPosition() < PassList.getPosition(i)) {
-      AddStandardLinkPasses(Passes);
-      StandardLinkOpts = false;
-    }
-    if (OptLevelO0 && OptLevelO0.getPosition() < PassList.getPosition(i)) {
-      AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 0, 0);
-      OptLevelO0 = false;
-    }
-    if (OptLevelO1 && OptLevelO1.getPosition() < PassList.getPosition(i)) {
-      AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 1, 0);
-      OptLevelO1 = false;
-    }
-    if (OptLevelO2 && OptLevelO2.getPosition() < PassList.getPosition(i)) {
-      AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 2, 0);
-      OptLevelO2 = false;
-    }
-    if (OptLevelOs && OptLevelOs.getPosition() < PassList.getPosition(i)) {
-      AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 2, 1);
-      OptLevelOs = false;
-    }
-    if (OptLevelOz && OptLevelOz.getPosition() < PassList.getPosition(i)) {
-      AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 2, 2);
-      OptLevelOz = false;
-    }
-    if (OptLevelO3 && OptLevelO3.getPosition() < PassList.getPosition(i)) {
-      AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 3, 0);
-      OptLevelO3 = false;
-    }
 
-    const llvm::PassInfo *PassInf = PassList[i];
-    llvm::Pass *P = nullptr;
-    if (PassInf->getNormalCtor()) {
-      P = PassInf->getNormalCtor()();
-    } else {
-      report_error("Cannot create pass: " +
-                   std::string(PassInf->getPassName()));
-    }
-    if (P) {
-      llvm::PassKind Kind = P->getPassKind();
-      addPass(Passes, P);
-    }
-  } // end for each pass in PassList
-
-  // now add standard presets of optimization passes
-  if (StandardLinkOpts) {
-    AddStandardLinkPasses(Passes);
-    StandardLinkOpts = false;
-  }
-  if (OptLevelO0) {
-    AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 0, 0);
-  }
-  if (OptLevelO1) {
-    AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 1, 0);
-  }
-  if (OptLevelO2) {
-    AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 2, 0);
-  }
-  if (OptLevelOs) {
-    AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 2, 1);
-  }
-  if (OptLevelOz) {
-    AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 2, 2);
-  }
-  if (OptLevelO3) {
-    AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 3, 0);
-  }
+  llvm::LLVMContext optContext;
+  std::unique_ptr<llvm::Module> loadedModule;
+  llvm::Module *module = nullptr;
+  if (inMemory) {
+    module = inMemory->module.get();
+  } else {
+    optContext.setDiscardValueNames(config.DiscardValueNames);
+    optContext.enableDebugTypeODRUniquing();
 
-  // run function passes
-  if (FPasses) {
-    FPasses->doInitialization();
-    for (llvm::Function &F : *module) {
-      FPasses->run(F);
+    // load llvm::Module
+    llvm::SMDiagnostic parsingInputErrorCode;
+    loadedModule =
+        llvm::parseIRFile(src_IR.string(), parsingInputErrorCode, optContext);
+    if (!loadedModule) {
+      std::string parsing_error_str;
+      llvm::raw_string_ostream s_ostream(parsing_error_str);
+      parsingInputErrorCode.print(OPT_EXE_FULLPATH, s_ostream);
+      report_error("Unable to load module from source file\n" +
+                   s_ostream.str());
+      if (!Compiler::exists(src_IR)) {
+        report_error("Cannot find source file " + src_IR.string());
+      }
+      return failureFileName;
     }
-    FPasses->doFinalization();
-  }
-
-  // Check that the module is well formed on completion of optimization
-  if (!NoVerify && !VerifyEach) {
-    Passes.add(llvm::createVerifierPass());
+    module = loadedModule.get();
   }
 
   std::error_code outFileCreationErrorCode;
-  std::unique_ptr<llvm::ToolOutputFile> Out =
-      std::make_unique<llvm::ToolOutputFile>(optBCfilename.c_str(),
-                                             outFileCreationErrorCode,
-                                             llvm::sys::fs::OF_None);
-  if (!Out) {
-    report_error("Could not create output file");
+  llvm::ToolOutputFile Out(optBCfilename.c_str(), outFileCreationErrorCode,
+                           llvm::sys::fs::OF_None);
+  if (outFileCreationErrorCode) {
+    report_error("Could not create output file: " +
+                 outFileCreationErrorCode.message());
     return failureFileName;
   }
 
-  // In run twice mode, we want to make sure the output is bit-by-bit
-  // equivalent if we run the pass manager again, so setup two buffers and
-  // a stream to write to them.
-  llvm::SmallVector<char, 0> Buffer;
-  llvm::SmallVector<char, 0> CompileTwiceBuffer;
-  std::unique_ptr<llvm::raw_svector_ostream> BOS;
-  llvm::raw_ostream *OS = nullptr;
-
-  // Write bitcode or assembly to the output as the last step...
-  OS = &Out->os();
-  if (RunTwice) {
-    BOS = std::make_unique<llvm::raw_svector_ostream>(Buffer);
-    OS = BOS.get();
-  }
-  if (OutputAssembly) {
-    if (EmitSummaryIndex) {
-      report_error("Text output is incompatible with -module-summary");
-    }
-    if (EmitModuleHash) {
-      report_error("Text output is incompatible with -module-hash");
-    }
-    Passes.add(createPrintModulePass(*OS, "", PreserveAssemblyUseListOrder));
-  } 
-#if LLVM_VERSION_MAJOR < 16
-  else if (OutputThinLTOBC) {
-    Passes.add(createWriteThinLTOBitcodePass(*OS));
-  } 
-#endif
-  else {
-#if LLVM_VERSION_MAJOR < 18
-    Passes.add(createBitcodeWriterPass(*OS, PreserveBitcodeUseListOrder,
-                                       EmitSummaryIndex, EmitModuleHash));
-#else
-    Passes.add(createBitcodeWriterPass(*OS, PreserveBitcodeUseListOrder));
-#endif
-  }
-
-#ifdef VC_DEBUG
-  // Before executing passes, print the final values of the LLVM options.
-  llvm::cl::PrintOptionValues();
-#endif
-
-  // If requested, run all passes again with the same pass manager to catch
-  // bugs caused by persistent state in the passes
-  if (RunTwice) {
-    std::unique_ptr<llvm::Module> module2(llvm::CloneModule(*module));
-    Passes.run(*module2);
-    CompileTwiceBuffer = Buffer;
-    Buffer.clear();
-  }
-
-  // Now that we have all of the passes ready, run them.
-  Passes.run(*module);
-
-  // Compare the two outputs and make sure they're the same
-  if (RunTwice) {
-    if (Buffer.size() != CompileTwiceBuffer.size() ||
-        (memcmp(Buffer.data(), CompileTwiceBuffer.data(), Buffer.size()) !=
-         0)) {
-      // running twice the same passes generated diverging bitcode versions
-      const std::string error_message =
-          "Running the pass manager twice changed the output.\n"
-          "Writing the result of the second run to the specified output.\n"
-          "To generate the one-run comparison binary, just run without\n"
-          "the compile-twice option\n";
-      report_error(error_message);
-      Out->os() << BOS->str();
-      Out->keep();
-      if (Compiler::exists(optBCfilename)) {
-        return optBCfilename;
-      }
-      return failureFileName;
-    } // end if divengent bitcodes
-    Out->os() << BOS->str();
+  if (!vc::runPassPipeline(*module, config, Out.os(), error_str)) {
+    report_error(error_str);
+    return failureFileName;
   }
 
-  opt_parse_mtx.unlock();
-
   // Declare success.
-  Out->keep();
+  Out.keep();
   if (Compiler::exists(optBCfilename)) {
     return optBCfilename;
   }
@@ -567,6 +344,8 @@ ClangLibCompiler::runOptimizer(const std::filesystem::path &src_IR,
  *
  * This implementation exploits the clang driver to handle all the stages of
  * the compilation and linking process.
+ * In-memory modules and sources are compiled in-process to object files,
+ * which are then linked by the driver.
  */
 std::filesystem::path
 ClangLibCompiler::generateBin(const std::vector<std::filesystem::path> &src,
@@ -590,6 +369,93 @@ ClangLibCompiler::generateBin(const std::vector<std::filesystem::path> &src,
     return;
   };
 
+  if (isCancelled(versionID)) {
+    report_error("compilation cancelled");
+    return failureFileName;
+  }
+
+  // create a local copy of option strings
+  const auto &argv_owner = getArgV(options);
+  std::vector<const char *> argv;
+  argv.reserve(argv_owner.size());
+  for (const auto &arg : argv_owner) {
+    argv.push_back(arg.c_str());
+  }
+
+  // object files generated in-process, linked by the driver
+  std::vector<std::filesystem::path> objFileNames;
+  auto emitObject = [&](const InMemoryModule &m, unsigned optLevel) {
+    llvm::SmallVector<char, 0> objBuffer;
+    std::string error_str;
+    if (!vc::emitObjectCode(*m.module, optLevel, objBuffer, error_str)) {
+      report_error(error_str);
+      return std::filesystem::path();
+    }
+    const std::filesystem::path objFileName =
+        libWorkingDirectory /
+        ("obj_" + versionID + "_" + std::to_string(objFileNames.size()) +
+         ".o");
+    std::ofstream objFile(objFileName, std::ios::binary);
+    objFile.write(objBuffer.data(), objBuffer.size());
+    objFile.close();
+    objFileNames.push_back(objFileName);
+    if (!objFile) {
+      report_error("Unable to write " + objFileName.string());
+      return std::filesystem::path();
+    }
+    return objFileName;
+  };
+  auto removeObjects = [&]() {
+    if (!_keepIntermediateFiles) {
+      for (const auto &objFileName : objFileNames) {
+        std::error_code ec;
+        std::filesystem::remove(objFileName, ec);
+      }
+    }
+  };
+
+  std::vector<std::filesystem::path> inputs = src;
+  if (std::shared_ptr<InMemoryModule> m = findModule(versionID, true)) {
+    // in-memory pipeline: emit the object code straight from the module
+    const std::filesystem::path objFileName = emitObject(*m, m->optLevel);
+    if (objFileName.empty()) {
+      removeObjects();
+      return failureFileName;
+    }
+    inputs = {objFileName};
+  } else if (hasSourceBuffers(versionID)) {
+    // in-memory sources are compiled one by one by the in-process frontend
+    const unsigned optLevel = getOptLevel(argv_owner);
+    for (auto &input : inputs) {
+      if (!getSourceBuffer(versionID, input)) {
+        continue;
+      }
+      std::vector<const char *> frontend_cmd = {"clang", "-c", "-fpic",
+                                                "-Wno-return-type-c-linkage"};
+      frontend_cmd.insert(frontend_cmd.end(), argv.begin(), argv.end());
+      frontend_cmd.push_back(input.c_str());
+      InMemoryModule object;
+      bool unsupported = false;
+      if (!runFrontend(frontend_cmd, versionID, {input}, object,
+                       unsupported)) {
+        report_error("Unable to compile in-memory source " + input.string());
+        removeObjects();
+        return failureFileName;
+      }
+      const std::filesystem::path objFileName = emitObject(object, optLevel);
+      if (objFileName.empty()) {
+        removeObjects();
+        return failureFileName;
+      }
+      input = objFileName;
+    }
+  }
+  if (isCancelled(versionID)) {
+    report_error("compilation cancelled");
+    removeObjects();
+    return failureFileName;
+  }
+
   // clang++ <options> -fpic -shared src -olibFileName
   // -Wno-return-type-c-linkage
   std::vector<const char *> cmd_str;
@@ -601,15 +467,16 @@ ClangLibCompiler::generateBin(const std::vector<std::filesystem::path> &src,
   const std::string outputArgument = "-o" + libFileName.string();
   cmd_str.push_back(std::move(outputArgument).c_str());
 
-  // create a local copy of option strings
-  const auto &argv_owner = getArgV(options);
-  std::vector<const char *> argv;
-  argv.reserve(argv_owner.size());
-  for (const auto &arg : argv_owner) {
-    argv.push_back(arg.c_str());
-  }
   cmd_str.insert(cmd_str.end(), argv.begin(), argv.end());
-  for (const auto &src_file : src) {
+  // only the functions of the Version are exported
+  const std::filesystem::path exportMap = writeExportMap(func, versionID);
+  const std::string exportArgument =
+      "-Wl,--version-script=" + exportMap.string();
+  if (!exportMap.empty()) {
+    cmd_str.push_back(exportArgument.c_str());
+    objFileNames.push_back(exportMap); // removed along with the objects
+  }
+  for (const auto &src_file : inputs) {
     cmd_str.push_back(src_file.c_str());
   }
 
@@ -619,28 +486,15 @@ ClangLibCompiler::generateBin(const std::vector<std::filesystem::path> &src,
   }
   Compiler::log_string(log_str);
 
-  clang::driver::Driver NikiLauda(_llvmManager->getClangExePath().string(),
-                           _llvmManager->getDefaultTriple()->str(),
-                           *_diagEngine);
-  NikiLauda.setTitle("clang as a library");
-  NikiLauda.setCheckInputsExist(false);
-  NikiLauda.CCPrintOptionsFilename = logFile.c_str();
-#ifdef VC_DEBUG
-  NikiLauda.CCPrintOptions = true;
-#else
-  NikiLauda.CCPrintOptions = false;
-#endif
-
-  std::unique_ptr<clang::driver::Compilation> C(NikiLauda.BuildCompilation(cmd_str));
-  if (!C) {
+  int res = 0;
+  if (!runDriver(cmd_str, res)) {
     report_error("clang::driver::Compilation not created");
+    removeObjects();
     return failureFileName;
   }
+  removeObjects();
 
-  llvm::SmallVector<std::pair<int, const clang::driver::Command *>, 1> failCmd;
-  const auto res = NikiLauda.ExecuteCompilation(*C, failCmd);
-
-  if (exists(libFileName)) {
+  if (existsNotEmpty(libFileName)) {
     return libFileName;
   }
   const std::string &error_str = "Unknown error:"
@@ -669,6 +523,228 @@ inline std::string ClangLibCompiler::getOptionString(const Option &o) const {
   return o.getPrefix() + tmp_val;
 }
 
+// ---------------------------------------------------------------------------
+// --------------------------- getCompilerVersion ----------------------------
+// ---------------------------------------------------------------------------
+std::string ClangLibCompiler::getCompilerVersion() const {
+  return clang::getClangFullVersion();
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------ mergeProfiles ------------------------------
+// ---------------------------------------------------------------------------
+bool ClangLibCompiler::mergeProfiles(
+    const std::vector<std::filesystem::path> &rawProfiles,
+    const std::filesystem::path &profile) {
+  llvm::InstrProfWriter writer;
+  bool ok = true;
+  for (const auto &raw : rawProfiles) {
+#if LLVM_VERSION_MAJOR >= 16
+    auto reader = llvm::InstrProfReader::create(
+        raw.string(), *llvm::vfs::getRealFileSystem());
+#else
+    auto reader = llvm::InstrProfReader::create(raw.string());
+#endif
+    if (!reader) {
+      log_string("cannot read profile " + raw.string() + ": " +
+                 llvm::toString(reader.takeError()));
+      return false;
+    }
+    if (llvm::Error e = writer.mergeProfileKind((*reader)->getProfileKind())) {
+      log_string("incompatible profile " + raw.string() + ": " +
+                 llvm::toString(std::move(e)));
+      return false;
+    }
+    for (auto &record : **reader) {
+      writer.addRecord(std::move(record), 1, [&](llvm::Error e) {
+        log_string("cannot merge " + raw.string() + ": " +
+                   llvm::toString(std::move(e)));
+        ok = false;
+      });
+    }
+    if ((*reader)->hasError()) {
+      log_string("cannot read profile " + raw.string() + ": " +
+                 llvm::toString((*reader)->getError()));
+      return false;
+    }
+  }
+  std::error_code ec;
+  llvm::raw_fd_ostream os(profile.string(), ec, llvm::sys::fs::OF_None);
+  if (ec) {
+    log_string("cannot write profile " + profile.string());
+    return false;
+  }
+  if (llvm::Error e = writer.write(os)) {
+    log_string("cannot write profile " + profile.string() + ": " +
+               llvm::toString(std::move(e)));
+    return false;
+  }
+  return ok;
+}
+
+// ---------------------------------------------------------------------------
+// -------------------------------- runDriver --------------------------------
+// ---------------------------------------------------------------------------
+bool ClangLibCompiler::runDriver(const std::vector<const char *> &cmd_str,
+                    int &result) const {
+  // private diagnostics, nothing is written to the log during the compilation
+  llvm::IntrusiveRefCntPtr<clang::DiagnosticOptions> diagnosticOptions =
+      new clang::DiagnosticOptions();
+  llvm::IntrusiveRefCntPtr<clang::DiagnosticIDs> diagnosticIDs =
+      new clang::DiagnosticIDs();
+  vc::FileLogDiagnosticConsumer diagConsumer(std::filesystem::u8path(""),
+                                             diagnosticOptions.get());
+  clang::DiagnosticsEngine diagEngine(diagnosticIDs, diagnosticOptions.get(),
+                                      &diagConsumer, false);
+
+  clang::driver::Driver NikiLauda(_llvmManager->getClangExePath().string(),
+                                  _llvmManager->getDefaultTriple()->str(),
+                                  diagEngine);
+  NikiLauda.setTitle("clang as a library");
+  NikiLauda.setCheckInputsExist(false);
+  NikiLauda.CCPrintOptions = false;
+
+  std::unique_ptr<clang::driver::Compilation> C(
+      NikiLauda.BuildCompilation(cmd_str));
+  if (!C) {
+    Compiler::log_string(diagConsumer.takeEntries());
+    return false;
+  }
+#ifdef VC_DEBUG
+  // replaces CCPrintOptions, which writes to the log file while compiling
+  std::string jobs_str;
+  llvm::raw_string_ostream jobs_stream(jobs_str);
+  C->getJobs().Print(jobs_stream, "\n", true);
+  Compiler::log_string(jobs_stream.str());
+#endif
+
+  llvm::SmallVector<std::pair<int, const clang::driver::Command *>, 1> failCmd;
+  result = NikiLauda.ExecuteCompilation(*C, failCmd);
+  const std::string diagnostics = diagConsumer.takeEntries();
+  if (!diagnostics.empty()) {
+    Compiler::log_string(diagnostics);
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------- enableInMemoryPipeline --------------------------
+// ---------------------------------------------------------------------------
+void ClangLibCompiler::enableInMemoryPipeline(bool keepIntermediateFiles) {
+  _inMemoryPipeline = true;
+  _keepIntermediateFiles = keepIntermediateFiles;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------ isInMemoryPipelineEnabled ------------------------
+// ---------------------------------------------------------------------------
+bool ClangLibCompiler::isInMemoryPipelineEnabled() const {
+  return _inMemoryPipeline;
+}
+
+// ---------------------------------------------------------------------------
+// ----------------------------- releaseVersion ------------------------------
+// ---------------------------------------------------------------------------
+void ClangLibCompiler::releaseVersion(const std::string &versionID) {
+  findModule(versionID, true);
+  Compiler::releaseVersion(versionID);
+}
+
+// ---------------------------------------------------------------------------
+// ----------------------------- hasInMemoryIR -------------------------------
+// ---------------------------------------------------------------------------
+bool ClangLibCompiler::hasInMemoryIR(const std::string &versionID) const {
+  return !_keepIntermediateFiles && findModule(versionID) != nullptr;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------- runFrontend -------------------------------
+// ---------------------------------------------------------------------------
+bool ClangLibCompiler::runFrontend(const std::vector<const char *> &cmd_str,
+                                   const std::string &versionID,
+                                   const std::vector<std::filesystem::path> &src,
+                                   InMemoryModule &result,
+                                   bool &unsupported) const {
+  // in-memory sources are served through a virtual file system
+  source_buffer_map_t buffers;
+  for (const auto &src_file : src) {
+    if (auto buffer = getSourceBuffer(versionID, src_file)) {
+      buffers[src_file] = buffer;
+    }
+  }
+  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs = nullptr;
+  if (!buffers.empty()) {
+    fs = vc::createSourceFileSystem(buffers);
+  }
+
+  std::vector<const char *> args(cmd_str);
+  args[0] = _llvmManager->getClangExePath().c_str();
+  std::string diagnostics;
+  result.context = std::make_unique<llvm::LLVMContext>();
+  result.module = vc::runClangFrontend(args, *result.context, fs, diagnostics,
+                                       unsupported);
+  if (!diagnostics.empty()) {
+    Compiler::log_string(diagnostics);
+  }
+  return result.module != nullptr;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------- findModule --------------------------------
+// ---------------------------------------------------------------------------
+std::shared_ptr<ClangLibCompiler::InMemoryModule>
+ClangLibCompiler::findModule(const std::string &versionID, bool remove) const {
+  std::lock_guard<std::mutex> lock(_modules_mtx);
+  auto it = _modules.find(versionID);
+  if (it == _modules.end()) {
+    return nullptr;
+  }
+  std::shared_ptr<InMemoryModule> m = it->second;
+  if (remove) {
+    _modules.erase(it);
+  }
+  return m;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------ writeBitcode -------------------------------
+// ---------------------------------------------------------------------------
+bool ClangLibCompiler::writeBitcode(const llvm::Module &module,
+                                    const std::filesystem::path &fileName) const {
+  std::error_code ec;
+  llvm::raw_fd_ostream out(fileName.string(), ec, llvm::sys::fs::OF_None);
+  if (ec) {
+    return false;
+  }
+  llvm::WriteBitcodeToFile(module, out);
+  out.close();
+  return !out.has_error();
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------- getOptLevel -------------------------------
+// ---------------------------------------------------------------------------
+unsigned
+ClangLibCompiler::getOptLevel(const std::vector<std::string> &argv) const {
+  unsigned optLevel = 0;
+  for (const auto &arg : argv) {
+    if (arg.size() < 2 || arg.compare(0, 2, "-O") != 0) {
+      continue;
+    }
+    const std::string level = arg.substr(2);
+    if (level == "0") {
+      optLevel = 0;
+    } else if (level.empty() || level == "1" || level == "g") {
+      optLevel = 1;
+    } else if (level == "2" || level == "s" || level == "z") {
+      optLevel = 2;
+    } else {
+      optLevel = 3;
+    }
+  }
+  return optLevel;
+}
+
 // ---------------------------------------------------------------------------
 // --------------------------------- getArgV ---------------------------------
 // ---------------------------------------------------------------------------
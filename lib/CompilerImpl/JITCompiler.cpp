@@ -29,6 +29,7 @@
  */
 #include "versioningCompiler/CompilerImpl/JITCompiler.hpp"
 #include "versioningCompiler/CompilerImpl/ClangLLVM/FileLogDiagnosticConsumer.hpp"
+#include "versioningCompiler/CompilerImpl/ClangLLVM/InProcessFrontend.hpp"
 #include "versioningCompiler/CompilerImpl/ClangLLVM/OptUtils.hpp" // opt stuff
 #include "versioningCompiler/DebugUtils.hpp"
 
@@ -40,10 +41,12 @@
 #include "clang/Driver/Job.h"
 #include "clang/Frontend/CompilerInvocation.h"
 #include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
 #include "llvm/TargetParser/Host.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 
@@ -56,8 +59,6 @@
 using namespace vc;
 using namespace clang;
 
-// static mutex object initialization
-std::mutex JITCompiler::opt_parse_mtx;
 
 // ----------------------------------------------------------------------------
 // --------------------------- detailed constructor ---------------------------
@@ -87,14 +88,6 @@ JITCompiler::JITCompiler(const std::string &compilerID,
   std::cout << "Constructing compiler object.." << std::endl;
   _llvmManager = LLVMInstanceManager::getInstance();
 
-  // custom diagnostic engine creation
-  _diagnosticOptions = new clang::DiagnosticOptions();
-  _diagnosticIDs = new clang::DiagnosticIDs();
-  _diagConsumer = std::make_shared<vc::FileLogDiagnosticConsumer>(
-      log, _diagnosticOptions.get());
-  _diagEngine = new clang::DiagnosticsEngine(
-      _diagnosticIDs, _diagnosticOptions.get(), _diagConsumer.get(), false);
-
   // initialize JIT objects
   llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
 
@@ -166,30 +159,47 @@ JITCompiler::generateIR(const std::vector<std::filesystem::path> &src,
   }
   Compiler::log_string(log_str);
 
-  clang::driver::Driver NikiLauda(_llvmManager->getClangExePath().string(),
-                           _llvmManager->getDefaultTriple()->str(),
-                           *_diagEngine);
-  NikiLauda.setTitle("clang as a library");
-  NikiLauda.setCheckInputsExist(false);
-  NikiLauda.CCPrintOptionsFilename = logFile.c_str();
-  Compiler::lockMutex(logFile);
-#ifdef VC_DEBUG
-  NikiLauda.CCPrintOptions = true;
-#else
-  NikiLauda.CCPrintOptions = false;
-#endif
+  if (hasSourceBuffers(versionID)) {
+    // in-memory sources are read by the in-process frontend
+    source_buffer_map_t buffers;
+    for (const auto &src_file : src) {
+      if (auto buffer = getSourceBuffer(versionID, src_file)) {
+        buffers[src_file] = buffer;
+      }
+    }
+    llvm::LLVMContext context;
+    std::string diagnostics;
+    bool unsupported = false;
+    std::unique_ptr<llvm::Module> module =
+        vc::runClangFrontend(cmd_str, context, createSourceFileSystem(buffers),
+                             diagnostics, unsupported);
+    if (!diagnostics.empty()) {
+      Compiler::log_string(diagnostics);
+    }
+    if (!module) {
+      report_error(unsupported
+                       ? "In-memory sources require a single translation unit"
+                       : "In-memory frontend failed");
+      return failureFileName;
+    }
+    std::error_code ec;
+    llvm::raw_fd_ostream out(llvmIRfileName.string(), ec,
+                             llvm::sys::fs::OF_None);
+    if (ec) {
+      report_error("Unable to write " + llvmIRfileName.string());
+      return failureFileName;
+    }
+    llvm::WriteBitcodeToFile(*module, out);
+    out.close();
+    return llvmIRfileName;
+  }
 
-  std::unique_ptr<clang::driver::Compilation> C(NikiLauda.BuildCompilation(cmd_str));
-  if (!C) {
+  int res = 0;
+  if (!runDriver(cmd_str, res)) {
     report_error("clang::driver::Compilation not created");
-    Compiler::unlockMutex(logFile);
     return failureFileName;
   }
 
-  llvm::SmallVector<std::pair<int, const clang::driver::Command *>, 1> failCmd;
-  const auto res = NikiLauda.ExecuteCompilation(*C, failCmd);
-  Compiler::unlockMutex(logFile);
-
   if (exists(llvmIRfileName)) {
     return llvmIRfileName;
   }
@@ -215,14 +225,15 @@ JITCompiler::generateIR(const std::vector<std::filesystem::path> &src,
  * This implementation tries to reuse as much as possible LLVM/Clang APIs.
  * Unfortunatly there is no driver for accessing easily `opt`, like there is
  * for clang.
- * Therefore, this method is just an adapted copy of the original `opt`.
- * It supports all the options of `opt` but the ones related to output
- * management.
+ * Therefore, this method mimics the original `opt`.
+ * It supports the subset of `opt` options handled by
+ * vc::parseOptimizerOptions (see NewPMDriver.h).
  * It is a constraint for this method to generate a well-formed output file.
  * If this method is not able to generate a well-formed optimized output file,
  * it will return an empty path string as generated failureFileName.
  *
- * This method only supports the legacy pass manager.
+ * This method relies on the new pass manager. The options are parsed into a
+ * per-call configuration, hence it is reentrant.
  */
 std::filesystem::path
 JITCompiler::runOptimizer(const std::filesystem::path &src_IR,
@@ -245,33 +256,30 @@ JITCompiler::runOptimizer(const std::filesystem::path &src_IR,
     return;
   };
 
-  llvm::LLVMContext optContext;
   const std::vector<std::string> &argv_owner = getArgV(options);
-  const size_t argc = argv_owner.size() + 1; // opt <options>
-  std::vector<const char *> argv;
-  std::string log_str = std::filesystem::u8path(OPT_EXE_NAME).string();
+  std::string log_str = std::filesystem::u8path(OPT_EXE_NAME).string(); // "opt "...
   log_str += " ";
-  argv.reserve(argc);
-  argv.push_back(std::move(std::filesystem::u8path(OPT_EXE_NAME).c_str()));
   for (const auto &arg : argv_owner) {
-    argv.push_back(arg.c_str());
     log_str = log_str + arg + " ";
   }
   Compiler::log_string(log_str);
 
-  // command line options are static and should be accessed exclusively
-  opt_parse_mtx.lock();
-
-  llvm::codegen::RegisterCodeGenFlags();
-  llvm::cl::ParseCommandLineOptions(argc,
-                                    const_cast<const char **>(argv.data()),
-                                    "JITCompiler::runOptimizer");
-
-  optContext.setDiscardValueNames(DiscardValueNames);
-  if (!DisableDITypeMap) {
-    optContext.enableDebugTypeODRUniquing();
+  // per-call configuration: no process-wide option is touched, so several
+  // optimizer runs can proceed concurrently
+  vc::OptimizerConfig config;
+  std::string error_str;
+  if (!vc::parseOptimizerOptions(argv_owner, config, error_str)) {
+    report_error(error_str);
+    return failureFileName;
+  }
+  for (const auto &ignored : config.Ignored) {
+    Compiler::log_string("JITCompiler::runOptimizer ignoring option " + ignored);
   }
 
+  llvm::LLVMContext optContext;
+  optContext.setDiscardValueNames(config.DiscardValueNames);
+  optContext.enableDebugTypeODRUniquing();
+
   // load llvm::Module
   llvm::SMDiagnostic parsingInputErrorCode;
   auto module =
@@ -279,7 +287,7 @@ JITCompiler::runOptimizer(const std::filesystem::path &src_IR,
   if (!module) {
     std::string parsing_error_str;
     llvm::raw_string_ostream s_ostream(parsing_error_str);
-    parsingInputErrorCode.print(argv[0], s_ostream);
+    parsingInputErrorCode.print(OPT_EXE_NAME, s_ostream);
     report_error("Unable to load module from source file\n" + s_ostream.str());
     if (!Compiler::exists(src_IR)) {
       report_error("Cannot find source file " + src_IR.string());
@@ -287,252 +295,22 @@ JITCompiler::runOptimizer(const std::filesystem::path &src_IR,
     return failureFileName;
   }
 
-  // Strip debug info before running the verifier.
-  if (StripDebug) {
-    llvm::StripDebugInfo(*module);
-  }
-
-  // Immediately run the verifier to catch any problems before starting up the
-  // pass pipelines.  Otherwise we can crash on broken code during
-  // doInitialization().
-  if (!NoVerify && llvm::verifyModule(*module, &llvm::errs())) {
-    report_error("Verifier check fail: input module is broken!\n");
-    return failureFileName;
-  }
-
-  // If we are supposed to override the target triple, do so now.
-  if (!TargetTriple.empty()) {
-    module->setTargetTriple(llvm::Triple::normalize(TargetTriple));
-  }
-
-  // retrieve module triple and prepare Target Machine object (may be empty)
-  llvm::Triple moduleTriple(module->getTargetTriple());
-  std::string optCPUStr, optFeaturesStr;
-  llvm::TargetMachine *optTMachine = nullptr;
-  const llvm::TargetOptions Options =
-      llvm::codegen::InitTargetOptionsFromCodeGenFlags(moduleTriple);
-  // llvm static helper function
-  std::string lookupError;
-  if (moduleTriple.getArch()) {
-    optCPUStr = llvm::codegen::getCPUStr(); // llvm static helper function
-    optFeaturesStr =
-        llvm::codegen::getFeaturesStr(); // llvm static helper function
-  }
-  const llvm::Target *TheTarget = llvm::TargetRegistry::lookupTarget(
-      llvm::codegen::getMArch(), moduleTriple, lookupError);
-  // Some modules don't specify a triple, and this is okay.
-  if (!TheTarget) {
-    optTMachine = nullptr;
-  } else {
-    optTMachine = TheTarget->createTargetMachine(
-        moduleTriple.getTriple(), optCPUStr, optFeaturesStr, Options,
-        llvm::codegen::getRelocModel(),
-        llvm::CodeModel::Small, // llvm::codegen::getCodeModel returns zero
-                                // (casted to Tiny), which is wrong! Going with
-                                // small which is the default model for majority
-                                // of supported targets
-        GetCodeGenOptLevel());
-  }
-  std::unique_ptr<llvm::TargetMachine> actualTM(optTMachine);
-  // Override function attributes based on CPUStr, FeaturesStr,
-  // and command line flags.
-  llvm::codegen::setFunctionAttributes(optCPUStr, optFeaturesStr, *module);
-
-  // Create a PassManager to hold and optimize the collection of passes we are
-  // about to build.
-  llvm::legacy::PassManager Passes;
-
-  // Add an appropriate TargetLibraryInfo pass for the module's triple.
-  llvm::TargetLibraryInfoImpl TLII(moduleTriple);
-
-  // The -disable-simplify-libcalls flag actually disables all builtin optzns.
-  if (DisableSimplifyLibCalls) {
-    TLII.disableAllFunctions();
-  }
-  Passes.add(new llvm::TargetLibraryInfoWrapperPass(TLII));
-
-  // Add an appropriate DataLayout instance for this module.
-  const llvm::DataLayout &DL = module->getDataLayout();
-  if (DL.isDefault() && !DefaultDataLayout.empty()) {
-    module->setDataLayout(DefaultDataLayout);
-  }
-
-  // Add internal analysis passes from the target machine.
-  Passes.add(llvm::createTargetTransformInfoWrapperPass(
-      (actualTM) ? actualTM->getTargetIRAnalysis() : llvm::TargetIRAnalysis()));
-
-  std::unique_ptr<llvm::legacy::FunctionPassManager> FPasses;
-  if (OptLevelO0 || OptLevelO1 || OptLevelO2 || OptLevelOs || OptLevelOz ||
-      OptLevelO3) {
-    FPasses.reset(new llvm::legacy::FunctionPassManager(module.get()));
-    FPasses->add(llvm::createTargetTransformInfoWrapperPass(
-        actualTM ? actualTM->getTargetIRAnalysis() : llvm::TargetIRAnalysis()));
-  }
-
-  // Create a new optimization pass for each one specified on the command line
-  for (uint64_t i = 0; i < PassList.size(); ++i) {
-    if (StandardLinkOpts &&
-        StandardLinkOpts.getPosition() < PassList.getPosition(i)) {
-      AddStandardLinkPasses(Passes);
-      StandardLinkOpts = false;
-    }
-    if (OptLevelO0 && OptLevelO0.getPosition() < PassList.getPosition(i)) {
-      AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 0, 0);
-      OptLevelO0 = false;
-    }
-    if (OptLevelO1 && OptLevelO1.getPosition() < PassList.getPosition(i)) {
-      AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 1, 0);
-      OptLevelO1 = false;
-    }
-    if (OptLevelO2 && OptLevelO2.getPosition() < PassList.getPosition(i)) {
-      AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 2, 0);
-      OptLevelO2 = false;
-    }
-    if (OptLevelOs && OptLevelOs.getPosition() < PassList.getPosition(i)) {
-      AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 2, 1);
-      OptLevelOs = false;
-    }
-    if (OptLevelOz && OptLevelOz.getPosition() < PassList.getPosition(i)) {
-      AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 2, 2);
-      OptLevelOz = false;
-    }
-    if (OptLevelO3 && OptLevelO3.getPosition() < PassList.getPosition(i)) {
-      AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 3, 0);
-      OptLevelO3 = false;
-    }
-
-    const llvm::PassInfo *PassInf = PassList[i];
-    llvm::Pass *P = nullptr;
-    if (PassInf->getNormalCtor()) {
-      P = PassInf->getNormalCtor()();
-    } else {
-      report_error("Cannot create pass: " +
-                   std::string(PassInf->getPassName()));
-    }
-    if (P) {
-      auto Kind = P->getPassKind();
-      addPass(Passes, P);
-    }
-  } // end for each pass in PassList
-
-  // now add standard presets of optimization passes
-  if (StandardLinkOpts) {
-    AddStandardLinkPasses(Passes);
-    StandardLinkOpts = false;
-  }
-  if (OptLevelO0) {
-    AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 0, 0);
-  }
-  if (OptLevelO1) {
-    AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 1, 0);
-  }
-  if (OptLevelO2) {
-    AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 2, 0);
-  }
-  if (OptLevelOs) {
-    AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 2, 1);
-  }
-  if (OptLevelOz) {
-    AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 2, 2);
-  }
-  if (OptLevelO3) {
-    AddOptimizationPasses(Passes, *FPasses, actualTM.get(), 3, 0);
-  }
-
-  // run function passes
-  if (FPasses) {
-    FPasses->doInitialization();
-    for (llvm::Function &F : *module) {
-      FPasses->run(F);
-    }
-    FPasses->doFinalization();
-  }
-
-  // Check that the module is well formed on completion of optimization
-  if (!NoVerify && !VerifyEach) {
-    Passes.add(llvm::createVerifierPass());
-  }
-
   std::error_code outFileCreationErrorCode;
-  std::unique_ptr<llvm::ToolOutputFile> Out =
-      std::make_unique<llvm::ToolOutputFile>(optBCfilename.c_str(),
-                                             outFileCreationErrorCode,
-                                             llvm::sys::fs::OF_None);
-  if (!Out) {
-    report_error("Could not create output file");
+  llvm::ToolOutputFile Out(optBCfilename.c_str(), outFileCreationErrorCode,
+                           llvm::sys::fs::OF_None);
+  if (outFileCreationErrorCode) {
+    report_error("Could not create output file: " +
+                 outFileCreationErrorCode.message());
     return failureFileName;
   }
 
-  // In run twice mode, we want to make sure the output is bit-by-bit
-  // equivalent if we run the pass manager again, so setup two buffers and
-  // a stream to write to them.
-  llvm::SmallVector<char, 0> Buffer;
-  llvm::SmallVector<char, 0> CompileTwiceBuffer;
-  std::unique_ptr<llvm::raw_svector_ostream> BOS;
-  llvm::raw_ostream *OS = nullptr;
-
-  // Write bitcode or assembly to the output as the last step...
-  OS = &Out->os();
-  if (RunTwice) {
-    BOS = std::make_unique<llvm::raw_svector_ostream>(Buffer);
-    OS = BOS.get();
-  }
-  if (OutputAssembly) {
-    if (EmitSummaryIndex) {
-      report_error("Text output is incompatible with -module-summary");
-    }
-    if (EmitModuleHash) {
-      report_error("Text output is incompatible with -module-hash");
-    }
-    Passes.add(createPrintModulePass(*OS, "", PreserveAssemblyUseListOrder));
-  }
-  else {
-    Passes.add(createBitcodeWriterPass(*OS, PreserveBitcodeUseListOrder));
-  }
-
-#ifdef VC_DEBUG
-  // Before executing passes, print the final values of the LLVM options.
-  llvm::cl::PrintOptionValues();
-#endif
-
-  // If requested, run all passes again with the same pass manager to catch
-  // bugs caused by persistent state in the passes
-  if (RunTwice) {
-    std::unique_ptr<llvm::Module> module2(llvm::CloneModule(*module));
-    Passes.run(*module2);
-    CompileTwiceBuffer = Buffer;
-    Buffer.clear();
-  }
-
-  // Now that we have all of the passes ready, run them.
-  Passes.run(*module);
-
-  // Compare the two outputs and make sure they're the same
-  if (RunTwice) {
-    if (Buffer.size() != CompileTwiceBuffer.size() ||
-        (memcmp(Buffer.data(), CompileTwiceBuffer.data(), Buffer.size()) !=
-         0)) {
-      // running twice the same passes generated diverging bitcode versions
-      const std::string error_message =
-          "Running the pass manager twice changed the output.\n"
-          "Writing the result of the second run to the specified output.\n"
-          "To generate the one-run comparison binary, just run without\n"
-          "the compile-twice option\n";
-      report_error(error_message);
-      Out->os() << BOS->str();
-      Out->keep();
-      if (Compiler::exists(optBCfilename)) {
-        return optBCfilename;
-      }
-      return failureFileName;
-    } // end if divengent bitcodes
-    Out->os() << BOS->str();
+  if (!vc::runPassPipeline(*module, config, Out.os(), error_str)) {
+    report_error(error_str);
+    return failureFileName;
   }
 
-  opt_parse_mtx.unlock();
-
   // Declare success.
-  Out->keep();
+  Out.keep();
   if (Compiler::exists(optBCfilename)) {
     return optBCfilename;
   }
@@ -804,6 +582,111 @@ inline std::string JITCompiler::getOptionString(const Option &o) const {
   return o.getPrefix() + tmp_val;
 }
 
+// ---------------------------------------------------------------------------
+// --------------------------- enableArtifactCache ---------------------------
+// ---------------------------------------------------------------------------
+void JITCompiler::enableArtifactCache(std::chrono::seconds failureTTL) {
+  Compiler::unsupported("JITCompiler::enableArtifactCache: "
+                        "JIT compiled modules are not cached");
+  return;
+}
+
+// ---------------------------------------------------------------------------
+// -------------------------- enableMemoryBinaries ---------------------------
+// ---------------------------------------------------------------------------
+bool JITCompiler::enableMemoryBinaries(bool enable) {
+  // JIT compiled code never goes through a shared object
+  return !enable;
+}
+
+// ---------------------------------------------------------------------------
+// -------------------------- supportsLazySymbols ----------------------------
+// ---------------------------------------------------------------------------
+bool JITCompiler::supportsLazySymbols() const {
+  // symbols are looked up in the JIT session while the module is loaded
+  return false;
+}
+
+// ---------------------------------------------------------------------------
+// -------------------------- prefaultSharedObject ---------------------------
+// ---------------------------------------------------------------------------
+bool JITCompiler::prefaultSharedObject(void *handler) const {
+  // the JIT linker has just written the code and data pages
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// --------------------------- getHugePageOptions ----------------------------
+// ---------------------------------------------------------------------------
+opt_list_t JITCompiler::getHugePageOptions() const { return {}; }
+
+// ---------------------------------------------------------------------------
+// ----------------------------- remapHugePages ------------------------------
+// ---------------------------------------------------------------------------
+bool JITCompiler::remapHugePages(void *handler) {
+  // sections are allocated by the SectionMemoryManager of each module
+  return false;
+}
+
+// ---------------------------------------------------------------------------
+// --------------------------- getFastLoadOptions ----------------------------
+// ---------------------------------------------------------------------------
+opt_list_t JITCompiler::getFastLoadOptions() const { return {}; }
+
+// ---------------------------------------------------------------------------
+// ----------------------- getProfileGenerateOptions -------------------------
+// ---------------------------------------------------------------------------
+opt_list_t
+JITCompiler::getProfileGenerateOptions(const std::string &profileID) const {
+  // the profile runtime is not linked into the JIT session
+  return {};
+}
+
+// ---------------------------------------------------------------------------
+// -------------------------------- runDriver --------------------------------
+// ---------------------------------------------------------------------------
+bool JITCompiler::runDriver(const std::vector<const char *> &cmd_str,
+                    int &result) const {
+  // private diagnostics, nothing is written to the log during the compilation
+  llvm::IntrusiveRefCntPtr<clang::DiagnosticOptions> diagnosticOptions =
+      new clang::DiagnosticOptions();
+  llvm::IntrusiveRefCntPtr<clang::DiagnosticIDs> diagnosticIDs =
+      new clang::DiagnosticIDs();
+  vc::FileLogDiagnosticConsumer diagConsumer(std::filesystem::u8path(""),
+                                             diagnosticOptions.get());
+  clang::DiagnosticsEngine diagEngine(diagnosticIDs, diagnosticOptions.get(),
+                                      &diagConsumer, false);
+
+  clang::driver::Driver NikiLauda(_llvmManager->getClangExePath().string(),
+                                  _llvmManager->getDefaultTriple()->str(),
+                                  diagEngine);
+  NikiLauda.setTitle("clang as a library");
+  NikiLauda.setCheckInputsExist(false);
+  NikiLauda.CCPrintOptions = false;
+
+  std::unique_ptr<clang::driver::Compilation> C(
+      NikiLauda.BuildCompilation(cmd_str));
+  if (!C) {
+    Compiler::log_string(diagConsumer.takeEntries());
+    return false;
+  }
+#ifdef VC_DEBUG
+  // replaces CCPrintOptions, which writes to the log file while compiling
+  std::string jobs_str;
+  llvm::raw_string_ostream jobs_stream(jobs_str);
+  C->getJobs().Print(jobs_stream, "\n", true);
+  Compiler::log_string(jobs_stream.str());
+#endif
+
+  llvm::SmallVector<std::pair<int, const clang::driver::Command *>, 1> failCmd;
+  result = NikiLauda.ExecuteCompilation(*C, failCmd);
+  const std::string diagnostics = diagConsumer.takeEntries();
+  if (!diagnostics.empty()) {
+    Compiler::log_string(diagnostics);
+  }
+  return true;
+}
+
 // ---------------------------------------------------------------------------
 // --------------------------------- getArgV ---------------------------------
 // ---------------------------------------------------------------------------
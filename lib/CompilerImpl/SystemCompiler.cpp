@@ -20,6 +20,9 @@
  */
 #include "versioningCompiler/CompilerImpl/SystemCompiler.hpp"
 
+#include <cstdio>
+#include <fstream>
+
 #ifndef DEFAULT_COMPILER_DIR
 #define DEFAULT_COMPILER_DIR "/usr/bin"
 #endif
@@ -65,18 +68,22 @@ SystemCompiler::generateIR(const std::vector<std::filesystem::path> &src,
                            const opt_list_t options) {
   // NO LLVM-IR support enabled by default
   if (hasIRSupport()) {
-    // system call - command construction
-    std::string command = (installDirectory / callString).string();
+    // process launch - argument vector construction
+    std::vector<std::string> argv =
+        ProcessLauncher::tokenize((installDirectory / callString).string());
     std::string IRFile = Compiler::getBitcodeFileName(versionID);
-    command = command + " -c -emit-llvm -o " + IRFile;
+    argv.insert(argv.end(), {"-c", "-emit-llvm", "-o", IRFile});
     // does not work with gcc
-    for (auto &o : options) {
-      command = command + " " + getOptionString(o);
-    }
-    for (const auto &src_file : src) {
-      command = command + " " + src_file.string();
+    appendOptions(argv, options);
+    std::vector<std::filesystem::path> temporaryFiles;
+    const std::shared_ptr<const std::string> input =
+        appendSources(argv, src, versionID, temporaryFiles);
+    runCommand(argv, input, temporaryFiles, versionID);
+    if (isCancelled(versionID)) {
+      std::error_code ec;
+      std::filesystem::remove(IRFile, ec);
+      return "";
     }
-    Compiler::log_exec(command);
     if (exists(IRFile)) {
       return IRFile;
     }
@@ -106,19 +113,29 @@ SystemCompiler::generateBin(const std::vector<std::filesystem::path> &src,
                             const std::vector<std::string> &func,
                             const std::string &versionID,
                             const opt_list_t options) {
-  // system call - command construction
-  std::string command = (installDirectory / callString).string();
+  // process launch - argument vector construction
+  // the call string may carry a launcher, as in "ccache gcc"
+  std::vector<std::string> argv =
+      ProcessLauncher::tokenize((installDirectory / callString).string());
   std::filesystem::path binaryFile =
       Compiler::getSharedObjectFileName(versionID);
-  command = command + " -fpic -shared -o " + binaryFile.string();
-  for (const auto &o : options) {
-    command = command + " " + getOptionString(o);
+  argv.insert(argv.end(), {"-fpic", "-shared", "-o", binaryFile.string()});
+  appendOptions(argv, options);
+  std::vector<std::filesystem::path> temporaryFiles;
+  const std::filesystem::path exportMap = writeExportMap(func, versionID);
+  if (!exportMap.empty()) {
+    argv.push_back("-Wl,--version-script=" + exportMap.string());
+    temporaryFiles.push_back(exportMap);
   }
-  for (const auto &src_file : src) {
-    command = command + " " + src_file.string();
+  const std::shared_ptr<const std::string> input =
+      appendSources(argv, src, versionID, temporaryFiles);
+  runCommand(argv, input, temporaryFiles, versionID);
+  if (isCancelled(versionID)) {
+    // the output may be incomplete
+    discardSharedObject(versionID);
+    return "";
   }
-  log_exec(command);
-  if (exists(binaryFile)) {
+  if (existsNotEmpty(binaryFile)) {
     return binaryFile;
   }
   return "";
@@ -139,3 +156,97 @@ inline std::string SystemCompiler::getOptionString(const Option &o) const {
   }
   return o.getPrefix() + tmp_val;
 }
+
+// ----------------------------------------------------------------------------
+// ------------------------- get compiler version -----------------------------
+// ----------------------------------------------------------------------------
+std::string SystemCompiler::getCompilerVersion() const {
+  std::call_once(versionFlag, [this]() {
+    versionString = queryVersion(installDirectory / callString);
+  });
+  return versionString;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------ query executable version --------------------------
+// ----------------------------------------------------------------------------
+std::string SystemCompiler::queryVersion(const std::filesystem::path &exe) {
+  const ProcessResult result =
+      ProcessLauncher::run(ProcessLauncher::tokenize(exe.string() +
+                                                     " --version"));
+  return result.launched ? result.output : "";
+}
+
+// ----------------------------------------------------------------------------
+// -------------------- append options to argument vector ---------------------
+// ----------------------------------------------------------------------------
+void SystemCompiler::appendOptions(std::vector<std::string> &argv,
+                                   const opt_list_t &options) const {
+  for (const auto &o : options) {
+    // option strings are quoted as on a shell command line
+    const std::vector<std::string> args =
+        ProcessLauncher::tokenize(getOptionString(o));
+    argv.insert(argv.end(), args.begin(), args.end());
+  }
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// -------------------- append sources to argument vector ---------------------
+// ----------------------------------------------------------------------------
+std::shared_ptr<const std::string> SystemCompiler::appendSources(
+    std::vector<std::string> &argv,
+    const std::vector<std::filesystem::path> &src,
+    const std::string &versionID,
+    std::vector<std::filesystem::path> &temporaryFiles) const {
+  std::shared_ptr<const std::string> input = nullptr;
+  std::string language = "";
+  for (const auto &src_file : src) {
+    const std::shared_ptr<const std::string> buffer =
+        getSourceBuffer(versionID, src_file);
+    if (!buffer) {
+      argv.push_back(src_file.string());
+    } else if (language.empty()) {
+      // stdin has no extension: the language is given explicitly
+      const std::string extension = src_file.extension().string();
+      language = "c";
+      if (extension == ".cpp" || extension == ".cc" || extension == ".cxx" ||
+          extension == ".C" || extension == ".c++") {
+        language = "c++";
+      }
+      input = buffer;
+    } else {
+      // only one source can be read from stdin
+      const std::filesystem::path tmp =
+          libWorkingDirectory /
+          std::filesystem::u8path(versionID + "_" +
+                                  src_file.filename().string());
+      std::ofstream tmpFile(tmp, std::ios::binary);
+      tmpFile << *buffer;
+      tmpFile.close();
+      temporaryFiles.push_back(tmp);
+      argv.push_back(tmp.string());
+    }
+  }
+  if (!language.empty()) {
+    // last one, as -x applies to any subsequent input
+    argv.insert(argv.end(), {"-x", language, "-"});
+  }
+  return input;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------- run command --------------------------------
+// ----------------------------------------------------------------------------
+void SystemCompiler::runCommand(
+    const std::vector<std::string> &argv,
+    const std::shared_ptr<const std::string> &input,
+    const std::vector<std::filesystem::path> &temporaryFiles,
+    const std::string &versionID) const {
+  log_exec(argv, input.get(), versionID);
+  for (const auto &tmp : temporaryFiles) {
+    std::error_code ec;
+    std::filesystem::remove(tmp, ec);
+  }
+  return;
+}
@@ -59,18 +59,31 @@ std::filesystem::path
 SystemCompilerOptimizer::runOptimizer(const std::filesystem::path &src_IR,
                                       const std::string &versionID,
                                       const opt_list_t options) const {
-  std::string commandString;
-  commandString = (optInstallDirectory / optCallString).string();
+  std::vector<std::string> argv =
+      ProcessLauncher::tokenize((optInstallDirectory / optCallString).string());
   std::filesystem::path optimizedFileName =
       Compiler::getOptBitcodeFileName(versionID);
-  for (auto &o : options) {
-    commandString = commandString + " " + getOptionString(o);
+  appendOptions(argv, options);
+  argv.insert(argv.end(),
+              {"-o", optimizedFileName.string(), src_IR.string()});
+  Compiler::log_exec(argv, nullptr, versionID);
+  if (isCancelled(versionID)) {
+    std::error_code ec;
+    std::filesystem::remove(optimizedFileName, ec);
+    return "";
   }
-  commandString = commandString + " -o " + optimizedFileName.string() + " " +
-                  src_IR.string();
-  Compiler::log_exec(commandString);
   if (exists(optimizedFileName)) {
     return optimizedFileName;
   }
   return "";
 }
+
+// ----------------------------------------------------------------------------
+// ------------------------- get compiler version -----------------------------
+// ----------------------------------------------------------------------------
+std::string SystemCompilerOptimizer::getCompilerVersion() const {
+  std::call_once(optVersionFlag, [this]() {
+    optVersionString = queryVersion(optInstallDirectory / optCallString);
+  });
+  return SystemCompiler::getCompilerVersion() + optVersionString;
+}
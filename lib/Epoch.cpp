@@ -0,0 +1,183 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "versioningCompiler/Epoch.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace vc;
+
+namespace {
+// per-thread reader slot. Slots are never freed, threads reuse them.
+struct Record {
+  // epoch observed when entering the outermost guard. 0 when quiescent.
+  std::atomic<uint64_t> epoch{0};
+  std::atomic<bool> inUse{false};
+  Record *next = nullptr;
+  // guard nesting level, accessed by the owner thread only
+  unsigned depth = 0;
+};
+
+struct Retired {
+  uint64_t epoch;
+  std::function<void()> deleter;
+};
+
+std::atomic<Record *> records{nullptr};
+std::atomic<uint64_t> globalEpoch{1};
+
+// intentionally leaked: deleters may run while the process exits
+std::mutex &retiredMtx() {
+  static std::mutex *mtx = new std::mutex();
+  return *mtx;
+}
+
+std::vector<Retired> &retiredList() {
+  static std::vector<Retired> *list = new std::vector<Retired>();
+  return *list;
+}
+
+Record *acquireRecord() {
+  for (Record *r = records.load(); r; r = r->next) {
+    bool free = false;
+    if (r->inUse.compare_exchange_strong(free, true)) {
+      return r;
+    }
+  }
+  Record *r = new Record();
+  r->inUse.store(true);
+  r->next = records.load();
+  while (!records.compare_exchange_weak(r->next, r)) {
+  }
+  return r;
+}
+
+// gives the slot back when the thread exits
+struct RecordOwner {
+  Record *record = nullptr;
+  ~RecordOwner() {
+    if (record) {
+      record->epoch.store(0);
+      record->depth = 0;
+      record->inUse.store(false);
+    }
+  }
+};
+
+thread_local RecordOwner owner;
+} // namespace
+
+// ----------------------------------------------------------------------------
+// ----------------------------- enter read side ------------------------------
+// ----------------------------------------------------------------------------
+void Epoch::enter() {
+  Record *r = owner.record;
+  if (!r) {
+    r = owner.record = acquireRecord();
+  }
+  if (r->depth++ == 0) {
+    // sequentially consistent: the following loads of shared pointers
+    // cannot be reordered before this store
+    r->epoch.store(globalEpoch.load());
+  }
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------------- exit read side -------------------------------
+// ----------------------------------------------------------------------------
+void Epoch::exit() {
+  Record *r = owner.record;
+  if (--r->depth == 0) {
+    r->epoch.store(0, std::memory_order_release);
+  }
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// ---------------------------------- retire ----------------------------------
+// ----------------------------------------------------------------------------
+void Epoch::retire(std::function<void()> deleter) {
+  // readers which observed this epoch, or an older one, may hold the object
+  const uint64_t epoch = globalEpoch.fetch_add(1);
+  {
+    std::lock_guard<std::mutex> lock(retiredMtx());
+    retiredList().push_back({epoch, std::move(deleter)});
+  }
+  reclaim();
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// --------------------------------- reclaim ----------------------------------
+// ----------------------------------------------------------------------------
+std::size_t Epoch::reclaim() {
+  uint64_t oldest = std::numeric_limits<uint64_t>::max();
+  for (Record *r = records.load(); r; r = r->next) {
+    const uint64_t e = r->epoch.load();
+    if (e != 0 && e < oldest) {
+      oldest = e;
+    }
+  }
+  std::vector<Retired> expired;
+  {
+    std::lock_guard<std::mutex> lock(retiredMtx());
+    std::vector<Retired> &list = retiredList();
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < list.size(); i++) {
+      if (list[i].epoch < oldest) {
+        expired.push_back(std::move(list[i]));
+      } else {
+        list[kept++] = std::move(list[i]);
+      }
+    }
+    list.resize(kept);
+  }
+  // deleters may be slow (dlclose), run them unlocked
+  for (auto &r : expired) {
+    r.deleter();
+  }
+  return expired.size();
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------- synchronize --------------------------------
+// ----------------------------------------------------------------------------
+void Epoch::synchronize() {
+  reclaim();
+  while (pending() > 0) {
+    std::this_thread::yield();
+    reclaim();
+  }
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------ pending objects -----------------------------
+// ----------------------------------------------------------------------------
+std::size_t Epoch::pending() {
+  std::lock_guard<std::mutex> lock(retiredMtx());
+  return retiredList().size();
+}
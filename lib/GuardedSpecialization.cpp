@@ -0,0 +1,224 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "versioningCompiler/GuardedSpecialization.hpp"
+
+#include <future>
+
+using namespace vc;
+
+namespace {
+// binds the guard to the specialized and the generic entry points
+typedef void (*bind_func_t)(void *, void *);
+
+const char *guard_bind_name = "vc_guard_bind";
+} // namespace
+
+// ----------------------------------------------------------------------------
+// --------------------------- detailed constructor ---------------------------
+// ----------------------------------------------------------------------------
+GuardedSpecialization::GuardedSpecialization(
+    const compiler_ptr_t &compiler, const std::string &functionName,
+    const std::string &returnType, const std::vector<Parameter> &parameters)
+    : compiler(compiler), functionName(functionName), returnType(returnType),
+      parameters(parameters) {}
+
+// ----------------------------------------------------------------------------
+// ------------------------------ assume value --------------------------------
+// ----------------------------------------------------------------------------
+void GuardedSpecialization::assumeValue(const std::string &parameter,
+                                        long long value) {
+  const std::string v = std::to_string(value);
+  assume("(" + parameter + ") == " + v + "LL",
+         "VC_ASSUME_VALUE_" + parameter + "=" + v);
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------------- assume aligned -------------------------------
+// ----------------------------------------------------------------------------
+void GuardedSpecialization::assumeAligned(const std::string &parameter,
+                                          std::size_t alignment) {
+  const std::string a = std::to_string(alignment);
+  assume("((uintptr_t)(" + parameter + ") & (" + a + "u - 1u)) == 0",
+         "VC_ASSUME_ALIGNED_" + parameter + "=" + a);
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------------- assume no alias ------------------------------
+// ----------------------------------------------------------------------------
+void GuardedSpecialization::assumeNoAlias(const std::string &first,
+                                          const std::string &second,
+                                          const std::string &size) {
+  const std::string p = "(uintptr_t)(" + first + ")";
+  const std::string q = "(uintptr_t)(" + second + ")";
+  const std::string s = "(uintptr_t)(" + size + ")";
+  assume("(" + p + " + " + s + " <= " + q + " || " + q + " + " + s +
+             " <= " + p + ")",
+         "VC_ASSUME_NOALIAS_" + first + "_" + second + "=1");
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------ assume at most ------------------------------
+// ----------------------------------------------------------------------------
+void GuardedSpecialization::assumeAtMost(const std::string &parameter,
+                                         long long bound) {
+  const std::string b = std::to_string(bound);
+  assume("(" + parameter + ") <= " + b + "LL",
+         "VC_ASSUME_MAX_" + parameter + "=" + b);
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------------- custom assumption ----------------------------
+// ----------------------------------------------------------------------------
+void GuardedSpecialization::assume(const std::string &condition,
+                                   const std::string &define) {
+  conditions.push_back(condition);
+  if (!define.empty()) {
+    defines.push_back(define);
+  }
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// --------------------------- build from builder -----------------------------
+// ----------------------------------------------------------------------------
+bool GuardedSpecialization::build(const Version::Builder &builder) {
+  Version::Builder genericBuilder = builder;
+  Version::Builder specializedBuilder = builder;
+  for (const auto &define : defines) {
+    specializedBuilder.addFunctionFlag(define);
+  }
+  const version_ptr_t g = genericBuilder.build();
+  const version_ptr_t s = specializedBuilder.build();
+  // both compilations run in parallel
+  std::vector<std::shared_future<bool>> compiled = submit({g, s});
+  const bool generic_ok = compiled[0].get();
+  const bool specialized_ok = compiled[1].get();
+  if (!generic_ok) {
+    return false;
+  }
+  return build(specialized_ok ? s : nullptr, g);
+}
+
+// ----------------------------------------------------------------------------
+// ---------------------------- build from Versions ---------------------------
+// ----------------------------------------------------------------------------
+bool GuardedSpecialization::build(const version_ptr_t &specialized,
+                                  const version_ptr_t &generic) {
+  this->specialized = nullptr;
+  this->generic = nullptr;
+  this->guard = nullptr;
+  if (!generic || !generic->compile() || !generic->getSymbol<void *>()) {
+    return false;
+  }
+  this->generic = generic;
+  if (!specialized || !specialized->compile() ||
+      !specialized->getSymbol<void *>()) {
+    // nothing to guard: the generic Version is called directly
+    return true;
+  }
+
+  Version::Builder builder;
+  builder.setCompiler(compiler);
+  builder.addFunctionName("vc_guard_" + functionName);
+  builder.addFunctionName(guard_bind_name);
+  builder.addSourceBuffer(
+      "vc_guard_" + functionName + ".c",
+      getGuardSource(specialized->getID(), generic->getID()));
+  builder.options({Option("o", "-O", "2")});
+  version_ptr_t g = builder.build();
+  if (!g->compile()) {
+    return false;
+  }
+  bind_func_t bind = g->getSymbol<bind_func_t>(1);
+  if (!bind) {
+    return false;
+  }
+  bind(specialized->getSymbol<void *>(), generic->getSymbol<void *>());
+  this->specialized = specialized;
+  this->guard = g;
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------- get symbol ---------------------------------
+// ----------------------------------------------------------------------------
+void *GuardedSpecialization::getSymbol() const {
+  if (guard) {
+    return guard->getSymbol<void *>();
+  }
+  if (generic) {
+    return generic->getSymbol<void *>();
+  }
+  return nullptr;
+}
+
+// ----------------------------------------------------------------------------
+// ---------------------------- get guard source ------------------------------
+// ----------------------------------------------------------------------------
+std::string
+GuardedSpecialization::getGuardSource(const std::string &specializedID,
+                                      const std::string &genericID) const {
+  std::string prototype = "";
+  std::string arguments = "";
+  for (std::size_t i = 0; i < parameters.size(); i++) {
+    if (i > 0) {
+      prototype += ", ";
+      arguments += ", ";
+    }
+    prototype += parameters[i].type + " " + parameters[i].name;
+    arguments += parameters[i].name;
+  }
+  if (parameters.empty()) {
+    prototype = "void";
+  }
+  const std::string pointer_t = returnType + " (*)(" + prototype + ")";
+  std::string condition = "1";
+  for (const auto &c : conditions) {
+    condition += " && (" + c + ")";
+  }
+  const bool returns = returnType != "void";
+  const std::string call_prefix = returns ? "return " : "";
+  const std::string call_suffix = returns ? "" : " return;";
+
+  std::string src = "#include <stddef.h>\n#include <stdint.h>\n\n";
+  // the targets are bound into the guard object: it must be its own
+  src += "__attribute__((used)) static const char vc_guard_targets[] =\n";
+  src += "    \"" + specializedID + " " + genericID + "\";\n";
+  src += "static " + returnType + " (*vc_specialized)(" + prototype + ");\n";
+  src += "static " + returnType + " (*vc_generic)(" + prototype + ");\n\n";
+  src += "void " + std::string(guard_bind_name) +
+         "(void *specialized, void *generic) {\n";
+  src += "  vc_specialized = (" + pointer_t + ")specialized;\n";
+  src += "  vc_generic = (" + pointer_t + ")generic;\n";
+  src += "}\n\n";
+  src += returnType + " vc_guard_" + functionName + "(" + prototype + ") {\n";
+  src += "  if (__builtin_expect(" + condition + ", 1)) {\n";
+  src += "    " + call_prefix + "vc_specialized(" + arguments + ");" +
+         call_suffix + "\n";
+  src += "  }\n";
+  src += "  " + call_prefix + "vc_generic(" + arguments + ");\n";
+  src += "}\n";
+  return src;
+}
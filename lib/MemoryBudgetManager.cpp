@@ -0,0 +1,372 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "versioningCompiler/MemoryBudgetManager.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <elf.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <vector>
+
+using namespace vc;
+
+// ---------------------------------------------------------------------------
+// -------------------------- Pin move constructor ---------------------------
+// ---------------------------------------------------------------------------
+MemoryBudgetManager::Pin::Pin(Pin &&other)
+    : manager(other.manager), version(std::move(other.version)) {
+  other.manager = nullptr;
+  other.version = nullptr;
+}
+
+// ---------------------------------------------------------------------------
+// --------------------------- Pin move assignment ---------------------------
+// ---------------------------------------------------------------------------
+MemoryBudgetManager::Pin &MemoryBudgetManager::Pin::operator=(Pin &&other) {
+  if (this != &other) {
+    release();
+    manager = other.manager;
+    version = std::move(other.version);
+    other.manager = nullptr;
+    other.version = nullptr;
+  }
+  return *this;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------- Pin release -------------------------------
+// ---------------------------------------------------------------------------
+void MemoryBudgetManager::Pin::release() {
+  if (manager && version) {
+    manager->unpin(version);
+  }
+  manager = nullptr;
+  version = nullptr;
+  return;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------- constructor -------------------------------
+// ---------------------------------------------------------------------------
+MemoryBudgetManager::MemoryBudgetManager(std::size_t budget, Policy policy,
+                                         Metric metric)
+    : budget(budget), policy(policy), metric(metric) {}
+
+// ---------------------------------------------------------------------------
+// ----------------------------- track a Version -----------------------------
+// ---------------------------------------------------------------------------
+bool MemoryBudgetManager::track(const version_ptr_t &version) {
+  if (!version || !version->hasLoadedSymbol()) {
+    return false;
+  }
+  Entry entry;
+  entry.version = version;
+  entry.binary = version->getFileName_bin();
+  entry.mappedSize = getMappedSize(entry.binary);
+  struct stat st;
+  if (stat(entry.binary.c_str(), &st) == 0) {
+    entry.device = st.st_dev;
+    entry.inode = st.st_ino;
+  }
+  std::vector<version_ptr_t> victims;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    entry.lastUse = ++clock;
+    entries[version.get()] = entry;
+    victims = selectVictims();
+  }
+  foldVictims(victims);
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------- untrack a Version ----------------------------
+// ---------------------------------------------------------------------------
+void MemoryBudgetManager::untrack(const version_ptr_t &version) {
+  std::lock_guard<std::mutex> lock(mtx);
+  entries.erase(version.get());
+  return;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------ pin a Version ------------------------------
+// ---------------------------------------------------------------------------
+MemoryBudgetManager::Pin
+MemoryBudgetManager::pin(const version_ptr_t &version) {
+  bool folded = false;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = entries.find(version.get());
+    if (it == entries.end()) {
+      return Pin();
+    }
+    // pinned before reloading: it cannot be folded again meanwhile
+    Entry &entry = it->second;
+    entry.pins++;
+    entry.uses++;
+    entry.lastUse = ++clock;
+    folded = entry.folded;
+  }
+  if (folded && !reloadPinned(version)) {
+    unpin(version);
+    return Pin();
+  }
+  enforce();
+  return Pin(this, version);
+}
+
+// ---------------------------------------------------------------------------
+// ----------------------------- unpin a Version -----------------------------
+// ---------------------------------------------------------------------------
+void MemoryBudgetManager::unpin(const version_ptr_t &version) {
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = entries.find(version.get());
+  if (it != entries.end() && it->second.pins > 0) {
+    it->second.pins--;
+  }
+  return;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------- refresh resident sizes --------------------------
+// ---------------------------------------------------------------------------
+std::size_t MemoryBudgetManager::refresh() {
+  // resident size of every mapped file, from a single pass over smaps.
+  // Files are identified by device and inode: names of anonymous memory
+  // files and of deleted files do not match the path they were loaded from
+  std::map<std::pair<dev_t, ino_t>, std::size_t> resident;
+  std::ifstream smaps("/proc/self/smaps");
+  std::string line;
+  std::pair<dev_t, ino_t> current(0, 0);
+  while (std::getline(smaps, line)) {
+    if (line.compare(0, 4, "Rss:") == 0) {
+      if (current.second != 0) {
+        resident[current] += std::stoull(line.substr(4)) * 1024;
+      }
+      continue;
+    }
+    // mapping header: address perms offset dev inode [pathname]
+    std::istringstream header(line);
+    std::string range, perms, offset, dev;
+    ino_t inode = 0;
+    unsigned int major_id = 0, minor_id = 0;
+    if (!(header >> range >> perms >> offset >> dev >> inode) ||
+        range.find('-') == std::string::npos ||
+        std::sscanf(dev.c_str(), "%x:%x", &major_id, &minor_id) != 2) {
+      continue; // any other field of the current mapping
+    }
+    current = std::make_pair(makedev(major_id, minor_id), inode);
+  }
+  std::vector<version_ptr_t> victims;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (auto &e : entries) {
+      auto it = resident.find(std::make_pair(e.second.device, e.second.inode));
+      e.second.residentSize = it != resident.end() ? it->second : 0;
+    }
+    victims = selectVictims();
+  }
+  foldVictims(victims);
+  return getUsage();
+}
+
+// ---------------------------------------------------------------------------
+// --------------------------- enforce the budget ----------------------------
+// ---------------------------------------------------------------------------
+std::size_t MemoryBudgetManager::enforce() {
+  std::vector<version_ptr_t> victims;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    victims = selectVictims();
+  }
+  return foldVictims(victims);
+}
+
+// ---------------------------------------------------------------------------
+// --------------------------- select the victims ----------------------------
+// ---------------------------------------------------------------------------
+std::vector<version_ptr_t> MemoryBudgetManager::selectVictims() {
+  std::vector<std::pair<uint64_t, const Version *>> candidates;
+  for (auto it = entries.begin(); it != entries.end();) {
+    if (it->second.version.expired()) {
+      it = entries.erase(it);
+      continue;
+    }
+    if (!it->second.folded && it->second.pins == 0) {
+      const uint64_t rank = policy == LEAST_RECENTLY_USED
+                                ? it->second.lastUse
+                                : it->second.uses;
+      candidates.emplace_back(rank, it->first);
+    }
+    ++it;
+  }
+  std::vector<version_ptr_t> victims;
+  std::size_t current = usage();
+  if (current <= budget) {
+    return victims;
+  }
+  std::sort(candidates.begin(), candidates.end());
+  for (const auto &c : candidates) {
+    if (current <= budget) {
+      break;
+    }
+    Entry &entry = entries.at(c.second);
+    version_ptr_t v = entry.version.lock();
+    if (!v) {
+      continue;
+    }
+    current -= std::min(current, sizeOf(entry));
+    // accounted as folded from now on, folded by foldVictims
+    entry.folded = true;
+    entry.residentSize = 0;
+    victims.push_back(std::move(v));
+  }
+  return victims;
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------- fold the victims -----------------------------
+// ---------------------------------------------------------------------------
+std::size_t
+MemoryBudgetManager::foldVictims(const std::vector<version_ptr_t> &victims) {
+  std::size_t folded = 0;
+  for (const auto &v : victims) {
+    std::lock_guard<std::mutex> loading(loadMtx);
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      auto it = entries.find(v.get());
+      if (it == entries.end() || !it->second.folded) {
+        continue; // untracked, or already reloaded by a pin
+      }
+      if (it->second.pins > 0) {
+        // pinned after its selection, while still loaded
+        it->second.folded = false;
+        continue;
+      }
+    }
+    // a pin arriving now finds it folded and waits on loadMtx to reload it
+    v->fold();
+    folded++;
+  }
+  return folded;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------ reload a pinned Version --------------------------
+// ---------------------------------------------------------------------------
+bool MemoryBudgetManager::reloadPinned(const version_ptr_t &version) {
+  std::lock_guard<std::mutex> loading(loadMtx);
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = entries.find(version.get());
+    if (it != entries.end() && !it->second.folded) {
+      return true; // reloaded by another pin, or its fold was abandoned
+    }
+  }
+  if (!version->reload()) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = entries.find(version.get());
+  if (it != entries.end()) {
+    it->second.folded = false;
+    it->second.residentSize = 0; // unknown until the next refresh
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// --------------------------- memory of an entry ----------------------------
+// ---------------------------------------------------------------------------
+std::size_t MemoryBudgetManager::sizeOf(const Entry &entry) const {
+  return metric == RESIDENT_SIZE ? entry.residentSize : entry.mappedSize;
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------- memory accounted -----------------------------
+// ---------------------------------------------------------------------------
+std::size_t MemoryBudgetManager::usage() const {
+  std::size_t total = 0;
+  for (const auto &e : entries) {
+    if (!e.second.folded) {
+      total += sizeOf(e.second);
+    }
+  }
+  return total;
+}
+
+// ---------------------------------------------------------------------------
+// -------------------------------- get usage --------------------------------
+// ---------------------------------------------------------------------------
+std::size_t MemoryBudgetManager::getUsage() const {
+  std::lock_guard<std::mutex> lock(mtx);
+  return usage();
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------- get budget --------------------------------
+// ---------------------------------------------------------------------------
+std::size_t MemoryBudgetManager::getBudget() const {
+  std::lock_guard<std::mutex> lock(mtx);
+  return budget;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------- set budget --------------------------------
+// ---------------------------------------------------------------------------
+void MemoryBudgetManager::setBudget(std::size_t budget) {
+  std::lock_guard<std::mutex> lock(mtx);
+  this->budget = budget;
+  return;
+}
+
+// ---------------------------------------------------------------------------
+// ----------------------- mapped size of an ELF file ------------------------
+// ---------------------------------------------------------------------------
+std::size_t
+MemoryBudgetManager::getMappedSize(const std::filesystem::path &bin) {
+  std::ifstream in(bin, std::ios::in | std::ios::binary);
+  Elf64_Ehdr ehdr;
+  if (!in.read(reinterpret_cast<char *>(&ehdr), sizeof(ehdr)) ||
+      std::memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 ||
+      ehdr.e_ident[EI_CLASS] != ELFCLASS64 ||
+      ehdr.e_shentsize != sizeof(Elf64_Shdr)) {
+    return 0;
+  }
+  std::vector<Elf64_Shdr> sections(ehdr.e_shnum);
+  in.seekg(ehdr.e_shoff);
+  if (!in.read(reinterpret_cast<char *>(sections.data()),
+               sections.size() * sizeof(Elf64_Shdr))) {
+    return 0;
+  }
+  std::size_t size = 0;
+  for (const auto &s : sections) {
+    if (s.sh_flags & SHF_ALLOC) {
+      size += s.sh_size;
+    }
+  }
+  return size;
+}
@@ -20,14 +20,105 @@
  */
 #include "versioningCompiler/Option.hpp"
 
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
 using namespace vc;
 
+namespace {
+// process wide table of the interned options
+struct OptionTable {
+  std::shared_mutex mtx;
+  // contiguous blocks, addresses are stable
+  std::deque<Option::Data> options;
+  // entries of the released options, reused first
+  std::vector<Option::Data *> free;
+  std::unordered_map<std::string, Option::Data *> byKey;
+};
+
+OptionTable &getOptionTable() {
+  static OptionTable *table = new OptionTable(); // outlives static Options
+  return *table;
+}
+
+// fields are length-prefixed, any string is a valid field
+std::string makeKey(const std::string &tag, const std::string &prefix,
+                    const std::string &value) {
+  return std::to_string(tag.size()) + ":" + tag +
+         std::to_string(prefix.size()) + ":" + prefix + value;
+}
+
+// the returned option is referred to once more
+const Option::Data *intern(const std::string &tag, const std::string &prefix,
+                           const std::string &value) {
+  OptionTable &table = getOptionTable();
+  const std::string key = makeKey(tag, prefix, value);
+  {
+    std::shared_lock<std::shared_mutex> lock(table.mtx);
+    const auto it = table.byKey.find(key);
+    if (it != table.byKey.end()) {
+      it->second->references.fetch_add(1, std::memory_order_relaxed);
+      return it->second;
+    }
+  }
+  std::unique_lock<std::shared_mutex> lock(table.mtx);
+  const auto it = table.byKey.find(key);
+  if (it != table.byKey.end()) {
+    // interned by another thread meanwhile
+    it->second->references.fetch_add(1, std::memory_order_relaxed);
+    return it->second;
+  }
+  Option::Data *data = nullptr;
+  if (!table.free.empty()) {
+    data = table.free.back();
+    table.free.pop_back();
+  } else {
+    data = &table.options.emplace_back();
+    data->id = table.options.size() - 1;
+  }
+  data->tag = tag;
+  data->value = value;
+  data->prefix = prefix;
+  data->text = prefix + value;
+  data->hash = std::hash<std::string>()(data->text);
+  data->references.store(1, std::memory_order_relaxed);
+  data->interned = true;
+  table.byKey.emplace(key, data);
+  return data;
+}
+} // namespace
+
 Option::Option(const std::string &optionTag, const std::string &optionPrefix,
                const std::string &val)
-    : tag(optionTag), value(val), prefix(optionPrefix) {}
+    : data(intern(optionTag, optionPrefix, val)) {}
+
+void Option::unintern(const Data *data) {
+  OptionTable &table = getOptionTable();
+  std::unique_lock<std::shared_mutex> lock(table.mtx);
+  // looked up again before the lock was taken, or already released by a
+  // previous drop to zero
+  if (data->references.load(std::memory_order_relaxed) != 0 ||
+      !data->interned) {
+    return;
+  }
+  const auto it =
+      table.byKey.find(makeKey(data->tag, data->prefix, data->value));
+  Data *entry = it->second;
+  table.byKey.erase(it);
+  entry->interned = false;
+  entry->tag = std::string();
+  entry->value = std::string();
+  entry->prefix = std::string();
+  entry->text = std::string();
+  table.free.push_back(entry);
+  return;
+}
 
-std::string Option::getTag() const { return tag; }
+const std::string &Option::getTag() const { return data->tag; }
 
-std::string Option::getValue() const { return value; }
+const std::string &Option::getValue() const { return data->value; }
 
-std::string Option::getPrefix() const { return prefix; }
+const std::string &Option::getPrefix() const { return data->prefix; }
@@ -0,0 +1,311 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "versioningCompiler/ProcessLauncher.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+using namespace vc;
+
+namespace {
+// how often a cancellation token is polled
+const int cancel_poll_ms = 50;
+// time given to a cancelled process to exit before SIGKILL
+const std::chrono::milliseconds cancel_grace(1000);
+} // namespace
+
+// ----------------------------------------------------------------------------
+// ------------------------------- run process --------------------------------
+// ----------------------------------------------------------------------------
+ProcessResult ProcessLauncher::run(const std::vector<std::string> &argv,
+                                   const std::string *input,
+                                   const env_map_t &environment,
+                                   const CancellationToken *cancel) {
+  ProcessResult result;
+  if (argv.empty()) {
+    return result;
+  }
+  if (cancel && cancel->isCancelled()) {
+    result.cancelled = true;
+    return result;
+  }
+  std::vector<char *> c_argv;
+  c_argv.reserve(argv.size() + 1);
+  for (const auto &arg : argv) {
+    c_argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  c_argv.push_back(nullptr);
+
+  // environment of the calling process, with overrides
+  std::vector<std::string> env_owner;
+  for (char **var = environ; var && *var; ++var) {
+    const std::string entry(*var);
+    const std::string name = entry.substr(0, entry.find('='));
+    if (environment.find(name) == environment.end()) {
+      env_owner.push_back(entry);
+    }
+  }
+  for (const auto &var : environment) {
+    env_owner.push_back(var.first + "=" + var.second);
+  }
+  std::vector<char *> c_env;
+  c_env.reserve(env_owner.size() + 1);
+  for (const auto &var : env_owner) {
+    c_env.push_back(const_cast<char *>(var.c_str()));
+  }
+  c_env.push_back(nullptr);
+
+  // close-on-exec: concurrent children must not inherit these pipes
+  int in_pipe[2] = {-1, -1};
+  int out_pipe[2] = {-1, -1};
+  if (pipe2(out_pipe, O_CLOEXEC) != 0) {
+    return result;
+  }
+  if (input && pipe2(in_pipe, O_CLOEXEC) != 0) {
+    close(out_pipe[0]);
+    close(out_pipe[1]);
+    return result;
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (input) {
+    posix_spawn_file_actions_adddup2(&actions, in_pipe[0], STDIN_FILENO);
+  } else {
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+                                     O_RDONLY, 0);
+  }
+  posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDERR_FILENO);
+
+  // the child starts with default signal handling
+  posix_spawnattr_t attributes;
+  posix_spawnattr_init(&attributes);
+  sigset_t signals;
+  sigemptyset(&signals);
+  posix_spawnattr_setsigmask(&attributes, &signals);
+  sigaddset(&signals, SIGPIPE);
+  posix_spawnattr_setsigdefault(&attributes, &signals);
+  short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+  if (cancel) {
+    // own process group: cancellation also reaches the compiler subprocesses
+    posix_spawnattr_setpgroup(&attributes, 0);
+    flags |= POSIX_SPAWN_SETPGROUP;
+  }
+  posix_spawnattr_setflags(&attributes, flags);
+
+  pid_t pid = -1;
+  const int spawn_error = posix_spawnp(&pid, c_argv[0], &actions, &attributes,
+                                       c_argv.data(), c_env.data());
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attributes);
+  close(out_pipe[1]);
+  if (input) {
+    close(in_pipe[0]);
+  }
+  if (spawn_error != 0) {
+    close(out_pipe[0]);
+    if (input) {
+      close(in_pipe[1]);
+    }
+    result.output = argv[0] + ": cannot execute\n";
+    return result;
+  }
+  result.launched = true;
+
+  // the process may exit without reading its input: get EPIPE instead of
+  // being killed by SIGPIPE
+  sigset_t sigpipe_mask;
+  sigset_t old_mask;
+  sigemptyset(&sigpipe_mask);
+  sigaddset(&sigpipe_mask, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe_mask, &old_mask);
+  bool sigpipe_raised = false;
+
+  // feed the input and drain the output together, either side may block
+  int in_fd = input ? in_pipe[1] : -1;
+  int out_fd = out_pipe[0];
+  std::size_t written = 0;
+  if (in_fd >= 0) {
+    fcntl(in_fd, F_SETFL, fcntl(in_fd, F_GETFL) | O_NONBLOCK);
+    if (input->empty()) {
+      close(in_fd);
+      in_fd = -1;
+    }
+  }
+  char buf[16384];
+  bool killed = false;
+  std::chrono::steady_clock::time_point cancel_time;
+  while (in_fd >= 0 || out_fd >= 0) {
+    if (cancel && !result.cancelled && cancel->isCancelled()) {
+      kill(-pid, SIGTERM);
+      result.cancelled = true;
+      cancel_time = std::chrono::steady_clock::now();
+    } else if (result.cancelled && !killed &&
+               std::chrono::steady_clock::now() - cancel_time > cancel_grace) {
+      kill(-pid, SIGKILL);
+      killed = true;
+    }
+    struct pollfd fds[2];
+    nfds_t nfds = 0;
+    if (in_fd >= 0) {
+      fds[nfds++] = {in_fd, POLLOUT, 0};
+    }
+    if (out_fd >= 0) {
+      fds[nfds++] = {out_fd, POLLIN, 0};
+    }
+    if (poll(fds, nfds, cancel ? cancel_poll_ms : -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    for (nfds_t i = 0; i < nfds; ++i) {
+      if (fds[i].revents == 0) {
+        continue;
+      }
+      if (fds[i].fd == in_fd) {
+        const ssize_t n =
+            write(in_fd, input->data() + written, input->size() - written);
+        if (n > 0) {
+          written += n;
+        } else if (n < 0 && errno == EPIPE) {
+          sigpipe_raised = true;
+        }
+        if (written == input->size() ||
+            (n < 0 && errno != EAGAIN && errno != EINTR)) {
+          close(in_fd);
+          in_fd = -1;
+        }
+      } else {
+        const ssize_t n = read(out_fd, buf, sizeof(buf));
+        if (n > 0) {
+          result.output.append(buf, n);
+        } else if (n == 0 || errno != EINTR) {
+          close(out_fd);
+          out_fd = -1;
+        }
+      }
+    }
+  }
+  if (in_fd >= 0) {
+    close(in_fd);
+  }
+  if (out_fd >= 0) {
+    close(out_fd);
+  }
+  if (sigpipe_raised) {
+    // consume the pending signal before restoring the mask
+    const struct timespec no_wait = {0, 0};
+    sigtimedwait(&sigpipe_mask, nullptr, &no_wait);
+  }
+  pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+
+  int status = 0;
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+  }
+  if (WIFEXITED(status)) {
+    result.exitCode = WEXITSTATUS(status);
+  } else if (WIFSIGNALED(status)) {
+    result.signal = WTERMSIG(status);
+  }
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------------- tokenize command -----------------------------
+// ----------------------------------------------------------------------------
+std::vector<std::string> ProcessLauncher::tokenize(const std::string &command) {
+  std::vector<std::string> argv;
+  std::string current = "";
+  bool in_token = false;
+  char quote = '\0';
+  for (std::size_t i = 0; i < command.size(); ++i) {
+    const char c = command[i];
+    if (quote == '\'') {
+      if (c == '\'') {
+        quote = '\0';
+      } else {
+        current += c;
+      }
+    } else if (quote == '"') {
+      if (c == '"') {
+        quote = '\0';
+      } else if (c == '\\' && i + 1 < command.size() &&
+                 std::string("\"\\$`").find(command[i + 1]) !=
+                     std::string::npos) {
+        current += command[++i];
+      } else {
+        current += c;
+      }
+    } else if (c == ' ' || c == '\t' || c == '\n') {
+      if (in_token) {
+        argv.push_back(current);
+        current.clear();
+        in_token = false;
+      }
+    } else {
+      in_token = true;
+      if (c == '\'' || c == '"') {
+        quote = c;
+      } else if (c == '\\' && i + 1 < command.size()) {
+        current += command[++i];
+      } else {
+        current += c;
+      }
+    }
+  }
+  if (in_token) {
+    argv.push_back(current);
+  }
+  return argv;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------- join command -------------------------------
+// ----------------------------------------------------------------------------
+std::string ProcessLauncher::join(const std::vector<std::string> &argv) {
+  std::string command = "";
+  for (const auto &arg : argv) {
+    if (!command.empty()) {
+      command += " ";
+    }
+    if (arg.empty() || arg.find_first_of(" \t\n'\"\\") != std::string::npos) {
+      // single quotes preserve everything but single quotes
+      std::string quoted = "'";
+      for (const char c : arg) {
+        quoted += (c == '\'') ? std::string("'\\''") : std::string(1, c);
+      }
+      command += quoted + "'";
+    } else {
+      command += arg;
+    }
+  }
+  return command;
+}
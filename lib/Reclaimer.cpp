@@ -0,0 +1,163 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "versioningCompiler/Reclaimer.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace vc;
+
+// ---------------------------------------------------------------------------
+// --------------------------- default constructor ---------------------------
+// ---------------------------------------------------------------------------
+Reclaimer::Reclaimer() : running(0), enabled(true), stopping(false) {
+  worker = std::thread(&Reclaimer::workerLoop, this);
+}
+
+// ---------------------------------------------------------------------------
+// --------------------------- default destructor ----------------------------
+// ---------------------------------------------------------------------------
+Reclaimer::~Reclaimer() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+  }
+  wakeup.notify_one();
+  worker.join();
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------ defer a task -------------------------------
+// ---------------------------------------------------------------------------
+void Reclaimer::defer(task_t task) {
+  if (!enabled) {
+    task();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    tasks.push_back(std::move(task));
+  }
+  wakeup.notify_one();
+  return;
+}
+
+// ---------------------------------------------------------------------------
+// -------------------------- defer a file removal ---------------------------
+// ---------------------------------------------------------------------------
+void Reclaimer::removeFile(const std::filesystem::path &file) {
+  if (file.empty()) {
+    return;
+  }
+  if (!enabled) {
+    std::remove(file.c_str());
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    files.push_back(file);
+  }
+  wakeup.notify_one();
+  return;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------- queue depth -------------------------------
+// ---------------------------------------------------------------------------
+std::size_t Reclaimer::pending() const {
+  std::lock_guard<std::mutex> lock(mtx);
+  return tasks.size() + files.size() + running;
+}
+
+// ---------------------------------------------------------------------------
+// --------------------------- wait for the queue ----------------------------
+// ---------------------------------------------------------------------------
+void Reclaimer::drain() {
+  std::unique_lock<std::mutex> lock(mtx);
+  idle.wait(lock, [this]() {
+    return tasks.empty() && files.empty() && running == 0;
+  });
+  return;
+}
+
+// ---------------------------------------------------------------------------
+// --------------------------------- enable ----------------------------------
+// ---------------------------------------------------------------------------
+void Reclaimer::setEnabled(bool enable) {
+  enabled = enable;
+  return;
+}
+
+bool Reclaimer::isEnabled() const { return enabled; }
+
+// ---------------------------------------------------------------------------
+// -------------------------- get default reclaimer --------------------------
+// ---------------------------------------------------------------------------
+Reclaimer &Reclaimer::getDefault() {
+  // intentionally leaked: Versions may be destroyed by static destructors
+  static Reclaimer *reclaimer = []() {
+    Reclaimer *r = new Reclaimer();
+    // files of the Versions destroyed last are not left behind. Static
+    // Versions built before the first call are destroyed after this handler
+    // has run: their teardown runs inline from then on
+    std::atexit([]() {
+      Reclaimer &r = getDefault();
+      r.setEnabled(false);
+      r.drain();
+    });
+    return r;
+  }();
+  return *reclaimer;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------- worker loop -------------------------------
+// ---------------------------------------------------------------------------
+void Reclaimer::workerLoop() {
+  std::unique_lock<std::mutex> lock(mtx);
+  while (true) {
+    wakeup.wait(lock, [this]() {
+      return stopping || !tasks.empty() || !files.empty();
+    });
+    if (tasks.empty() && files.empty()) {
+      break; // stopping
+    }
+    std::deque<task_t> batchTasks;
+    std::vector<std::filesystem::path> batchFiles;
+    batchTasks.swap(tasks);
+    batchFiles.swap(files);
+    running = batchTasks.size() + batchFiles.size();
+    lock.unlock();
+    for (auto &task : batchTasks) {
+      task();
+    }
+    batchTasks.clear(); // captured resources are released here as well
+    for (const auto &file : batchFiles) {
+      std::remove(file.c_str());
+    }
+    lock.lock();
+    running = 0;
+    if (tasks.empty() && files.empty()) {
+      idle.notify_all();
+    }
+  }
+  return;
+}
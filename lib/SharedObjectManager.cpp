@@ -0,0 +1,365 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "versioningCompiler/SharedObjectManager.hpp"
+#include "versioningCompiler/HashUtils.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <dlfcn.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace vc;
+
+namespace {
+// size of the huge pages backing the code
+const uintptr_t huge_page_size = 2 << 20;
+
+// page-aligned address range of a loaded segment
+struct Segment {
+  uintptr_t begin;
+  uintptr_t end;
+  int flags;
+};
+
+// PT_LOAD segments of an open handle
+std::vector<Segment> getLoadSegments(void *handle) {
+  struct Search {
+    const struct link_map *map;
+    std::vector<Segment> segments;
+  } search;
+  struct link_map *map = nullptr;
+  if (!handle || dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0 || !map) {
+    return search.segments;
+  }
+  search.map = map;
+  dl_iterate_phdr(
+      [](struct dl_phdr_info *info, size_t, void *data) -> int {
+        Search *search = static_cast<Search *>(data);
+        if (info->dlpi_addr != search->map->l_addr ||
+            std::strcmp(info->dlpi_name, search->map->l_name) != 0) {
+          return 0;
+        }
+        const uintptr_t page = sysconf(_SC_PAGESIZE);
+        for (int i = 0; i < info->dlpi_phnum; i++) {
+          const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+          if (phdr.p_type != PT_LOAD || phdr.p_memsz == 0) {
+            continue;
+          }
+          const uintptr_t start = info->dlpi_addr + phdr.p_vaddr;
+          search->segments.push_back(
+              {start & ~(page - 1),
+               (start + phdr.p_memsz + page - 1) & ~(page - 1),
+               static_cast<int>(phdr.p_flags)});
+        }
+        return 1;
+      },
+      &search);
+  return search.segments;
+}
+
+// true unless transparent huge pages are disabled or not supported
+bool transparentHugePagesEnabled() {
+  std::ifstream in("/sys/kernel/mm/transparent_hugepage/enabled");
+  std::string mode;
+  return std::getline(in, mode) && mode.find("[never]") == std::string::npos;
+}
+
+// Replaces [begin, begin + size) with a huge-page backed copy of its first
+// used bytes. The copy is moved over the original mapping by a single
+// mremap, so the code stays executable during the swap.
+bool remapHuge(uintptr_t begin, std::size_t used, std::size_t size, int prot) {
+  void *area = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  const bool hugetlb = area != MAP_FAILED;
+  if (!hugetlb) {
+    // no explicit huge page reserved: transparent ones need an aligned area
+    if (!transparentHugePagesEnabled()) {
+      return false;
+    }
+    void *raw = mmap(nullptr, size + huge_page_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+      return false;
+    }
+    const uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+    const uintptr_t aligned =
+        (start + huge_page_size - 1) & ~(huge_page_size - 1);
+    if (aligned > start) {
+      munmap(raw, aligned - start);
+    }
+    munmap(reinterpret_cast<void *>(aligned + size),
+           start + huge_page_size - aligned);
+    area = reinterpret_cast<void *>(aligned);
+    if (madvise(area, size, MADV_HUGEPAGE) != 0) {
+      munmap(area, size);
+      return false;
+    }
+  }
+  std::memcpy(area, reinterpret_cast<const void *>(begin), used);
+  if (mprotect(area, size, prot) != 0 ||
+      mremap(area, size, size, MREMAP_MAYMOVE | MREMAP_FIXED,
+             reinterpret_cast<void *>(begin)) == MAP_FAILED) {
+    munmap(area, size);
+    return false;
+  }
+  return true;
+}
+} // namespace
+
+// ---------------------------------------------------------------------------
+// ------------------------- acquire a shared object -------------------------
+// ---------------------------------------------------------------------------
+void *SharedObjectManager::acquire(const std::filesystem::path &bin,
+                                   int flags, std::string *error) {
+  struct stat st;
+  if (stat(bin.c_str(), &st) != 0) {
+    if (error) {
+      *error = bin.string() + " : file not found";
+    }
+    return nullptr;
+  }
+  const file_key_t file(st.st_dev, st.st_ino, flags);
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = byFile.find(file);
+    if (it != byFile.end()) {
+      return share(it->second);
+    }
+  }
+  // identical objects would share their writable state: opt-in only
+  const bool dedupe = contentDedupe;
+  content_key_t content(0, st.st_size, flags);
+  if (dedupe) {
+    // hashing may take a while, no lock is held
+    uint64_t h = hash_seed;
+    if (!hashFile(bin, h)) {
+      if (error) {
+        *error = bin.string() + " : cannot read file";
+      }
+      return nullptr;
+    }
+    std::get<0>(content) = h;
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = byFile.find(file);
+    if (it != byFile.end()) {
+      return share(it->second);
+    }
+    auto c = byContent.find(content);
+    if (c != byContent.end()) {
+      return share(c->second);
+    }
+  }
+  void *handle = dlopen(bin.c_str(), flags);
+  if (!handle) {
+    if (error) {
+      const char *reason = dlerror();
+      *error = reason ? std::string(reason) : bin.string();
+    }
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(mtx);
+  // the same object may have been opened in the meantime
+  void *known = nullptr;
+  auto f = byFile.find(file);
+  if (f != byFile.end()) {
+    known = f->second;
+  } else if (dedupe) {
+    auto c = byContent.find(content);
+    known = c != byContent.end() ? c->second : nullptr;
+  }
+  if (!known && entries.count(handle)) {
+    // the loader returns the object already open for this file, whatever
+    // the flags
+    known = handle;
+  }
+  if (known) {
+    // the loader counts references as well: drop the one just taken
+    dlclose(handle);
+    return share(known);
+  }
+  Entry &entry = entries[handle];
+  entry.refs = 1;
+  entry.file = file;
+  entry.content = content;
+  byFile[file] = handle;
+  if (dedupe) {
+    entry.byContent = true;
+    byContent[content] = handle;
+  }
+  return handle;
+}
+
+// ---------------------------------------------------------------------------
+// -------------------------- share an open handle ---------------------------
+// ---------------------------------------------------------------------------
+void *SharedObjectManager::share(void *handle) {
+  entries.at(handle).refs++;
+  return handle;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------- release a shared object -------------------------
+// ---------------------------------------------------------------------------
+bool SharedObjectManager::release(void *handle, std::string *error) {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = entries.find(handle);
+    if (it != entries.end()) {
+      if (--it->second.refs > 0) {
+        return true;
+      }
+      byFile.erase(it->second.file);
+      if (it->second.byContent) {
+        byContent.erase(it->second.content);
+      }
+      entries.erase(it);
+    }
+  }
+  // destructors of the shared object run without the lock
+  if (dlclose(handle)) {
+    if (error) {
+      const char *reason = dlerror();
+      *error = reason ? std::string(reason) : "dlclose failed";
+    }
+    return false;
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------- resolve a symbol -----------------------------
+// ---------------------------------------------------------------------------
+void *SharedObjectManager::resolve(void *handle, const std::string &symbol) {
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = entries.find(handle);
+  if (it == entries.end()) {
+    return dlsym(handle, symbol.c_str());
+  }
+  auto s = it->second.symbols.find(symbol);
+  if (s != it->second.symbols.end()) {
+    return s->second;
+  }
+  void *address = dlsym(handle, symbol.c_str());
+  it->second.symbols[symbol] = address;
+  return address;
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------- prefault segments ----------------------------
+// ---------------------------------------------------------------------------
+std::size_t SharedObjectManager::prefault(void *handle) const {
+  const uintptr_t page = sysconf(_SC_PAGESIZE);
+  std::size_t bytes = 0;
+  for (const Segment &segment : getLoadSegments(handle)) {
+    if (!(segment.flags & PF_R)) {
+      continue;
+    }
+    void *addr = reinterpret_cast<void *>(segment.begin);
+    const std::size_t size = segment.end - segment.begin;
+    madvise(addr, size, MADV_WILLNEED);
+    bool populated = false;
+#ifdef MADV_POPULATE_READ
+    const int advice =
+        (segment.flags & PF_W) ? MADV_POPULATE_WRITE : MADV_POPULATE_READ;
+    populated = madvise(addr, size, advice) == 0;
+#endif
+    if (!populated) {
+      // e.g. old kernel, or the RELRO part of a writable segment.
+      // Writing could race with the other users of the object
+      for (uintptr_t p = segment.begin; p < segment.end; p += page) {
+        (void)*reinterpret_cast<volatile const char *>(p);
+      }
+    }
+    bytes += size;
+  }
+  return bytes;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------ remap code on huge pages -------------------------
+// ---------------------------------------------------------------------------
+bool SharedObjectManager::remapHugePages(void *handle) {
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = entries.find(handle);
+  if (it == entries.end()) {
+    return false;
+  }
+  if (it->second.hugePages) {
+    return true; // shared with a Version which remapped it already
+  }
+  const std::vector<Segment> segments = getLoadSegments(handle);
+  bool remapped = false;
+  for (const Segment &code : segments) {
+    if (!(code.flags & PF_X) || code.begin % huge_page_size != 0) {
+      continue; // not linked with getHugePageOptions()
+    }
+    const uintptr_t end =
+        (code.end + huge_page_size - 1) & ~(huge_page_size - 1);
+    // the tail of the last huge page must be the reserved gap which
+    // separates the code from the next segment of the same object
+    bool gap = false;
+    for (const Segment &other : segments) {
+      if (other.begin >= end) {
+        gap = true;
+      } else if (other.begin != code.begin && other.end > code.begin) {
+        gap = false;
+        break;
+      }
+    }
+    if (gap && remapHuge(code.begin, code.end - code.begin,
+                         end - code.begin, PROT_READ | PROT_EXEC)) {
+      remapped = true;
+    }
+  }
+  it->second.hugePages = remapped;
+  return remapped;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------- number of open objects --------------------------
+// ---------------------------------------------------------------------------
+std::size_t SharedObjectManager::size() const {
+  std::lock_guard<std::mutex> lock(mtx);
+  return entries.size();
+}
+
+// ---------------------------------------------------------------------------
+// ----------------------------- content dedupe ------------------------------
+// ---------------------------------------------------------------------------
+void SharedObjectManager::setContentDedupe(bool enable) {
+  contentDedupe = enable;
+  return;
+}
+
+bool SharedObjectManager::hasContentDedupe() const { return contentDedupe; }
+
+// ---------------------------------------------------------------------------
+// ----------------------------- default manager -----------------------------
+// ---------------------------------------------------------------------------
+SharedObjectManager &SharedObjectManager::getDefault() {
+  // intentionally leaked: Versions may be released while the process exits
+  static SharedObjectManager *manager = new SharedObjectManager();
+  return *manager;
+}
@@ -0,0 +1,159 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "versioningCompiler/ThreadPool.hpp"
+
+using namespace vc;
+
+namespace {
+// pool and queue index of the calling thread, if it is a worker
+thread_local const ThreadPool *current_pool = nullptr;
+thread_local std::size_t current_index = 0;
+} // namespace
+
+// ----------------------------------------------------------------------------
+// --------------------------- detailed constructor ---------------------------
+// ----------------------------------------------------------------------------
+ThreadPool::ThreadPool(std::size_t numWorkers)
+    : pending(0), next_queue(0), stopping(false) {
+  if (numWorkers == 0) {
+    numWorkers = std::thread::hardware_concurrency();
+  }
+  if (numWorkers == 0) {
+    numWorkers = 1;
+  }
+  for (std::size_t i = 0; i < numWorkers; i++) {
+    queues.push_back(std::make_unique<WorkQueue>());
+  }
+  for (std::size_t i = 0; i < numWorkers; i++) {
+    workers.emplace_back(&ThreadPool::workerLoop, this, i);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// ---------------------------- default destructor ----------------------------
+// ----------------------------------------------------------------------------
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mtx);
+    stopping = true;
+  }
+  wakeup.notify_all();
+  for (auto &w : workers) {
+    w.join();
+  }
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------- submit task --------------------------------
+// ----------------------------------------------------------------------------
+void ThreadPool::submit(task_t task) {
+  std::size_t index;
+  if (current_pool == this) {
+    index = current_index;
+  } else {
+    index = next_queue++ % queues.size();
+  }
+  {
+    // increment under the lock to avoid lost wake-ups, and before the push
+    // so that a thief popping the task cannot decrement it below zero
+    std::lock_guard<std::mutex> lock(sleep_mtx);
+    pending++;
+  }
+  {
+    std::lock_guard<std::mutex> lock(queues[index]->mtx);
+    queues[index]->tasks.push_back(std::move(task));
+  }
+  wakeup.notify_one();
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------------- number of workers ----------------------------
+// ----------------------------------------------------------------------------
+std::size_t ThreadPool::size() const { return workers.size(); }
+
+// ----------------------------------------------------------------------------
+// ------------------------------ pending tasks -------------------------------
+// ----------------------------------------------------------------------------
+std::size_t ThreadPool::pendingTasks() const { return pending.load(); }
+
+// ----------------------------------------------------------------------------
+// ------------------------------- default pool -------------------------------
+// ----------------------------------------------------------------------------
+ThreadPool &ThreadPool::getDefault() {
+  // intentionally leaked: workers may still be compiling while the process
+  // exits and must not observe destroyed static objects
+  static ThreadPool *pool = new ThreadPool();
+  return *pool;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------ pop or steal --------------------------------
+// ----------------------------------------------------------------------------
+bool ThreadPool::tryPop(std::size_t index, task_t &task) {
+  {
+    // own queue: most recent task first
+    std::lock_guard<std::mutex> lock(queues[index]->mtx);
+    if (!queues[index]->tasks.empty()) {
+      task = std::move(queues[index]->tasks.back());
+      queues[index]->tasks.pop_back();
+      pending--;
+      return true;
+    }
+  }
+  for (std::size_t i = 1; i < queues.size(); i++) {
+    // other queues: oldest task first
+    WorkQueue &victim = *queues[(index + i) % queues.size()];
+    std::lock_guard<std::mutex> lock(victim.mtx);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      pending--;
+      return true;
+    }
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------- worker loop --------------------------------
+// ----------------------------------------------------------------------------
+void ThreadPool::workerLoop(std::size_t index) {
+  current_pool = this;
+  current_index = index;
+  task_t task;
+  while (true) {
+    if (tryPop(index, task)) {
+      try {
+        task();
+      } catch (...) {
+        // a failing task must not take the worker down with it
+      }
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mtx);
+    wakeup.wait(lock, [this]() { return stopping || pending.load() > 0; });
+    if (stopping && pending.load() == 0) {
+      return;
+    }
+  }
+}
@@ -19,24 +19,85 @@
  * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
  */
 #include "versioningCompiler/Version.hpp"
+#include "versioningCompiler/CompileScheduler.hpp"
+#include "versioningCompiler/HashUtils.hpp"
+#include "versioningCompiler/Reclaimer.hpp"
+#include "versioningCompiler/ThreadPool.hpp"
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdio>
 #include <dlfcn.h>
+#include <unistd.h>
 
 using namespace vc;
 
+namespace {
+// shared by the Versions with an empty component
+template <typename T> const std::shared_ptr<const T> &empty() {
+  static const std::shared_ptr<const T> *e =
+      new std::shared_ptr<const T>(std::make_shared<const T>());
+  return *e;
+}
+
+// interned options are the same if they have the same identifier
+bool sameOptions(const opt_list_t &a, const opt_list_t &b) {
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+                    [](const Option &x, const Option &y) {
+                      return x.getID() == y.getID();
+                    });
+}
+
+// the component of the previous Version, if value is equal to it. Empty
+// components are shared with the empty constant
+template <typename T>
+std::shared_ptr<const T> share(const Version *previous,
+                               std::shared_ptr<const T> Version::*component,
+                               const T &value) {
+  if (previous && *(previous->*component) == value) {
+    return previous->*component;
+  }
+  return value.empty() ? empty<T>() : std::make_shared<const T>(value);
+}
+
+std::shared_ptr<const opt_list_t>
+share(const Version *previous,
+      std::shared_ptr<const opt_list_t> Version::*component,
+      const opt_list_t &value) {
+  if (previous && sameOptions(*(previous->*component), value)) {
+    return previous->*component;
+  }
+  return value.empty() ? empty<opt_list_t>()
+                       : std::make_shared<const opt_list_t>(value);
+}
+} // namespace
+
 // ----------------------------------------------------------------------------
 // ----------------------- zero-parameters constructor ------------------------
 // ----------------------------------------------------------------------------
 Version::Version() {
   autoremoveFilesEnable = true;
-  functionName = {};
-  fileName_src = {};
+  functionName = empty<std::vector<std::string>>();
+  mapFnToIndex = empty<std::unordered_map<std::string, int>>();
+  fileName_src = empty<std::vector<std::filesystem::path>>();
+  sourceBuffers = empty<source_buffer_map_t>();
+  optionList = empty<opt_list_t>();
+  baseOptionList = empty<opt_list_t>();
+  genIRoptionList = empty<opt_list_t>();
+  optOptionList = empty<opt_list_t>();
   fileName_IR = "";
+  inMemoryIR = false;
   fileName_bin = "";
   symbol = {};
-  tags = {};
+  tags = empty<std::vector<std::string>>();
   lib_handle = nullptr;
+  loadFlags = RTLD_NOW | RTLD_LOCAL;
+  warmUp = false;
+  hugePages = false;
+  hugePagesMapped = false;
+  fastLoad = false;
+  lazySymbols = false;
+  binaryFd = -1;
   uuid_t uuid;
   char tmp[128];
   uuid_generate(uuid);
@@ -48,26 +109,42 @@ Version::Version() {
 // ---------------------------- default destructor ----------------------------
 // ----------------------------------------------------------------------------
 Version::~Version() {
-  if (lib_handle) {
-    compiler->releaseSymbol(&lib_handle); // close the shared object
-  }
   symbol.clear(); // invalide symbols
+  if (binaryFd >= 0) {
+    fileName_bin = ""; // the in-memory shared object is not a file
+  }
+  // unloading and removing files may block: the reclaimer does it
+  Reclaimer &reclaimer = Reclaimer::getDefault();
+  if (lib_handle || compiler || binaryFd >= 0) {
+    reclaimer.defer([compiler = compiler, handle = lib_handle, id = id,
+                     fd = binaryFd]() mutable {
+      if (handle) {
+        compiler->releaseSymbol(&handle); // close the shared object
+      }
+      if (compiler) {
+        compiler->releaseVersion(id); // drop compiler-side state, if any
+      }
+      if (fd >= 0) {
+        close(fd); // frees the in-memory shared object
+      }
+    });
+  }
   if (autoremoveFilesEnable) {
-    removeFile(fileName_bin);
-    removeFile(fileName_IR_opt);
-    removeFile(fileName_IR);
+    reclaimer.removeFile(fileName_bin);
+    reclaimer.removeFile(fileName_IR_opt);
+    reclaimer.removeFile(fileName_IR);
   }
 }
 
 // ----------------------------------------------------------------------------
 // ---------------------------------- get ID ----------------------------------
 // ----------------------------------------------------------------------------
-std::string Version::getID() const { return id; }
+const std::string &Version::getID() const { return id; }
 
 // ----------------------------------------------------------------------------
 // --------------------------------- get Tag ----------------------------------
 // ----------------------------------------------------------------------------
-std::vector<std::string> Version::getTags() const { return tags; }
+const std::vector<std::string> &Version::getTags() const { return *tags; }
 
 // ----------------------------------------------------------------------------
 // --------------------- has generated intermediate file ----------------------
@@ -79,6 +156,11 @@ bool Version::hasGeneratedIR() const { return (!fileName_IR.empty()); }
 // ----------------------------------------------------------------------------
 bool Version::hasOptimizedIR() const { return (!fileName_IR_opt.empty()); }
 
+// ----------------------------------------------------------------------------
+// ------------------------------ has in-memory IR ----------------------------
+// ----------------------------------------------------------------------------
+bool Version::hasInMemoryIR() const { return inMemoryIR; }
+
 // ----------------------------------------------------------------------------
 // ------------------------ has generated binary file -------------------------
 // ----------------------------------------------------------------------------
@@ -89,16 +171,43 @@ bool Version::hasGeneratedBin() const { return (!fileName_bin.empty()); }
 // ----------------------------------------------------------------------------
 bool Version::hasLoadedSymbol() const { return (!symbol.empty()); }
 
+// ----------------------------------------------------------------------------
+// --------------------------- has code on huge pages -------------------------
+// ----------------------------------------------------------------------------
+bool Version::hasHugePages() const { return hugePagesMapped; }
+
 // ----------------------------------------------------------------------------
 // -------------------------- load function pointer ---------------------------
 // ----------------------------------------------------------------------------
 void Version::loadSymbol() {
   if (symbol.empty() && hasGeneratedBin()) {
-    symbol = compiler->loadSymbols(fileName_bin, functionName, &lib_handle);
+    lazySymbols = compiler->supportsLazySymbols();
+    if (!lazySymbols) {
+      symbol = compiler->loadSymbols(fileName_bin, *functionName, &lib_handle);
+    } else if (compiler->openSharedObject(fileName_bin, loadFlags,
+                                          &lib_handle)) {
+      // symbols are resolved on first request
+      symbol.assign(functionName->size(), nullptr);
+    }
   }
   return;
 }
 
+// ----------------------------------------------------------------------------
+// ---------------------------- resolve a symbol ------------------------------
+// ----------------------------------------------------------------------------
+void *Version::resolveSymbol(std::size_t index) const {
+  void *s = __atomic_load_n(&symbol[index], __ATOMIC_ACQUIRE);
+  if (!s && lazySymbols && lib_handle) {
+    // concurrent callers resolve the same address
+    s = compiler->resolveSymbol(lib_handle, (*functionName)[index]);
+    if (s) {
+      __atomic_store_n(&symbol[index], s, __ATOMIC_RELEASE);
+    }
+  }
+  return s;
+}
+
 // ----------------------------------------------------------------------------
 // ----------------------------------- fold -----------------------------------
 // ----------------------------------------------------------------------------
@@ -106,6 +215,7 @@ void Version::fold() {
   if (lib_handle) {
     compiler->releaseSymbol(&lib_handle);
     symbol.clear();
+    hugePagesMapped = false;
   }
   return;
 }
@@ -118,94 +228,360 @@ void *Version::reload() {
     fold();
   }
   symbol.clear();
-  loadSymbol();
-  return getSymbol();
+  return loadStage() ? getSymbol() : nullptr;
 }
 
 // ----------------------------------------------------------------------------
 // --------------------------- get function pointer ---------------------------
 // ----------------------------------------------------------------------------
-void *Version::getSymbol() const { return symbol.at(0); }
+void *Version::getSymbol() const {
+  symbol.at(0); // bounds check
+  return resolveSymbol(0);
+}
 
 // ----------------------------------------------------------------------------
 // --------------------------- get function pointer ---------------------------
 // ----------------------------------------------------------------------------
-void *Version::getSymbol(const int index) const { return symbol.at(index); }
+void *Version::getSymbol(const int index) const {
+  symbol.at(index); // bounds check
+  return resolveSymbol(index);
+}
 
 // ----------------------------------------------------------------------------
 // --------------------------- get function pointer ---------------------------
 // ----------------------------------------------------------------------------
-std::vector<void *> Version::getSymbols() const { return symbol; }
+std::vector<void *> Version::getSymbols() const {
+  // entries are read atomically: lazy resolution may be writing them
+  std::vector<void *> symbols(symbol.size(), nullptr);
+  for (std::size_t i = 0; i < symbols.size(); i++) {
+    symbols[i] = resolveSymbol(i);
+  }
+  return symbols;
+}
+
+// ----------------------------------------------------------------------------
+// --------------------------- get symbol count -------------------------------
+// ----------------------------------------------------------------------------
+std::size_t Version::getSymbolCount() const { return symbol.size(); }
 
 // ----------------------------------------------------------------------------
 // --------------------------- get function pointer ---------------------------
 // ----------------------------------------------------------------------------
 void *Version::getSymbol(const std::string &functionName) const {
-  using map_finder_t = decltype(mapFnToIndex)::const_iterator;
-  map_finder_t it = mapFnToIndex.find(functionName);
-  if (it != mapFnToIndex.end()) {
-    return getSymbol(it->second);
+  const int index = getSymbolIndex(functionName);
+  if (index >= 0) {
+    return getSymbol(index);
   }
   return nullptr;
 }
 
+// ----------------------------------------------------------------------------
+// ---------------------------- get symbol index ------------------------------
+// ----------------------------------------------------------------------------
+int Version::getSymbolIndex(const std::string &functionName) const {
+  const auto it = mapFnToIndex->find(functionName);
+  if (it != mapFnToIndex->end()) {
+    return it->second;
+  }
+  return -1;
+}
+
 // ----------------------------------------------------------------------------
 // ----------------- prepare intermediate and optimized file ------------------
 // ----------------------------------------------------------------------------
 bool Version::prepareIR() {
+  return runOnce(
+      inFlightIR,
+      [this]() {
+        return hasGeneratedIR() &&
+               (hasOptimizedIR() || !compiler->hasOptimizer());
+      },
+      [this]() { return runPrepareIR(); });
+}
+
+// ----------------------------------------------------------------------------
+// -------------------------- compile to binary file --------------------------
+// ----------------------------------------------------------------------------
+bool Version::compile() {
+  return runOnce(
+      inFlightCompile,
+      [this]() { return hasGeneratedBin() && hasLoadedSymbol(); },
+      [this]() { return runCompile(); });
+}
+
+// ----------------------------------------------------------------------------
+// ---------------------------- single-flight stage ---------------------------
+// ----------------------------------------------------------------------------
+bool Version::runOnce(std::shared_future<bool> &inFlight,
+                      const std::function<bool()> &isDone,
+                      const std::function<bool()> &stage) {
+  std::promise<bool> promise;
+  std::shared_future<bool> running;
+  if (!claimStage(inFlight, promise, running)) {
+    return running.get(); // join the running stage
+  }
+  bool result = false;
+  try {
+    // stages read each other's outputs: one at a time
+    std::lock_guard<std::mutex> stageLock(stageMtx);
+    result = isDone() || stage();
+  } catch (...) {
+    releaseStage(inFlight);
+    promise.set_exception(std::current_exception());
+    throw;
+  }
+  releaseStage(inFlight);
+  promise.set_value(result);
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------- claim stage --------------------------------
+// ----------------------------------------------------------------------------
+bool Version::claimStage(std::shared_future<bool> &inFlight,
+                         std::promise<bool> &promise,
+                         std::shared_future<bool> &result) {
+  std::lock_guard<std::mutex> lock(inFlightMtx);
+  if (inFlight.valid()) {
+    result = inFlight;
+    return false;
+  }
+  inFlight = promise.get_future().share();
+  result = inFlight;
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------ release stage -------------------------------
+// ----------------------------------------------------------------------------
+void Version::releaseStage(std::shared_future<bool> &inFlight) {
+  std::lock_guard<std::mutex> lock(inFlightMtx);
+  inFlight = std::shared_future<bool>();
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------------- prepare IR body ----------------------------
+// ----------------------------------------------------------------------------
+bool Version::runPrepareIR() { return generateIRStage() && optimizeStage(); }
+
+// ----------------------------------------------------------------------------
+// ------------------------------- compile body -------------------------------
+// ----------------------------------------------------------------------------
+bool Version::runCompile() { return generateBinStage() && loadStage(); }
+
+// ----------------------------------------------------------------------------
+// ---------------------------- IR generation stage ---------------------------
+// ----------------------------------------------------------------------------
+bool Version::generateIRStage() {
   if (!compiler->hasIRSupport()) {
     return false;
   }
-  fileName_IR =
-      compiler->generateIR(fileName_src, functionName, id, genIRoptionList);
+  if (hasGeneratedIR()) {
+    return true;
+  }
+  fileName_IR = runCachedStage(
+      "IR", *fileName_src, *genIRoptionList, compiler->getBitcodeFileName(id),
+      [&]() {
+        return compiler->generateIR(*fileName_src, *functionName, id,
+                                    *genIRoptionList);
+      });
+  inMemoryIR = hasGeneratedIR() && compiler->hasInMemoryIR(id);
+  return hasGeneratedIR();
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------------- optimization stage ---------------------------
+// ----------------------------------------------------------------------------
+bool Version::optimizeStage() {
+  if (!compiler->hasOptimizer() || hasOptimizedIR()) {
+    return true;
+  }
   if (!hasGeneratedIR()) {
     return false;
   }
-  if (compiler->hasOptimizer()) {
-    fileName_IR_opt = compiler->runOptimizer(fileName_IR, id, optOptionList);
-    return hasOptimizedIR();
-  }
-  return true;
+  fileName_IR_opt = runCachedStage(
+      "opt", {fileName_IR}, *optOptionList,
+      compiler->getOptBitcodeFileName(id), [&]() {
+        return compiler->runOptimizer(fileName_IR, id, *optOptionList);
+      });
+  return hasOptimizedIR();
 }
 
 // ----------------------------------------------------------------------------
-// -------------------------- compile to binary file --------------------------
+// ------------------------------- codegen stage ------------------------------
 // ----------------------------------------------------------------------------
-bool Version::compile() {
-  if (hasGeneratedBin() && hasLoadedSymbol()) {
+bool Version::generateBinStage() {
+  if (hasGeneratedBin()) {
     return true;
   }
-  if (!hasGeneratedBin()) {
-    std::vector<std::filesystem::path> src;
-    if (!fileName_IR_opt.empty()) {
-      src.clear();
-      src.push_back(fileName_IR_opt);
-    } else if (!fileName_IR.empty()) {
-      src.clear();
-      src.push_back(fileName_IR);
-    } else {
-      src = fileName_src;
+  if (compiler->hasMemoryBinaries()) {
+    // the compiler writes into it, it falls back to disk on failure
+    const int fd = compiler->prepareMemoryBinary(id);
+    if (fd >= 0) {
+      binaryFd = fd;
     }
-    fileName_bin = compiler->generateBin(src, functionName, id, optionList);
   }
+  std::vector<std::filesystem::path> src;
+  if (!fileName_IR_opt.empty()) {
+    src.push_back(fileName_IR_opt);
+  } else if (!fileName_IR.empty()) {
+    src.push_back(fileName_IR);
+  } else {
+    src = *fileName_src;
+  }
+  const auto generate = [&]() {
+    return compiler->generateBin(src, *functionName, id, *optionList);
+  };
+  if (inMemoryIR) {
+    // there is no IR file to identify the binary in the cache
+    fileName_bin = generate();
+    return hasGeneratedBin();
+  }
+  fileName_bin = runCachedStage(
+      "bin", src, *optionList, compiler->getSharedObjectFileName(id), generate);
+  return hasGeneratedBin();
+}
+
+// ----------------------------------------------------------------------------
+// -------------------------------- load stage --------------------------------
+// ----------------------------------------------------------------------------
+bool Version::loadStage() {
   loadSymbol();
+  if (hugePages && lib_handle) {
+    // before the warm-up, which would fault in the file pages
+    hugePagesMapped = compiler->remapHugePages(lib_handle);
+  }
+  if (warmUp && hasLoadedSymbol()) {
+    warmUpStage();
+  }
   return hasLoadedSymbol();
 }
 
+// ---------------------------------------------------------------------------
+// ------------------------------ warm-up stage ------------------------------
+// ---------------------------------------------------------------------------
+void Version::warmUpStage() {
+  if (lib_handle) {
+    compiler->prefaultSharedObject(lib_handle);
+  }
+  getSymbols(); // no symbol lookup on the first calls
+  if (warmUpCallback) {
+    warmUpCallback(*this);
+  }
+  return;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------- asynchronous prepare IR --------------------------
+// ----------------------------------------------------------------------------
+std::shared_future<bool> Version::prepareIRAsync() {
+  version_ptr_t self = shared_from_this();
+  return ThreadPool::getDefault().async([self]() { return self->prepareIR(); });
+}
+
+// ----------------------------------------------------------------------------
+// -------------------------- asynchronous compile ----------------------------
+// ----------------------------------------------------------------------------
+std::shared_future<bool> Version::compileAsync() {
+  version_ptr_t self = shared_from_this();
+  return ThreadPool::getDefault().async([self]() { return self->compile(); });
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------ batch asynchronous compile ------------------------
+// ----------------------------------------------------------------------------
+std::vector<std::shared_future<bool>>
+vc::submit(const std::vector<version_ptr_t> &versions) {
+  // same stages of compile(): the scheduler overlaps codegen and loading
+  return CompileScheduler::getDefault().submit(versions, false);
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------ compute stage cache key ---------------------------
+// ----------------------------------------------------------------------------
+std::string
+Version::getCacheKey(const std::string &stage,
+                     const std::vector<std::filesystem::path> &input,
+                     const opt_list_t &options) const {
+  uint64_t h = hashString(stage);
+  h = hashString(compiler->getId(), h);
+  h = hashString(compiler->getCompilerVersion(), h);
+  h = hashString(std::to_string(options.size()), h);
+  for (const auto &o : options) {
+    h = hashString(compiler->getOptionString(o), h);
+  }
+  if (stage == "bin" && compiler->hasExportMaps()) {
+    // the export map lists the functions
+    for (const auto &f : *functionName) {
+      h = hashString(f, h);
+    }
+  }
+  for (const auto &file : input) {
+    // the extension selects the input language
+    h = hashString(file.extension().string(), h);
+    const auto buffer = sourceBuffers->find(file);
+    if (buffer != sourceBuffers->end()) {
+      h = hashString(*buffer->second, h);
+    } else if (!hashFile(file, h)) {
+      return "";
+    }
+  }
+  return hashToString(h);
+}
+
+// ----------------------------------------------------------------------------
+// ---------------------- run stage through the cache -------------------------
+// ----------------------------------------------------------------------------
+std::filesystem::path Version::runCachedStage(
+    const std::string &stage, const std::vector<std::filesystem::path> &input,
+    const opt_list_t &options, const std::filesystem::path &artifact,
+    const std::function<std::filesystem::path()> &generate) {
+  const std::shared_ptr<ArtifactCache> cache = compiler->getArtifactCache();
+  if (!cache) {
+    return generate();
+  }
+  const std::string key = getCacheKey(stage, input, options);
+  if (key.empty()) {
+    return generate();
+  }
+  const std::string extension = artifact.extension().string();
+  if (cache->lookup(key, extension, artifact)) {
+    return artifact;
+  }
+  if (cache->isKnownFailure(key)) {
+    return "";
+  }
+  const std::filesystem::path result = generate();
+  if (result.empty()) {
+    if (!compiler->isCancelled(id)) {
+      // a cancelled compilation says nothing about the configuration
+      cache->recordFailure(key);
+    }
+  } else {
+    cache->publish(key, extension, result);
+  }
+  return result;
+}
+
 // ----------------------------------------------------------------------------
 // ----------------- get ordered list of compilation options ------------------
 // ----------------------------------------------------------------------------
-const opt_list_t Version::getOptionList() const { return optionList; }
+const opt_list_t &Version::getOptionList() const { return *optionList; }
 
 // ----------------------------------------------------------------------------
 // ----------- get ordered list of intermediate generation options ------------
 // ----------------------------------------------------------------------------
-const opt_list_t Version::getGenIRoptionList() const { return genIRoptionList; }
+const opt_list_t &Version::getGenIRoptionList() const {
+  return *genIRoptionList;
+}
 
 // ----------------------------------------------------------------------------
 // ------------------ get ordered list of optimizer options -------------------
 // ----------------------------------------------------------------------------
-const opt_list_t Version::getOptOptionList() const { return optOptionList; }
+const opt_list_t &Version::getOptOptionList() const {
+  return *optOptionList;
+}
 
 // ----------------------------------------------------------------------------
 // ----------------------------- get compiler ID ------------------------------
@@ -215,68 +591,65 @@ std::string Version::getCompilerId() const { return compiler->getId(); }
 // ----------------------------------------------------------------------------
 // --------------------------- get function name ------------------------------
 // ----------------------------------------------------------------------------
-std::string Version::getFunctionName() const { return functionName.at(0); }
+const std::string &Version::getFunctionName() const {
+  return functionName->at(0);
+}
 
 // ----------------------------------------------------------------------------
 // --------------------------- get function name ------------------------------
 // ----------------------------------------------------------------------------
-std::string Version::getFunctionName(const int index) const {
-  return functionName.at(index);
+const std::string &Version::getFunctionName(const int index) const {
+  return functionName->at(index);
 }
 
 // ----------------------------------------------------------------------------
 // --------------------------- get function name ------------------------------
 // ----------------------------------------------------------------------------
-std::vector<std::string> Version::getFunctionNames() const {
-  return functionName;
+const std::vector<std::string> &Version::getFunctionNames() const {
+  return *functionName;
 }
 
 // ----------------------------------------------------------------------------
 // --------------------------- get source filename ----------------------------
 // ----------------------------------------------------------------------------
-std::filesystem::path Version::getFileName_src() const {
-  return fileName_src.at(0);
+const std::filesystem::path &Version::getFileName_src() const {
+  return fileName_src->at(0);
 }
 
 // ----------------------------------------------------------------------------
 // --------------------------- get source filename ----------------------------
 // ----------------------------------------------------------------------------
-std::filesystem::path Version::getFileName_src(const int index) const {
-  return fileName_src.at(index);
+const std::filesystem::path &
+Version::getFileName_src(const int index) const {
+  return fileName_src->at(index);
 }
 
 // ----------------------------------------------------------------------------
 // --------------------------- get source filename ----------------------------
 // ----------------------------------------------------------------------------
-std::vector<std::filesystem::path> Version::getFileNames_src() const {
-  return fileName_src;
+const std::vector<std::filesystem::path> &Version::getFileNames_src() const {
+  return *fileName_src;
 }
 
 // ----------------------------------------------------------------------------
 // ------------------------ get intermediate filename -------------------------
 // ----------------------------------------------------------------------------
-std::filesystem::path Version::getFileName_IR() const { return fileName_IR; }
+const std::filesystem::path &Version::getFileName_IR() const {
+  return fileName_IR;
+}
 
 // ----------------------------------------------------------------------------
 // ------------------------- get optimized filename ---------------------------
 // ----------------------------------------------------------------------------
-std::filesystem::path Version::getFileName_IR_opt() const {
+const std::filesystem::path &Version::getFileName_IR_opt() const {
   return fileName_IR_opt;
 }
 
 // ----------------------------------------------------------------------------
 // --------------------------- get binary filename ----------------------------
 // ----------------------------------------------------------------------------
-std::filesystem::path Version::getFileName_bin() const { return fileName_bin; }
-
-// ----------------------------------------------------------------------------
-// ------------------------------ remove file ---------------------------------
-// ----------------------------------------------------------------------------
-bool Version::removeFile(const std::filesystem::path &fileName) {
-  if (fileName.empty()) {
-    return true;
-  }
-  return remove(fileName.c_str()) != 0;
+const std::filesystem::path &Version::getFileName_bin() const {
+  return fileName_bin;
 }
 
 // ---------------------------------------------------------------------------
@@ -292,14 +665,20 @@ Version::Builder::Builder() { reset(); }
 // ------------------- constructor from a Version object ----------------------
 // ----------------------------------------------------------------------------
 Version::Builder::Builder(const Version *v) {
-  _functionName = v->functionName;
-  _fileName_src = v->fileName_src;
-  _fileName_IR = v->fileName_IR;
-  _optionList = v->optionList;
+  _functionName = *v->functionName;
+  _fileName_src = *v->fileName_src;
+  _sourceBuffers = *v->sourceBuffers;
+  _fileName_IR = v->inMemoryIR ? "" : v->fileName_IR; // no file to reuse
+  _optionList = *v->baseOptionList; // link options follow the flags below
   _compiler = v->compiler;
-  _genIROptionList = v->genIRoptionList;
-  _optOptionList = v->optOptionList;
+  _genIROptionList = *v->genIRoptionList;
+  _optOptionList = *v->optOptionList;
   _autoremoveFilesEnable = v->autoremoveFilesEnable;
+  _loadFlags = v->loadFlags;
+  _warmUp = v->warmUp;
+  _warmUpCallback = v->warmUpCallback;
+  _hugePages = v->hugePages;
+  _fastLoad = v->fastLoad;
 }
 
 // ----------------------------------------------------------------------------
@@ -333,28 +712,163 @@ Version::Builder::Builder(const std::vector<std::filesystem::path> &fileNames,
 // ---------------------- Version object finalization -------------------------
 // ----------------------------------------------------------------------------
 version_ptr_t Version::Builder::build() {
+  if (!_registry) {
+    return buildNew();
+  }
+  _version_ptr = _registry->getOrCreate(getConfigurationKey(),
+                                        [this]() { return buildNew(); });
+  return _version_ptr;
+}
+
+// ----------------------------------------------------------------------------
+// -------------------------- new Version object ------------------------------
+// ----------------------------------------------------------------------------
+version_ptr_t Version::Builder::buildNew() {
+  // unchanged components are shared with the last Version built
+  const version_ptr_t last = _version_ptr;
+  const Version *previous = last.get();
   _version_ptr = version_ptr_t(new Version());
-  _version_ptr->tags = _tags;
-  _version_ptr->functionName = _functionName;
-  for (int i = 0; i < _functionName.size(); i++) { // build reverse index
-    _version_ptr->mapFnToIndex[_functionName[i]] = i;
-  }
-  _version_ptr->fileName_src = _fileName_src;
-  _version_ptr->fileName_IR = _fileName_IR;
-  _version_ptr->compiler = _compiler;
-  _version_ptr->optionList = _optionList;
-  _version_ptr->genIRoptionList = _genIROptionList;
-  _version_ptr->optOptionList = _optOptionList;
-  _version_ptr->fileName_IR_opt = "";
-  _version_ptr->autoremoveFilesEnable = _autoremoveFilesEnable;
+  Version &v = *_version_ptr;
+  v.tags = share(previous, &Version::tags, _tags);
+  v.functionName = share(previous, &Version::functionName, _functionName);
+  if (previous && v.functionName == previous->functionName) {
+    v.mapFnToIndex = previous->mapFnToIndex;
+  } else if (!_functionName.empty()) {
+    std::unordered_map<std::string, int> mapFnToIndex;
+    for (std::size_t i = 0; i < _functionName.size(); i++) { // reverse index
+      mapFnToIndex[_functionName[i]] = static_cast<int>(i);
+    }
+    v.mapFnToIndex =
+        std::make_shared<const std::unordered_map<std::string, int>>(
+            std::move(mapFnToIndex));
+  }
+  v.fileName_src = share(previous, &Version::fileName_src, _fileName_src);
+  v.sourceBuffers = share(previous, &Version::sourceBuffers, _sourceBuffers);
+  v.fileName_IR = _fileName_IR;
+  v.compiler = _compiler;
+  opt_list_t optionList;
+  opt_list_t genIROptionList;
+  std::size_t linkOptions = 0;
+  if (getEffectiveOptions(optionList, genIROptionList, linkOptions)) {
+    v.optionList = share(previous, &Version::optionList, optionList);
+    v.genIRoptionList =
+        share(previous, &Version::genIRoptionList, genIROptionList);
+  } else {
+    v.optionList = share(previous, &Version::optionList, _optionList);
+    v.genIRoptionList =
+        share(previous, &Version::genIRoptionList, _genIROptionList);
+  }
+  if (linkOptions == 0) {
+    v.baseOptionList = v.optionList;
+  } else {
+    // a Builder cloned from the Version adds the link options again
+    v.baseOptionList = share(
+        previous, &Version::baseOptionList,
+        opt_list_t(v.optionList->begin(), v.optionList->end() - linkOptions));
+  }
+  v.optOptionList = share(previous, &Version::optOptionList, _optOptionList);
+  v.fileName_IR_opt = "";
+  v.autoremoveFilesEnable = _autoremoveFilesEnable;
+  v.loadFlags = _loadFlags;
+  v.warmUp = _warmUp;
+  v.warmUpCallback = _warmUpCallback;
+  v.hugePages = _hugePages;
+  v.fastLoad = _fastLoad;
+  if (_compiler && !_sourceBuffers.empty()) {
+    _compiler->addSourceBuffers(v.id, _sourceBuffers);
+  }
+  return _version_ptr;
+}
+
+// ----------------------------------------------------------------------------
+// -------------------------- configuration key -------------------------------
+// ----------------------------------------------------------------------------
+std::string Version::Builder::getConfigurationKey() const {
+  // process-local: the compiler is identified by its address
+  uint64_t h = hashString(std::to_string(
+      reinterpret_cast<std::uintptr_t>(_compiler.get())));
+  h = hashString(std::to_string(_autoremoveFilesEnable), h);
+  h = hashString(std::to_string(_loadFlags), h);
+  // the callback cannot be compared: only its presence is part of the key
+  h = hashString(std::to_string(_warmUp) + std::to_string(!!_warmUpCallback),
+                 h);
+  h = hashString(std::to_string(_hugePages), h);
+  h = hashString(std::to_string(_fastLoad), h);
+  h = hashString(std::to_string(_functionName.size()), h);
+  for (const auto &f : _functionName) {
+    h = hashString(f, h);
+  }
+  h = hashString(std::to_string(_fileName_src.size()), h);
+  for (const auto &file : _fileName_src) {
+    h = hashString(file.string(), h);
+    const auto buffer = _sourceBuffers.find(file);
+    if (buffer != _sourceBuffers.end()) {
+      h = hashString(*buffer->second, h);
+    } else if (!hashFile(file, h)) {
+      h = hashString("", h); // not readable: identified by name only
+    }
+  }
+  h = hashString(_fileName_IR.string(), h);
+  // defines are hashed as the options they become, so that a Builder cloned
+  // from a Version has the same key of the Builder of that Version
+  opt_list_t optionList;
+  opt_list_t genIROptionList;
+  std::size_t linkOptions = 0;
+  const bool defined =
+      getEffectiveOptions(optionList, genIROptionList, linkOptions);
+  const opt_list_t *lists[] = {defined ? &optionList : &_optionList,
+                               defined ? &genIROptionList : &_genIROptionList,
+                               &_optOptionList};
+  for (const opt_list_t *list : lists) {
+    h = hashString(std::to_string(list->size()), h);
+    for (const auto &o : *list) {
+      h = hashString(o.getPrefix(), h);
+      h = hashString(o.getValue(), h);
+    }
+  }
+  return hashToString(h);
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------- effective options ----------------------------
+// ---------------------------------------------------------------------------
+bool Version::Builder::getEffectiveOptions(opt_list_t &optionList,
+                                           opt_list_t &genIROptionList,
+                                           std::size_t &linkOptions) const {
+  bool changed = false;
+  linkOptions = 0;
+  const auto copy = [&]() {
+    if (!changed) {
+      optionList = _optionList;
+      genIROptionList = _genIROptionList;
+      changed = true;
+    }
+  };
   for (const auto &flag : _flagDefineList) {
     if (flag != "") {
+      copy();
       const Option flag_opt = getFunctionFlag(flag);
-      _version_ptr->optionList.push_front(flag_opt);
-      _version_ptr->genIRoptionList.push_front(flag_opt);
+      optionList.insert(optionList.begin(), flag_opt);
+      genIROptionList.insert(genIROptionList.begin(), flag_opt);
     }
   }
-  return _version_ptr;
+  if (_hugePages && _compiler) {
+    const opt_list_t link = _compiler->getHugePageOptions();
+    if (!link.empty()) {
+      copy();
+      optionList.insert(optionList.end(), link.begin(), link.end());
+      linkOptions += link.size();
+    }
+  }
+  if (_fastLoad && _compiler) {
+    const opt_list_t profile = _compiler->getFastLoadOptions();
+    if (!profile.empty()) {
+      copy();
+      optionList.insert(optionList.end(), profile.begin(), profile.end());
+      linkOptions += profile.size();
+    }
+  }
+  return changed;
 }
 
 // ----------------------------------------------------------------------------
@@ -366,12 +880,19 @@ void Version::Builder::reset() {
   _compiler = nullptr;
   _functionName.clear();
   _fileName_src.clear();
+  _sourceBuffers.clear();
   _fileName_IR = "";
   _optionList.clear();
   _genIROptionList.clear();
   _optOptionList.clear();
   _flagDefineList.clear();
   _autoremoveFilesEnable = true;
+  _loadFlags = RTLD_NOW | RTLD_LOCAL;
+  _warmUp = false;
+  _warmUpCallback = nullptr;
+  _hugePages = false;
+  _fastLoad = false;
+  _registry = nullptr;
   return;
 }
 
@@ -383,6 +904,18 @@ void Version::Builder::addSourceFile(const std::filesystem::path &src) {
   return;
 }
 
+// ----------------------------------------------------------------------------
+// ---------------------------- add source buffer -----------------------------
+// ----------------------------------------------------------------------------
+void Version::Builder::addSourceBuffer(const std::filesystem::path &name,
+                                       const std::string &contents) {
+  if (_sourceBuffers.find(name) == _sourceBuffers.end()) {
+    _fileName_src.push_back(name);
+  }
+  _sourceBuffers[name] = std::make_shared<const std::string>(contents);
+  return;
+}
+
 // ----------------------------------------------------------------------------
 // ------------------------------- add metadata -------------------------------
 // ----------------------------------------------------------------------------
@@ -437,7 +970,9 @@ void Version::Builder::optOptions(const opt_list_t options) {
 // ----------------------------------------------------------------------------
 void Version::Builder::removeOption(const std::string &tag) {
   auto check = [tag](const Option &_o) -> bool { return _o.getTag() == tag; };
-  _optionList.remove_if(check);
+  _optionList.erase(
+      std::remove_if(_optionList.begin(), _optionList.end(), check),
+      _optionList.end());
   return;
 }
 
@@ -446,7 +981,9 @@ void Version::Builder::removeOption(const std::string &tag) {
 // ----------------------------------------------------------------------------
 void Version::Builder::removeOptOption(const std::string &tag) {
   auto check = [tag](const Option &_o) -> bool { return _o.getTag() == tag; };
-  _optOptionList.remove_if(check);
+  _optOptionList.erase(
+      std::remove_if(_optOptionList.begin(), _optOptionList.end(), check),
+      _optOptionList.end());
   return;
 }
 
@@ -455,7 +992,9 @@ void Version::Builder::removeOptOption(const std::string &tag) {
 // ----------------------------------------------------------------------------
 void Version::Builder::removeGenIROption(const std::string &tag) {
   auto check = [tag](const Option &_o) -> bool { return _o.getTag() == tag; };
-  _genIROptionList.remove_if(check);
+  _genIROptionList.erase(
+      std::remove_if(_genIROptionList.begin(), _genIROptionList.end(), check),
+      _genIROptionList.end());
   return;
 }
 
@@ -486,15 +1025,9 @@ std::size_t Version::Builder::addFunctionName(const std::string &functionName) {
 version_ptr_t Version::Builder::createFromSO(
     const std::filesystem::path &sharedObject, const std::string &functionName,
     const compiler_ptr_t &compiler, bool autoremoveFilesEnable,
-    const std::vector<std::string> &tags) {
-  version_ptr_t v = version_ptr_t(new Version());
-  v->fileName_bin = sharedObject;
-  v->autoremoveFilesEnable = autoremoveFilesEnable;
-  v->functionName.push_back(functionName);
-  v->compiler = compiler;
-  v->tags = tags;
-  v->compile();
-  return v;
+    const std::vector<std::string> &tags, int loadFlags) {
+  return createFromSO(sharedObject, std::vector<std::string>{functionName},
+                      compiler, autoremoveFilesEnable, tags, loadFlags);
 }
 
 // ----------------------------------------------------------------------------
@@ -505,13 +1038,23 @@ Version::Builder::createFromSO(const std::filesystem::path &sharedObject,
                                const std::vector<std::string> &functionNames,
                                const compiler_ptr_t &compiler,
                                bool autoremoveFilesEnable,
-                               const std::vector<std::string> &tags) {
+                               const std::vector<std::string> &tags,
+                               int loadFlags) {
   version_ptr_t v = version_ptr_t(new Version());
   v->fileName_bin = sharedObject;
   v->autoremoveFilesEnable = autoremoveFilesEnable;
-  v->functionName = functionNames;
+  v->functionName =
+      std::make_shared<const std::vector<std::string>>(functionNames);
+  std::unordered_map<std::string, int> mapFnToIndex;
+  for (std::size_t i = 0; i < functionNames.size(); i++) { // reverse index
+    mapFnToIndex[functionNames[i]] = static_cast<int>(i);
+  }
+  v->mapFnToIndex =
+      std::make_shared<const std::unordered_map<std::string, int>>(
+          std::move(mapFnToIndex));
+  v->loadFlags = loadFlags;
   v->compiler = compiler;
-  v->tags = tags;
+  v->tags = std::make_shared<const std::vector<std::string>>(tags);
   v->compile();
   return v;
 }
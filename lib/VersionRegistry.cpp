@@ -0,0 +1,511 @@
+/* Copyright 2017-2018 Politecnico di Milano.
+ * Developed by : Stefano Cherubin
+ *                PhD student, Politecnico di Milano
+ *                <first_name>.<family_name>@polimi.it
+ *
+ * This file is part of libVersioningCompiler
+ *
+ * libVersioningCompiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * libVersioningCompiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libVersioningCompiler. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "versioningCompiler/VersionRegistry.hpp"
+#include "versioningCompiler/Compiler.hpp"
+#include "versioningCompiler/HashUtils.hpp"
+#include "versioningCompiler/Version.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <tuple>
+#include <unistd.h>
+
+using namespace vc;
+
+namespace {
+const char *manifest_file_name = "manifest";
+const char *manifest_header = "vc_manifest 1";
+
+// file of the manifest and content hash of a Version artifact
+struct ManifestArtifact {
+  std::filesystem::path file;
+  std::string name;
+  std::string hash;
+};
+
+// a Version as it is described by the manifest
+struct ManifestEntry {
+  std::string compilerID;
+  bool autoremove = true;
+  int loadFlags = RTLD_NOW | RTLD_LOCAL;
+  bool warmUp = false;
+  bool hugePages = false;
+  bool fastLoad = false;
+  std::vector<std::string> tags;
+  std::vector<std::string> functions;
+  std::vector<std::filesystem::path> sources;
+  std::map<std::filesystem::path, ManifestArtifact> buffers;
+  opt_list_t optionList;
+  opt_list_t genIROptionList;
+  opt_list_t optOptionList;
+  ManifestArtifact ir;
+  ManifestArtifact irOpt;
+  ManifestArtifact bin;
+};
+
+// fields are separated by spaces: separators are percent-encoded and a lone
+// '%' stands for the empty string
+std::string escape(const std::string &s) {
+  if (s.empty()) {
+    return "%";
+  }
+  std::string escaped;
+  for (const char c : s) {
+    if (c == '%' || c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+      char buf[4];
+      std::snprintf(buf, sizeof(buf), "%%%02x", static_cast<unsigned char>(c));
+      escaped += buf;
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+std::string unescape(const std::string &s) {
+  std::string unescaped;
+  for (std::size_t i = 0; i < s.size(); i++) {
+    if (s[i] == '%' && i + 2 < s.size()) {
+      unescaped += static_cast<char>(
+          std::strtol(s.substr(i + 1, 2).c_str(), nullptr, 16));
+      i += 2;
+    } else if (s[i] != '%') {
+      unescaped += s[i];
+    }
+  }
+  return unescaped;
+}
+
+std::vector<std::string> splitFields(const std::string &line) {
+  std::vector<std::string> fields;
+  std::istringstream in(line);
+  std::string field;
+  while (in >> field) {
+    fields.push_back(unescape(field));
+  }
+  return fields;
+}
+
+bool readFile(const std::filesystem::path &file, std::string &content) {
+  std::ifstream in(file, std::ios::in | std::ios::binary);
+  if (!in.is_open()) {
+    return false;
+  }
+  std::ostringstream buf;
+  buf << in.rdbuf();
+  content = buf.str();
+  return !in.bad();
+}
+
+// writes through a temporary file, readers never see a partial file
+bool writeFile(const std::filesystem::path &file, const std::string &content) {
+  const std::filesystem::path tmp =
+      file.string() + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream out(tmp, std::ios::out | std::ios::binary);
+    if (!out.is_open() || !out.write(content.data(), content.size())) {
+      return false;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp, file, ec);
+  if (ec) {
+    std::filesystem::remove(tmp, ec);
+    return false;
+  }
+  return true;
+}
+
+// stores content in directory under the name of its hash
+bool storeArtifact(const std::string &content,
+                   const std::filesystem::path &directory,
+                   const std::filesystem::path &extension,
+                   ManifestArtifact &artifact) {
+  artifact.hash = hashToString(hashBytes(content.data(), content.size()));
+  artifact.name = artifact.hash + extension.string();
+  std::error_code ec;
+  if (std::filesystem::exists(directory / artifact.name, ec)) {
+    return true;
+  }
+  return writeFile(directory / artifact.name, content);
+}
+
+// the artifact line: <kind> <file> <name> <hash>
+void writeArtifact(std::ostream &out, const std::string &kind,
+                   const ManifestArtifact &artifact) {
+  out << kind << " " << escape(artifact.file.string()) << " "
+      << escape(artifact.name) << " " << escape(artifact.hash) << "\n";
+  return;
+}
+
+bool parseArtifact(const std::vector<std::string> &fields,
+                   ManifestArtifact &artifact) {
+  if (fields.size() != 4) {
+    return false;
+  }
+  artifact.file = std::filesystem::u8path(fields[1]);
+  artifact.name = fields[2];
+  artifact.hash = fields[3];
+  // names are generated by saveManifest, they never leave the directory
+  return artifact.name.find('/') == std::string::npos;
+}
+
+// reads the artifact back and checks its content hash
+bool loadArtifact(const std::filesystem::path &directory,
+                  const ManifestArtifact &artifact, std::string &content) {
+  return readFile(directory / artifact.name, content) &&
+         hashToString(hashBytes(content.data(), content.size())) ==
+             artifact.hash;
+}
+
+// links the artifact at the working file name of a Version
+bool restoreArtifact(const std::filesystem::path &directory,
+                     const ManifestArtifact &artifact,
+                     const std::filesystem::path &file) {
+  uint64_t h = hash_seed;
+  if (!hashFile(directory / artifact.name, h) ||
+      hashToString(h) != artifact.hash) {
+    return false;
+  }
+  std::error_code ec;
+  std::filesystem::remove(file, ec);
+  std::filesystem::create_hard_link(directory / artifact.name, file, ec);
+  if (ec) {
+    // e.g. the working directory is on another file system
+    ec.clear();
+    std::filesystem::copy_file(directory / artifact.name, file, ec);
+  }
+  return !ec;
+}
+} // namespace
+
+// ----------------------------------------------------------------------------
+// ------------------------- get or create a Version --------------------------
+// ----------------------------------------------------------------------------
+version_ptr_t
+VersionRegistry::getOrCreate(const std::string &key,
+                             const std::function<version_ptr_t()> &create) {
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = versions.find(key);
+  if (it != versions.end()) {
+    if (version_ptr_t v = it->second.lock()) {
+      return v;
+    }
+  }
+  // building a Version does not compile it, it is fine under the lock
+  version_ptr_t v = create();
+  if (v) {
+    versions[key] = v;
+    if (versions.size() > 2 * lastPurgeSize + 16) {
+      purge();
+    }
+  }
+  return v;
+}
+
+// ----------------------------------------------------------------------------
+// ----------------------------- find a Version -------------------------------
+// ----------------------------------------------------------------------------
+version_ptr_t VersionRegistry::find(const std::string &key) const {
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = versions.find(key);
+  if (it == versions.end()) {
+    return nullptr;
+  }
+  return it->second.lock();
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------- number of live Versions --------------------------
+// ----------------------------------------------------------------------------
+std::size_t VersionRegistry::size() const {
+  std::lock_guard<std::mutex> lock(mtx);
+  std::size_t count = 0;
+  for (const auto &entry : versions) {
+    if (!entry.second.expired()) {
+      count++;
+    }
+  }
+  return count;
+}
+
+// ----------------------------------------------------------------------------
+// ------------------------- remove expired entries ---------------------------
+// ----------------------------------------------------------------------------
+void VersionRegistry::purge() {
+  for (auto it = versions.begin(); it != versions.end();) {
+    if (it->second.expired()) {
+      it = versions.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  lastPurgeSize = versions.size();
+  return;
+}
+
+// ---------------------------------------------------------------------------
+// --------------------- save manifest of live Versions ----------------------
+// ---------------------------------------------------------------------------
+bool VersionRegistry::saveManifest(
+    const std::filesystem::path &directory) const {
+  std::vector<version_ptr_t> live;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (const auto &entry : versions) {
+      if (version_ptr_t v = entry.second.lock()) {
+        live.push_back(v);
+      }
+    }
+  }
+  return saveManifest(directory, live);
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------ save manifest ------------------------------
+// ---------------------------------------------------------------------------
+bool VersionRegistry::saveManifest(const std::filesystem::path &directory,
+                                   const std::vector<version_ptr_t> &versions) {
+  std::error_code ec;
+  std::filesystem::create_directories(directory, ec);
+  if (ec) {
+    return false;
+  }
+  std::ostringstream out;
+  out << manifest_header << "\n";
+  for (const auto &v : versions) {
+    if (!v || !v->compiler) {
+      continue;
+    }
+    out << "version " << escape(v->id) << "\n";
+    out << "compiler " << escape(v->compiler->getId()) << "\n";
+    out << "autoremove " << v->autoremoveFilesEnable << "\n";
+    out << "load_flags " << v->loadFlags << "\n";
+    out << "warm_up " << v->warmUp << "\n";
+    out << "huge_pages " << v->hugePages << "\n";
+    out << "fast_load " << v->fastLoad << "\n";
+    for (const auto &t : *v->tags) {
+      out << "tag " << escape(t) << "\n";
+    }
+    for (const auto &f : *v->functionName) {
+      out << "function " << escape(f) << "\n";
+    }
+    for (const auto &src : *v->fileName_src) {
+      out << "source " << escape(src.string()) << "\n";
+      const auto buffer = v->sourceBuffers->find(src);
+      if (buffer != v->sourceBuffers->end()) {
+        ManifestArtifact artifact;
+        artifact.file = src;
+        if (!storeArtifact(*buffer->second, directory, src.extension(),
+                           artifact)) {
+          return false;
+        }
+        writeArtifact(out, "buffer", artifact);
+      }
+    }
+    const std::pair<const char *, const opt_list_t *> lists[] = {
+        {"build", v->baseOptionList.get()},
+        {"genIR", v->genIRoptionList.get()},
+        {"opt", v->optOptionList.get()}};
+    for (const auto &list : lists) {
+      for (const auto &o : *list.second) {
+        out << "option " << list.first << " " << escape(o.getTag()) << " "
+            << escape(o.getPrefix()) << " " << escape(o.getValue()) << "\n";
+      }
+    }
+    const std::tuple<const char *, std::filesystem::path, const char *>
+        artifacts[] = {{"ir", v->fileName_IR, ".bc"},
+                       {"ir_opt", v->fileName_IR_opt, ".opt.bc"},
+                       {"bin", v->fileName_bin, ".so"}};
+    for (const auto &a : artifacts) {
+      if (v->inMemoryIR && std::string(std::get<0>(a)) != "bin") {
+        continue; // the IR files do not exist
+      }
+      ManifestArtifact artifact;
+      artifact.file = std::get<1>(a);
+      std::string content;
+      // e.g. not generated yet
+      if (artifact.file.empty() || !readFile(artifact.file, content)) {
+        continue;
+      }
+      if (!storeArtifact(content, directory, std::get<2>(a), artifact)) {
+        return false;
+      }
+      writeArtifact(out, std::get<0>(a), artifact);
+    }
+    out << "end\n";
+  }
+  return writeFile(directory / manifest_file_name, out.str());
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------ load manifest ------------------------------
+// ---------------------------------------------------------------------------
+std::vector<version_ptr_t>
+VersionRegistry::loadManifest(const std::filesystem::path &directory,
+                              const std::vector<compiler_ptr_t> &compilers,
+                              bool preload) {
+  std::vector<version_ptr_t> restored;
+  std::ifstream in(directory / manifest_file_name);
+  std::string line;
+  if (!in.is_open() || !std::getline(in, line) || line != manifest_header) {
+    return restored;
+  }
+  // builds the Version of entry, or finds the live one
+  const auto restore = [&](const ManifestEntry &entry) -> version_ptr_t {
+    compiler_ptr_t compiler;
+    for (const auto &c : compilers) {
+      if (c && c->getId() == entry.compilerID) {
+        compiler = c;
+      }
+    }
+    if (!compiler) {
+      return nullptr;
+    }
+    source_buffer_map_t buffers;
+    for (const auto &buffer : entry.buffers) {
+      std::string content;
+      if (!loadArtifact(directory, buffer.second, content)) {
+        return nullptr;
+      }
+      buffers[buffer.first] =
+          std::make_shared<const std::string>(std::move(content));
+    }
+    // the configuration of the Builder which built the Version
+    Version::Builder builder;
+    builder._tags = entry.tags;
+    builder._compiler = compiler;
+    builder._functionName = entry.functions;
+    builder._fileName_src = entry.sources;
+    builder._sourceBuffers = buffers;
+    builder._fileName_IR = entry.sources.empty() ? entry.ir.file : "";
+    builder._optionList = entry.optionList;
+    builder._genIROptionList = entry.genIROptionList;
+    builder._optOptionList = entry.optOptionList;
+    builder._autoremoveFilesEnable = entry.autoremove;
+    builder._loadFlags = entry.loadFlags;
+    builder._warmUp = entry.warmUp;
+    builder._hugePages = entry.hugePages;
+    builder._fastLoad = entry.fastLoad;
+    const std::string key = builder.getConfigurationKey();
+    if (version_ptr_t v = find(key)) {
+      return v;
+    }
+    version_ptr_t v = builder.build();
+    std::vector<std::filesystem::path> restoredFiles;
+    const std::tuple<const ManifestArtifact *, std::filesystem::path,
+                     std::filesystem::path *>
+        artifacts[] = {
+            {&entry.ir, compiler->getBitcodeFileName(v->id), &v->fileName_IR},
+            {&entry.irOpt, compiler->getOptBitcodeFileName(v->id),
+             &v->fileName_IR_opt},
+            {&entry.bin, compiler->getSharedObjectFileName(v->id),
+             &v->fileName_bin}};
+    for (const auto &a : artifacts) {
+      if (std::get<0>(a)->name.empty()) {
+        continue;
+      }
+      if (!restoreArtifact(directory, *std::get<0>(a), std::get<1>(a))) {
+        // the input IR of the Version is not its own file
+        v->autoremoveFilesEnable = false;
+        std::error_code ec;
+        for (const auto &file : restoredFiles) {
+          std::filesystem::remove(file, ec);
+        }
+        return nullptr;
+      }
+      restoredFiles.push_back(std::get<1>(a));
+      *std::get<2>(a) = std::get<1>(a);
+    }
+    return getOrCreate(key, [&]() { return v; });
+  };
+  ManifestEntry entry;
+  bool valid = true;
+  while (std::getline(in, line)) {
+    const std::vector<std::string> fields = splitFields(line);
+    if (fields.empty()) {
+      continue;
+    }
+    const std::string &kind = fields[0];
+    if (kind == "version") {
+      entry = ManifestEntry();
+      valid = true;
+    } else if (kind == "compiler" && fields.size() == 2) {
+      entry.compilerID = fields[1];
+    } else if (kind == "autoremove" && fields.size() == 2) {
+      entry.autoremove = (fields[1] != "0");
+    } else if (kind == "load_flags" && fields.size() == 2) {
+      entry.loadFlags = std::strtol(fields[1].c_str(), nullptr, 10);
+    } else if (kind == "warm_up" && fields.size() == 2) {
+      entry.warmUp = (fields[1] != "0");
+    } else if (kind == "huge_pages" && fields.size() == 2) {
+      entry.hugePages = (fields[1] != "0");
+    } else if (kind == "fast_load" && fields.size() == 2) {
+      entry.fastLoad = (fields[1] != "0");
+    } else if (kind == "tag" && fields.size() == 2) {
+      entry.tags.push_back(fields[1]);
+    } else if (kind == "function" && fields.size() == 2) {
+      entry.functions.push_back(fields[1]);
+    } else if (kind == "source" && fields.size() == 2) {
+      entry.sources.push_back(std::filesystem::u8path(fields[1]));
+    } else if (kind == "buffer") {
+      ManifestArtifact artifact;
+      valid = valid && parseArtifact(fields, artifact);
+      entry.buffers[artifact.file] = artifact;
+    } else if (kind == "option" && fields.size() == 5) {
+      const Option o(fields[2], fields[3], fields[4]);
+      if (fields[1] == "build") {
+        entry.optionList.push_back(o);
+      } else if (fields[1] == "genIR") {
+        entry.genIROptionList.push_back(o);
+      } else if (fields[1] == "opt") {
+        entry.optOptionList.push_back(o);
+      } else {
+        valid = false;
+      }
+    } else if (kind == "ir") {
+      valid = valid && parseArtifact(fields, entry.ir);
+    } else if (kind == "ir_opt") {
+      valid = valid && parseArtifact(fields, entry.irOpt);
+    } else if (kind == "bin") {
+      valid = valid && parseArtifact(fields, entry.bin);
+    } else if (kind == "end") {
+      if (valid) {
+        version_ptr_t v = restore(entry);
+        if (v) {
+          restored.push_back(v);
+        }
+      }
+    } else {
+      valid = false;
+    }
+  }
+  if (preload) {
+    for (const auto &v : restored) {
+      if (v->hasGeneratedBin() && !v->hasLoadedSymbol()) {
+        v->compileAsync();
+      }
+    }
+  }
+  return restored;
+}